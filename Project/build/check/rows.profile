@@ -0,0 +1 @@
+1000 0.1 1 rows 1 1 0.001
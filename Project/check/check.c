@@ -0,0 +1,894 @@
+/**
+ * @file check.c
+ * @brief Checks of the image formats and analyses of the library: round trips, and comparisons with brute force
+ * @author Saint-Cirgue Arnaud _ Correge Etienne
+ * @version 0.1
+ * @date november 2023
+ */
+
+/**
+ * Usage: check <image file> <work directory>
+ *
+ * Formats (tiled containers, streams, multi-image files and PAM) are written then read back, and compared pixel
+ * by pixel with the original. Analyses (labeling, cache, tracking, volumes, spatial index) are compared with
+ * straightforward implementations: flood fill, linear scans. Inputs are the given image, and random images
+ * (fixed seeds: every run checks the same pixels).
+ *
+ * One line is printed per check, and each failed condition on stderr; the exit code is 1 if any check failed.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <omp.h>
+
+#include "image_lib.h"
+#include "image_cache.h"
+#include "image_tracking.h"
+#include "image_volume.h"
+#include "image_spatial.h"
+
+/**
+ * @brief Report a failed condition, with its line, and count it
+ */
+#define CHECK(cond) do { \
+        if (!(cond)) { \
+            fprintf(stderr, "%s:%d: %s: check failed: %s\n", __FILE__, __LINE__, __FUNCTION__, #cond); \
+            num_failed++; \
+        } \
+    } while (0)
+
+static int num_failed = 0;
+static const char *work_dir;
+
+/**
+ * @brief Pseudo-random numbers (linear congruential generator), reproducible from a seed
+ * @param state (input/output) generator state
+ * @return a number in 0..2^31-1
+ */
+static int check_rand(unsigned long *state)
+{
+    *state = *state * 6364136223846793005UL + 1442695040888963407UL;
+    return (int)(*state >> 33);
+}
+
+/**
+ * @brief Path of a file of the work directory
+ * @param name file name
+ * @return path, valid until the next call
+ */
+static const char *check_path(const char *name)
+{
+    static char path[4096];
+    snprintf(path, sizeof(path), "%s/%s", work_dir, name);
+    return path;
+}
+
+/**
+ * @brief New image of random pixels
+ * @param width image width
+ * @param height image height
+ * @param type image type
+ * @param seed generator seed
+ * @param density bitmaps: percentage of foreground pixels (the top-left pixel is always background)
+ * @return Handle of a new image object
+ */
+static image_t *check_random_image(int width, int height, image_type_t type, unsigned long seed, int density)
+{
+    image_t *self = image_new(width, height, type);
+    assert(self);
+    for (int y = 0; y < height; ++y)
+    {
+        for (int x = 0; x < width; ++x)
+        {
+            int r = check_rand(&seed);
+            color_t c = {.u32 = 0};
+            switch (type)
+            {
+            case IMAGE_BITMAP:
+                c.bit = (x || y) && (r % 100 < density);
+                break;
+            case IMAGE_GRAYSCALE_8:
+                c.gs8 = r;
+                break;
+            case IMAGE_GRAYSCALE_16:
+                /* long runs too, for run-length encodings */
+                c.gs16 = (r % 4) ? (x / 16) * 7 : r;
+                break;
+            case IMAGE_RGB_888:
+                c.rgb = (rgb_t){r, r >> 8, r >> 16};
+                break;
+            default:
+                c.fl = r;
+                break;
+            }
+            self->setpixel(self, x, y, c);
+        }
+    }
+    return self;
+}
+
+/**
+ * @brief Compare the pixels of two images
+ * @return true if both images have the same type, dimensions and pixels
+ */
+static bool check_same_pixels(const image_t *a, const image_t *b)
+{
+    if (!a || !b || a->type != b->type || a->width != b->width || a->height != b->height)
+    {
+        return false;
+    }
+    for (int y = 0; y < a->height; ++y)
+    {
+        const uint8_t *row_a = image_row(a, y), *row_b = image_row(b, y);
+        if (a->type == IMAGE_BITMAP)
+        {
+            for (int x = 0; x < a->width; ++x)
+            {
+                if (image_bmp_row_get(row_a, x) != image_bmp_row_get(row_b, x))
+                {
+                    return false;
+                }
+            }
+        }
+        else if (memcmp(row_a, row_b, image_row_bytes(a->width, a->type)) != 0)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * @brief Compare an image with a region of another one (any abscissa, unlike views of bitmaps)
+ * @return true if both have the same type, and the pixels of a are those of b at (x, y)
+ */
+static bool check_same_region(const image_t *a, const image_t *b, int x, int y)
+{
+    if (!a || !b || a->type != b->type || x + a->width > b->width || y + a->height > b->height)
+    {
+        return false;
+    }
+    for (int j = 0; j < a->height; ++j)
+    {
+        for (int i = 0; i < a->width; ++i)
+        {
+            color_t ca = a->getpixel(a, i, j), cb = b->getpixel(b, x + i, y + j);
+            bool same;
+            switch (a->type)
+            {
+            case IMAGE_BITMAP:
+                same = (ca.bit == cb.bit);
+                break;
+            case IMAGE_GRAYSCALE_8:
+                same = (ca.gs8 == cb.gs8);
+                break;
+            case IMAGE_GRAYSCALE_16:
+                same = (ca.gs16 == cb.gs16);
+                break;
+            case IMAGE_RGB_888:
+                same = !memcmp(&ca.rgb, &cb.rgb, sizeof(rgb_t));
+                break;
+            default:
+                same = (ca.fl == cb.fl);
+                break;
+            }
+            if (!same)
+            {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+/**
+ * @brief Compare two labelings: same background, and a one-to-one mapping between the labels of both
+ * @param a labels (0 for background)
+ * @param b labels (0 for background)
+ * @param n number of labels of a and b
+ * @param num_labels labels are 0..num_labels
+ * @return true if both labelings define the same components
+ */
+static bool check_same_partition(const int *a, const int *b, size_t n, int num_labels)
+{
+    int *a_to_b = malloc((num_labels + 1) * sizeof(int));
+    int *b_to_a = malloc((num_labels + 1) * sizeof(int));
+    bool same = true;
+    assert(a_to_b && b_to_a);
+    memset(a_to_b, -1, (num_labels + 1) * sizeof(int));
+    memset(b_to_a, -1, (num_labels + 1) * sizeof(int));
+
+    for (size_t i = 0; i < n && same; ++i)
+    {
+        if (a[i] < 0 || a[i] > num_labels || b[i] < 0 || b[i] > num_labels || (a[i] == 0) != (b[i] == 0))
+        {
+            same = false;
+        }
+        else if (a_to_b[a[i]] < 0 && b_to_a[b[i]] < 0)
+        {
+            a_to_b[a[i]] = b[i];
+            b_to_a[b[i]] = a[i];
+        }
+        else
+        {
+            same = (a_to_b[a[i]] == b[i] && b_to_a[b[i]] == a[i]);
+        }
+    }
+    free(a_to_b);
+    free(b_to_a);
+    return same;
+}
+
+/**
+ * @brief Brute force 3D labeling: flood fill from each unlabeled foreground voxel (a 2D image is one slice)
+ * @param fg foreground flags, width x height x depth, x first
+ * @param width volume width
+ * @param height volume height
+ * @param depth number of slices
+ * @param connectivity 4 or 6 (voxels sharing a face), 26 (also an edge or a corner)
+ * @param labels (output) connected component numbers, 1..n in order of first voxel, 0 for background
+ * @return the number of connected components
+ */
+static int check_flood_fill(const bool *fg, int width, int height, int depth, int connectivity, int *labels)
+{
+    size_t n = (size_t)width * height * depth;
+    size_t *stack = malloc(n * sizeof(size_t));
+    int num_cc = 0;
+    assert(stack);
+    memset(labels, 0, n * sizeof(int));
+
+    for (size_t seed = 0; seed < n; ++seed)
+    {
+        if (!fg[seed] || labels[seed])
+        {
+            continue;
+        }
+        size_t top = 0;
+        labels[seed] = ++num_cc;
+        stack[top++] = seed;
+        while (top)
+        {
+            size_t v = stack[--top];
+            int x = v % width, y = (v / width) % height, z = v / ((size_t)width * height);
+            for (int dz = -1; dz <= 1; ++dz)
+            {
+                for (int dy = -1; dy <= 1; ++dy)
+                {
+                    for (int dx = -1; dx <= 1; ++dx)
+                    {
+                        int dist = ABS(dx) + ABS(dy) + ABS(dz);
+                        if (dist == 0 || (connectivity != 26 && dist > 1))
+                        {
+                            continue;
+                        }
+                        int nx = x + dx, ny = y + dy, nz = z + dz;
+                        if (nx < 0 || nx >= width || ny < 0 || ny >= height || nz < 0 || nz >= depth)
+                        {
+                            continue;
+                        }
+                        size_t w = ((size_t)nz * height + ny) * width + nx;
+                        if (fg[w] && !labels[w])
+                        {
+                            labels[w] = num_cc;
+                            stack[top++] = w;
+                        }
+                    }
+                }
+            }
+        }
+    }
+    free(stack);
+    return num_cc;
+}
+
+/**
+ * @brief Foreground flags of a bitmap (background: color of the top-left pixel)
+ * @return newly allocated table, width x height
+ */
+static bool *check_foreground(const image_t *bitmap)
+{
+    bool *fg = malloc((size_t)bitmap->width * bitmap->height * sizeof(bool));
+    bool bg_color = image_bmp_row_get(image_row(bitmap, 0), 0);
+    assert(fg);
+    for (int y = 0; y < bitmap->height; ++y)
+    {
+        for (int x = 0; x < bitmap->width; ++x)
+        {
+            fg[(size_t)y * bitmap->width + x] = image_bmp_row_get(image_row(bitmap, y), x) != bg_color;
+        }
+    }
+    return fg;
+}
+
+/**
+ * @brief Labels of a tag image, as a table
+ * @return newly allocated table, width x height
+ */
+static int *check_tags_table(const image_t *tags, int width, int height)
+{
+    int *labels = malloc((size_t)width * height * sizeof(int));
+    assert(labels);
+    for (int y = 0; y < height; ++y)
+    {
+        for (int x = 0; x < width; ++x)
+        {
+            labels[(size_t)y * width + x] = image_gs16_row(tags, y)[x];
+        }
+    }
+    return labels;
+}
+
+/**
+ * @brief Labeling: same components as a flood fill, with matching bounding boxes and sizes, with 1 and 4 threads
+ */
+static void check_labeling(const image_t *img)
+{
+    image_t *random = check_random_image(317, 211, IMAGE_BITMAP, 1, 45);
+    const image_t *inputs[] = {img, random};
+
+    for (int i = 0; i < 2; ++i)
+    {
+        const image_t *bitmap = inputs[i];
+        size_t n = (size_t)bitmap->width * bitmap->height;
+        bool *fg = check_foreground(bitmap);
+        int *expected = malloc(n * sizeof(int));
+        int num_expected = check_flood_fill(fg, bitmap->width, bitmap->height, 1, 4, expected);
+
+        for (int num_threads = 1; num_threads <= 4; num_threads += 3)
+        {
+            image_t *tags = image_new(bitmap->width, bitmap->height, IMAGE_GRAYSCALE_16);
+            ccl_stats_t stats;
+            omp_set_num_threads(num_threads);
+            int num_cc = image_connected_components(bitmap, tags, NULL, &stats);
+            CHECK(num_cc == num_expected);
+
+            int *labels = check_tags_table(tags, bitmap->width, bitmap->height);
+            CHECK(check_same_partition(labels, expected, n, MAX(num_cc, num_expected)));
+
+            /* bounding boxes and sizes, from the labels */
+            image_connected_component_t *boxes = calloc(MAX(num_cc, 1), sizeof(image_connected_component_t));
+            for (size_t p = 0; p < n && num_cc > 0; ++p)
+            {
+                if (labels[p] < 1 || labels[p] > num_cc)
+                {
+                    continue;
+                }
+                image_connected_component_t *cc = &boxes[labels[p] - 1];
+                int x = p % bitmap->width, y = p / bitmap->width;
+                if (cc->num_pixels++ == 0)
+                {
+                    *cc = (image_connected_component_t){.x1 = x, .x2 = x, .y1 = y, .y2 = y, .num_pixels = 1};
+                }
+                cc->x1 = MIN(cc->x1, x);
+                cc->x2 = MAX(cc->x2, x);
+                cc->y1 = MIN(cc->y1, y);
+                cc->y2 = MAX(cc->y2, y);
+            }
+            CHECK(num_cc <= 0 || !memcmp(boxes, stats.con_cmp, num_cc * sizeof(image_connected_component_t)));
+
+            free(boxes);
+            free(labels);
+            free(stats.con_cmp);
+            image_delete(tags);
+        }
+        free(expected);
+        free(fg);
+    }
+    image_delete(random);
+}
+
+/**
+ * @brief Tiled containers: whole image and random regions, raw and run-length encoded tiles, edge tiles
+ */
+static void check_tiled(const image_t *img)
+{
+    image_t *gs16 = check_random_image(203, 97, IMAGE_GRAYSCALE_16, 2, 0);
+    image_t *rgb = check_random_image(77, 131, IMAGE_RGB_888, 3, 0);
+    const image_t *inputs[] = {img, gs16, rgb};
+    const char *path = check_path("tiled.cclt");
+    unsigned long seed = 4;
+
+    for (int i = 0; i < 3; ++i)
+    {
+        const image_t *ref = inputs[i];
+        for (int compress = 0; compress <= 1; ++compress)
+        {
+            int tile_width = compress ? 64 : 24, tile_height = compress ? 48 : 7;
+            image_tiled_info_t info;
+            CHECK(image_tiled_save(ref, path, tile_width, tile_height, compress) == 0);
+            CHECK(image_tiled_info(path, &info) == 0);
+            CHECK(info.type == ref->type && info.width == ref->width && info.height == ref->height);
+            CHECK(info.tiles_x == (ref->width + tile_width - 1) / tile_width);
+            CHECK(info.tiles_y == (ref->height + tile_height - 1) / tile_height);
+
+            image_t *loaded = image_tiled_load(path);
+            CHECK(check_same_pixels(loaded, ref));
+            image_delete(loaded);
+
+            for (int k = 0; k < 20; ++k)
+            {
+                int x = check_rand(&seed) % ref->width, y = check_rand(&seed) % ref->height;
+                int width = 1 + check_rand(&seed) % (ref->width - x);
+                int height = 1 + check_rand(&seed) % (ref->height - y);
+                image_t *region = image_tiled_load_region(path, x, y, width, height);
+                CHECK(check_same_region(region, ref, x, y));
+                if (region)
+                {
+                    image_delete(region);
+                }
+            }
+        }
+    }
+    image_delete(rgb);
+    image_delete(gs16);
+}
+
+/**
+ * @brief Streams: images written by bands, read back whole and by bands, ASCII and binary, all types
+ */
+static void check_stream(const image_t *img)
+{
+    image_t *inputs[] = {
+        image_new_view(img, 0, 0, MIN(img->width, 333), MIN(img->height, 101)),
+        check_random_image(129, 45, IMAGE_GRAYSCALE_8, 5, 0),
+        check_random_image(61, 33, IMAGE_GRAYSCALE_16, 6, 0),
+        check_random_image(45, 29, IMAGE_RGB_888, 7, 0)};
+    const char *path = check_path("stream.pnm");
+
+    for (int i = 0; i < 4; ++i)
+    {
+        const image_t *ref = inputs[i];
+        for (int binary = 0; binary <= 1; ++binary)
+        {
+            image_stream_t *out = image_stream_create(path, ref->width, ref->height, ref->type, binary);
+            CHECK(out);
+            if (!out)
+            {
+                continue;
+            }
+            for (int y = 0; y < ref->height; y += 7)
+            {
+                image_t *band = image_new_view(ref, 0, y, ref->width, MIN(7, ref->height - y));
+                CHECK(image_stream_write(out, band, band->height) == 0);
+                image_delete(band);
+            }
+            CHECK(image_stream_close(out) == 0);
+
+            image_t *loaded = image_new_open(path);
+            CHECK(check_same_pixels(loaded, ref));
+            image_delete(loaded);
+
+            image_stream_t *in = image_stream_open(path);
+            CHECK(in);
+            if (!in)
+            {
+                continue;
+            }
+            image_t *band = image_stream_new_band(in, 5);
+            int y = 0, num_rows;
+            while ((num_rows = image_stream_read(in, band)) > 0)
+            {
+                image_t *read = image_new_view(band, 0, 0, ref->width, num_rows);
+                image_t *view = image_new_view(ref, 0, y, ref->width, num_rows);
+                CHECK(check_same_pixels(read, view));
+                image_delete(view);
+                image_delete(read);
+                y += num_rows;
+            }
+            CHECK(num_rows == 0 && y == ref->height);
+            image_delete(band);
+            image_stream_close(in);
+        }
+    }
+    for (int i = 0; i < 4; ++i)
+    {
+        image_delete(inputs[i]);
+    }
+}
+
+/**
+ * @brief Append a file to another one
+ */
+static void check_append(FILE *out, const char *fname)
+{
+    FILE *in = fopen(fname, "rb");
+    char buf[65536];
+    size_t n;
+    assert(in);
+    while ((n = fread(buf, 1, sizeof(buf), in)) > 0)
+    {
+        fwrite(buf, 1, n, out);
+    }
+    fclose(in);
+}
+
+/**
+ * @brief Multi-image files and PAM: images of all types and encodings concatenated, read back one by one
+ */
+static void check_reader(const image_t *img)
+{
+    image_t *images[] = {
+        image_new_view(img, 0, 0, MIN(img->width, 250), MIN(img->height, 80)),
+        check_random_image(131, 17, IMAGE_BITMAP, 8, 50),
+        check_random_image(67, 23, IMAGE_GRAYSCALE_8, 9, 0),
+        check_random_image(41, 19, IMAGE_GRAYSCALE_16, 10, 0),
+        check_random_image(37, 11, IMAGE_RGB_888, 11, 0),
+        check_random_image(53, 13, IMAGE_BITMAP, 12, 50),
+        check_random_image(29, 31, IMAGE_GRAYSCALE_16, 13, 0)};
+    /* encoding of each image: 0 ASCII, 1 binary, 2 PAM */
+    int encodings[] = {1, 0, 1, 0, 1, 2, 2};
+    int num_images = sizeof(images) / sizeof(images[0]);
+    char single[4096], multi[4096];
+    snprintf(single, sizeof(single), "%s", check_path("page.pnm"));
+    snprintf(multi, sizeof(multi), "%s", check_path("pages.pnm"));
+
+    FILE *fp = fopen(multi, "wb");
+    assert(fp);
+    for (int i = 0; i < num_images; ++i)
+    {
+        int res = (encodings[i] == 2) ? image_save_pam(images[i], single) : image_save(images[i], single, encodings[i]);
+        CHECK(res == 0);
+
+        /* single image files: the usual readers */
+        image_t *loaded = image_new_open(single);
+        CHECK(check_same_pixels(loaded, images[i]));
+        image_delete(loaded);
+        loaded = image_new_open_mmap(single);
+        CHECK(check_same_pixels(loaded, images[i]));
+        image_delete(loaded);
+
+        check_append(fp, single);
+    }
+    fclose(fp);
+
+    image_reader_t *reader = image_reader_open(multi);
+    CHECK(reader);
+    for (int i = 0; reader && i < num_images; ++i)
+    {
+        image_t *page = image_reader_next(reader);
+        CHECK(check_same_pixels(page, images[i]));
+        if (page)
+        {
+            image_delete(page);
+        }
+    }
+    if (reader)
+    {
+        CHECK(image_reader_next(reader) == NULL && !reader->error);
+        image_reader_close(reader);
+    }
+    for (int i = 0; i < num_images; ++i)
+    {
+        image_delete(images[i]);
+    }
+}
+
+/**
+ * @brief Cache: hits give the results of the labeling, with and without label maps
+ */
+static void check_cache(const image_t *img)
+{
+    image_t *ref_tags = image_new(img->width, img->height, IMAGE_GRAYSCALE_16);
+    ccl_stats_t ref;
+    int ref_cc = image_connected_components(img, ref_tags, NULL, &ref);
+    const char *dirs[] = {"cache.labels", "cache.tables"};
+
+    for (int store_labels = 1; store_labels >= 0; --store_labels)
+    {
+        ccl_cache_set_dir(check_path(dirs[!store_labels]), store_labels);
+        for (int pass = 0; pass < 2; ++pass)
+        {
+            /* pass 0 stores the entry (the cache directories start empty), pass 1 hits it */
+            image_t *tags = image_new(img->width, img->height, IMAGE_GRAYSCALE_16);
+            ccl_stats_t stats;
+            int num_cc = image_connected_components(img, tags, NULL, &stats);
+            CHECK(num_cc == ref_cc);
+            CHECK(!memcmp(stats.con_cmp, ref.con_cmp, ref_cc * sizeof(image_connected_component_t)));
+            CHECK(stats.cached == (pass ? (store_labels ? 2 : 1) : 0));
+            CHECK(stats.cached == 1 || check_same_pixels(tags, ref_tags));
+            free(stats.con_cmp);
+
+            /* without stats, a hit without label map labels the image */
+            CHECK(image_connected_components(img, tags, NULL, NULL) == ref_cc);
+            CHECK(check_same_pixels(tags, ref_tags));
+            image_delete(tags);
+        }
+    }
+    ccl_cache_set_dir(NULL, false);
+    free(ref.con_cmp);
+    image_delete(ref_tags);
+}
+
+/**
+ * @brief Tracking: each frame of a random sequence has the components of a flood fill; unchanged frames keep identities
+ * (on random frames, not on img)
+ */
+static void check_tracking(const image_t *img)
+{
+    (void)img;
+    int width = 173, height = 119;
+    image_t *frame = check_random_image(width, height, IMAGE_BITMAP, 14, 40);
+    ccl_sequence_t *seq = ccl_sequence_new(width, height);
+    unsigned long seed = 15;
+    size_t n = (size_t)width * height;
+    int *expected = malloc(n * sizeof(int));
+
+    for (int f = 0; f < 12; ++f)
+    {
+        if (f % 4 != 3)
+        {
+            /* change a few rectangles (not the top-left pixel, which sets the background color) */
+            for (int k = 0; k < 3; ++k)
+            {
+                int x1 = 1 + check_rand(&seed) % (width - 1), y1 = 1 + check_rand(&seed) % (height - 1);
+                int w = check_rand(&seed) % 30, h = check_rand(&seed) % 30;
+                int x2 = MIN(width - 1, x1 + w), y2 = MIN(height - 1, y1 + h);
+                int fill = check_rand(&seed) % 3;
+                for (int y = y1; y <= y2; ++y)
+                {
+                    for (int x = x1; x <= x2; ++x)
+                    {
+                        bool bit = (fill == 2) ? check_rand(&seed) % 2 : fill;
+                        image_bmp_row_set(image_row(frame, y), x, bit);
+                    }
+                }
+            }
+        }
+
+        ccl_track_t *prev = malloc(MAX(seq->num_tracks, 1) * sizeof(ccl_track_t));
+        int num_prev = seq->num_tracks;
+        memcpy(prev, seq->tracks, num_prev * sizeof(ccl_track_t));
+
+        int num_cc = ccl_sequence_push(seq, frame);
+        bool *fg = check_foreground(frame);
+        int num_expected = check_flood_fill(fg, width, height, 1, 4, expected);
+        CHECK(num_cc == num_expected);
+
+        int *labels = check_tags_table(seq->tags, width, height);
+        CHECK(check_same_partition(labels, expected, n, MAX(num_cc, num_expected)));
+
+        /* sizes, and unique identifiers */
+        unsigned int *sizes = calloc(MAX(num_cc, 1) + 1, sizeof(unsigned int));
+        for (size_t p = 0; p < n; ++p)
+        {
+            sizes[LIMIT(labels[p], 0, num_cc)]++;
+        }
+        for (int t = 0; t < num_cc; ++t)
+        {
+            CHECK(seq->tracks[t].cc.num_pixels == sizes[t + 1]);
+            for (int u = 0; u < t; ++u)
+            {
+                CHECK(seq->tracks[u].id != seq->tracks[t].id);
+            }
+        }
+
+        if (f % 4 == 3)
+        {
+            /* same frame again: every component keeps its identity */
+            CHECK(num_cc == num_prev && seq->num_new == 0 && seq->num_lost == 0);
+            for (int t = 0; t < MIN(num_cc, num_prev); ++t)
+            {
+                CHECK(seq->tracks[t].id == prev[t].id && seq->tracks[t].age == prev[t].age + 1);
+            }
+        }
+        free(sizes);
+        free(labels);
+        free(fg);
+        free(prev);
+    }
+    free(expected);
+    ccl_sequence_delete(seq);
+    image_delete(frame);
+}
+
+/**
+ * @brief Volumes: same components as a 3D flood fill, 6- and 26-connectivity, 1 and 4 threads (on random slices,
+ * not on img)
+ */
+static void check_volume(const image_t *img)
+{
+    (void)img;
+    int width = 53, height = 41, depth = 17;
+    size_t n = (size_t)width * height * depth;
+    bool *fg = malloc(n * sizeof(bool));
+    int *expected = malloc(n * sizeof(int));
+    int *labels = malloc(n * sizeof(int));
+
+    for (int density = 15; density <= 30; density += 15)
+    {
+        image_t **slices = malloc(depth * sizeof(image_t *));
+        for (int z = 0; z < depth; ++z)
+        {
+            slices[z] = check_random_image(width, height, IMAGE_BITMAP, 16 + z + density, density);
+            for (int y = 0; y < height; ++y)
+            {
+                for (int x = 0; x < width; ++x)
+                {
+                    fg[((size_t)z * height + y) * width + x] = image_bmp_row_get(image_row(slices[z], y), x);
+                }
+            }
+        }
+        image_volume_t *volume = image_volume_new_from_slices(slices, depth);
+        CHECK(volume && image_volume_num_voxels(volume) == n);
+
+        for (int connectivity = CCL_CONNECT_6; volume && connectivity <= CCL_CONNECT_26; connectivity += 20)
+        {
+            int num_expected = check_flood_fill(fg, width, height, depth, connectivity, expected);
+            for (int num_threads = 1; num_threads <= 4; num_threads += 3)
+            {
+                ccl_volume_stats_t stats;
+                omp_set_num_threads(num_threads);
+                int num_cc = image_volume_connected_components(volume, labels, connectivity, &stats);
+                CHECK(num_cc == num_expected);
+                CHECK(check_same_partition(labels, expected, n, MAX(num_cc, num_expected)));
+
+                unsigned long *sizes = calloc(MAX(num_cc, 1) + 1, sizeof(unsigned long));
+                for (size_t v = 0; v < n; ++v)
+                {
+                    sizes[LIMIT(labels[v], 0, num_cc)]++;
+                }
+                for (int t = 0; t < num_cc; ++t)
+                {
+                    CHECK(stats.con_cmp[t].num_voxels == sizes[t + 1]);
+                }
+                free(sizes);
+                free(stats.con_cmp);
+            }
+        }
+        image_volume_delete(volume);
+        free(slices);
+    }
+    free(labels);
+    free(expected);
+    free(fg);
+}
+
+/**
+ * @brief Compare two ints, for qsort()
+ */
+static int check_compare_ints(const void *a, const void *b)
+{
+    return *(const int *)a - *(const int *)b;
+}
+
+/**
+ * @brief Squared distance from a pixel to a bounding box
+ */
+static long check_distance2(const image_connected_component_t *cc, int x, int y)
+{
+    long dx = MAX(0, MAX(cc->x1 - x, x - cc->x2));
+    long dy = MAX(0, MAX(cc->y1 - y, y - cc->y2));
+    return dx * dx + dy * dy;
+}
+
+/**
+ * @brief Spatial index: rectangle, point and nearest neighbors queries give the results of linear scans
+ */
+static void check_spatial(const image_t *img)
+{
+    image_t *tags = image_new(img->width, img->height, IMAGE_GRAYSCALE_16);
+    ccl_stats_t stats;
+    int num_cc = image_connected_components(img, tags, NULL, &stats);
+    const image_connected_component_t *con_cmp = stats.con_cmp;
+    ccl_index_t *index = ccl_index_new(con_cmp, num_cc, img->width, img->height);
+    int *found = malloc(MAX(num_cc, 1) * sizeof(int));
+    int *expected = malloc(MAX(num_cc, 1) * sizeof(int));
+    unsigned long seed = 17;
+    CHECK(index);
+
+    for (int k = 0; index && k < 200; ++k)
+    {
+        int x1 = check_rand(&seed) % img->width - 10, y1 = check_rand(&seed) % img->height - 10;
+        int x2 = x1 + check_rand(&seed) % (img->width / 4), y2 = y1 + check_rand(&seed) % (img->height / 4);
+
+        /* rectangle: any order, each component once */
+        int num_found = ccl_index_query_rect(index, x1, y1, x2, y2, found, num_cc);
+        int num_expected = 0;
+        for (int t = 0; t < num_cc; ++t)
+        {
+            const image_connected_component_t *cc = &con_cmp[t];
+            if (cc->num_pixels && cc->x1 <= x2 && x1 <= cc->x2 && cc->y1 <= y2 && y1 <= cc->y2)
+            {
+                expected[num_expected++] = t;
+            }
+        }
+        qsort(found, MIN(num_found, num_cc), sizeof(int), check_compare_ints);
+        CHECK(num_found == num_expected && !memcmp(found, expected, num_found * sizeof(int)));
+
+        /* point: increasing order */
+        num_found = ccl_index_query_point(index, x1, y1, found, num_cc);
+        num_expected = 0;
+        for (int t = 0; t < num_cc; ++t)
+        {
+            if (con_cmp[t].num_pixels && check_distance2(&con_cmp[t], x1, y1) == 0)
+            {
+                expected[num_expected++] = t;
+            }
+        }
+        CHECK(num_found == num_expected && !memcmp(found, expected, num_found * sizeof(int)));
+
+        /* nearest: by distance, then index; a linear scan keeps the best one not yet taken */
+        int num_nearest = 1 + k % 8;
+        num_found = ccl_index_nearest(index, x2, y2, num_nearest, found);
+        num_expected = 0;
+        for (int i = 0; i < num_nearest; ++i)
+        {
+            int best = -1;
+            for (int t = 0; t < num_cc; ++t)
+            {
+                bool taken = false;
+                for (int j = 0; j < num_expected && !taken; ++j)
+                {
+                    taken = (expected[j] == t);
+                }
+                if (!con_cmp[t].num_pixels || taken)
+                {
+                    continue;
+                }
+                if (best < 0 || check_distance2(&con_cmp[t], x2, y2) < check_distance2(&con_cmp[best], x2, y2))
+                {
+                    best = t;
+                }
+            }
+            if (best >= 0)
+            {
+                expected[num_expected++] = best;
+            }
+        }
+        CHECK(num_found == num_expected && !memcmp(found, expected, num_found * sizeof(int)));
+    }
+
+    if (index)
+    {
+        ccl_index_delete(index);
+    }
+    free(expected);
+    free(found);
+    free(stats.con_cmp);
+    image_delete(tags);
+}
+
+int main(int argc, char **argv)
+{
+    if (argc < 3)
+    {
+        DIE("Usage: %s <image file> <work directory>\n", argv[0]);
+    }
+    work_dir = argv[2];
+    image_t *img = image_new_open(argv[1]);
+    if (!img || img->type != IMAGE_BITMAP)
+    {
+        DIE("Cannot open bitmap `%s`\n", argv[1]);
+    }
+
+    struct
+    {
+        const char *name;
+        void (*run)(const image_t *img);
+    } checks[] = {
+        {"labeling", check_labeling},
+        {"tiled", check_tiled},
+        {"stream", check_stream},
+        {"reader", check_reader},
+        {"cache", check_cache},
+        {"tracking", check_tracking},
+        {"volume", check_volume},
+        {"spatial", check_spatial}};
+    int num_checks = sizeof(checks) / sizeof(checks[0]);
+    int saved_threads = omp_get_max_threads();
+
+    for (int i = 0; i < num_checks; ++i)
+    {
+        int failed = num_failed;
+        printf("%s: ", checks[i].name);
+        fflush(stdout);
+        omp_set_num_threads(saved_threads);
+        checks[i].run(img);
+        printf("%s\n", (num_failed == failed) ? "ok" : "FAILED");
+    }
+
+    image_delete(img);
+    return num_failed ? 1 : 0;
+}
@@ -16,6 +16,16 @@
 
 #include "pixel.h"
 
+/**
+ * @brief Alignment of pixel buffers and of row strides allocated by image_new() (one cache line)
+ */
+#define IMAGE_ALIGN 64
+
+/**
+ * @brief Minimal buffer size for huge-page backing, when enabled by image_set_alloc_hugepages()
+ */
+#define IMAGE_HUGEPAGE_SIZE (2UL << 20)
+
 /**
  * @enum image_type_t
  * @brief List of supported image types
@@ -29,6 +39,28 @@ typedef enum
     IMAGE_RGB_888       /*!< 3-channel (RGB), 256-levels per channel, color image */
 } image_type_t;
 
+/**
+ * @enum image_alloc_policy_t
+ * @brief Placement policy of the pixel buffers allocated by image_new()
+ */
+typedef enum
+{
+    IMAGE_ALLOC_DEFAULT,     /*!< calloc(): pages are zeroed, hence placed, by the allocating thread */
+    IMAGE_ALLOC_FIRST_TOUCH, /*!< uninitialized buffer, zeroed in parallel with the row partitioning of the processing loops */
+    IMAGE_ALLOC_INTERLEAVE   /*!< pages spread round-robin over all allowed NUMA nodes */
+} image_alloc_policy_t;
+
+/**
+ * @enum image_mem_t
+ * @brief How the pixel data of an image was obtained, i.e. how image_delete() releases it
+ */
+typedef enum
+{
+    IMAGE_MEM_HEAP,     /*!< malloc()/calloc() block, released with free() */
+    IMAGE_MEM_MMAP,     /*!< anonymous or (read-only) file mapping, released with munmap() */
+    IMAGE_MEM_VIEW      /*!< borrowed from a parent image, never released by the view */
+} image_mem_t;
+
 /** 
  * @struct image_t
  * @brief image object ; this class holds an image metadata and pixels
@@ -38,41 +70,116 @@ typedef struct image_s
     image_type_t type;   /*!< image type (bitmap, grayscale, etc.) */
     int width;           /*!< image width (in pixels) */
     int height;          /*!< image height (in pixels) */
+    size_t stride;       /*!< distance between the starts of two consecutive rows (in bytes) */
     uint8_t *data;       /*!< pointer to pixel data table */
+    image_mem_t mem;     /*!< origin of the pixel data table */
+    void *mem_base;      /*!< start of the pixel data allocation (data may point past a file header) */
+    size_t mem_size;     /*!< size of the pixel data allocation (in bytes) */
     void (*setpixel)(struct image_s *self, int x, int y, color_t c); /*!< pixel setter method, specific to each image type */
     color_t (*getpixel)(const struct image_s *self, int x, int y);   /*!< pixel getter method, specific to each image type */
 } image_t;
 
 // constructors
-image_t *image_new(int width, int height, image_type_t type);
-image_t *image_new_from_mem(int width, int height, image_type_t type, void *mem);
+IMAGE_API image_t *image_new(int width, int height, image_type_t type);
+IMAGE_API image_t *image_new_from_mem(int width, int height, image_type_t type, void *mem);
+IMAGE_API image_t *image_new_from_mem_stride(int width, int height, image_type_t type, void *mem, size_t stride);
+IMAGE_API image_t *image_new_view(const image_t *parent, int x, int y, int width, int height);
+IMAGE_API void image_set_mem(image_t *self, image_mem_t kind, void *base, size_t size);
+
+// allocation policy
+IMAGE_API void image_set_alloc_policy(image_alloc_policy_t policy);
+IMAGE_API image_alloc_policy_t image_get_alloc_policy(void);
+IMAGE_API void image_set_alloc_hugepages(bool enable);
 
 // destructors
-void image_delete(image_t *self);
+IMAGE_API void image_delete(image_t *self);
 
 // output to console
-void image_print_details(const image_t *self);
-void image_print_ascii(const image_t *self);
+IMAGE_API void image_print_details(const image_t *self);
+IMAGE_API void image_print_ascii(const image_t *self);
 
 // methods
-uint8_t image_coord_check(const image_t *self, int x, int y);
+IMAGE_API size_t image_row_bytes(int width, image_type_t type);
+IMAGE_API uint8_t image_coord_check(const image_t *self, int x, int y);
+
+IMAGE_API void image_bmp_setpixel(image_t *self, int x, int y, color_t c);
+IMAGE_API color_t image_bmp_getpixel(const image_t *self, int x, int y);
+
+IMAGE_API void image_gs8_setpixel(image_t *self, int x, int y, color_t c);
+IMAGE_API color_t image_gs8_getpixel(const image_t *self, int x, int y);
 
-void image_bmp_setpixel(image_t *self, int x, int y, color_t c);
-color_t image_bmp_getpixel(const image_t *self, int x, int y);
+IMAGE_API void image_gs16_setpixel(image_t *self, int x, int y, color_t c);
+IMAGE_API color_t image_gs16_getpixel(const image_t *self, int x, int y);
 
-void image_gs8_setpixel(image_t *self, int x, int y, color_t c);
-color_t image_gs8_getpixel(const image_t *self, int x, int y);
+IMAGE_API void image_gsfl_setpixel(image_t *self, int x, int y, color_t c);
+IMAGE_API color_t image_gsfl_getpixel(const image_t *self, int x, int y);
 
-void image_gs16_setpixel(image_t *self, int x, int y, color_t c);
-color_t image_gs16_getpixel(const image_t *self, int x, int y);
+IMAGE_API void image_rgb_setpixel(image_t *self, int x, int y, color_t c);
+IMAGE_API color_t image_rgb_getpixel(const image_t *self, int x, int y);
 
-void image_gsfl_setpixel(image_t *self, int x, int y, color_t c);
-color_t image_gsfl_getpixel(const image_t *self, int x, int y);
+IMAGE_API void image_clear(const image_t *self);
 
-void image_rgb_setpixel(image_t *self, int x, int y, color_t c);
-color_t image_rgb_getpixel(const image_t *self, int x, int y);
+/**
+ * Coordinates check of the typed pixel accessors.
+ * Compile with the -DRELEASE flag to remove it from hot loops.
+ */
+#ifdef RELEASE
+#define IMAGE_COORD_ASSERT(self, x, y) do {} while(0)
+#else
+#define IMAGE_COORD_ASSERT(self, x, y) assert(image_coord_check((self), (x), (y)))
+#endif
+
+/**
+ * @brief Get a pointer to the first byte of a pixel row
+ * @param self handle to image object
+ * @param y ordinate of the row
+ * @return pointer to row pixel data
+ *
+ * Row-pointer accessors let hot loops dispatch on the image type once per image (or per row),
+ * then access pixels as plain arrays, which the compiler can inline and vectorize.
+ */
+static inline uint8_t *image_row(const image_t *self, int y)
+{
+    return self->data + (size_t)y * self->stride;
+}
+
+/**
+ * Generate a typed row accessor, e.g. image_gs16_row(self, y) returns a gs16_t * to row y.
+ * Row pointers are suitably aligned as long as the buffer and the stride are (which image_new() ensures).
+ */
+#define IMAGE_DEFINE_ROW_ACCESSOR(name, pixel_type) \
+    static inline pixel_type *image_##name##_row(const image_t *self, int y) \
+    { \
+        return (pixel_type *)image_row(self, y); \
+    }
 
-void image_clear(const image_t *self);
+IMAGE_DEFINE_ROW_ACCESSOR(gs8, gs8_t)
+IMAGE_DEFINE_ROW_ACCESSOR(gs16, gs16_t)
+IMAGE_DEFINE_ROW_ACCESSOR(gsfl, float)
+IMAGE_DEFINE_ROW_ACCESSOR(rgb, rgb_t)
+
+/**
+ * @brief Read a pixel in a bitmap row (pixels are packed 8 per byte, most significant bit first)
+ * @param row pointer to bitmap row, see image_row()
+ * @param x abscissa
+ * @return pixel bit
+ */
+static inline bool image_bmp_row_get(const uint8_t *row, int x)
+{
+    return (row[x >> 3] >> (7 - (x & 7))) & 1;
+}
+
+/**
+ * @brief Write a pixel in a bitmap row
+ * @param row pointer to bitmap row, see image_row()
+ * @param x abscissa
+ * @param bit pixel bit
+ */
+static inline void image_bmp_row_set(uint8_t *row, int x, bool bit)
+{
+    uint8_t mask = 0x80 >> (x & 7);
+    row[x >> 3] = bit ? (row[x >> 3] | mask) : (row[x >> 3] & ~mask);
+}
 
 // Useful macros
 
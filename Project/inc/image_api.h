@@ -0,0 +1,24 @@
+#ifndef IMAGE_API_H
+#define IMAGE_API_H
+/**
+ * @file image_api.h
+ * @brief Basic image processing library: symbols exported by the library
+ * @author Saint-Cirgue Arnaud _ Correge Etienne
+ * @version 0.1
+ * @date november 2023
+ */
+
+/**
+ * @brief Marks a function of the public API.
+ *
+ * The libraries are compiled with -fvisibility=hidden (see the Makefile): unmarked functions are
+ * internal, cannot be interposed by another shared object, and may thus be inlined by the compiler
+ * (with -flto, even across source files).
+ */
+#if defined(__GNUC__)
+#define IMAGE_API __attribute__((visibility("default")))
+#else
+#define IMAGE_API
+#endif
+
+#endif
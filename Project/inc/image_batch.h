@@ -0,0 +1,44 @@
+#ifndef IMAGE_BATCH_H
+#define IMAGE_BATCH_H
+/**
+ * @file image_batch.h
+ * @brief Image processing library: pipelined connected components labeling of batches of images
+ * @author Saint-Cirgue Arnaud _ Correge Etienne
+ * @version 0.1
+ * @date november 2023
+ */
+
+#include "image_lib.h"
+
+/**
+ * @brief batch pipeline settings
+ */
+typedef struct
+{
+    int num_loaders;        /*!< number of loader threads */
+    int num_labelers;       /*!< number of labeling workers (each one runs its own OpenMP team) */
+    int num_threads;        /*!< maximum number of OpenMP threads for one image (at most CCL_MAX_THREADS) */
+    int num_cores;          /*!< number of cores shared by all labeling and analysis teams */
+    int max_pool_threads;   /*!< cap on the OpenMP threads kept alive by all workers' teams (workers included) */
+    long pixels_per_thread; /*!< an image gets one thread per pixels_per_thread pixels (at least 1, at most num_threads) */
+    int queue_size;         /*!< capacity of the queues between stages (bounds the number of images in flight) */
+    const char *out_dir;    /*!< directory for per-image outputs, or NULL for no output file */
+} image_batch_options_t;
+
+/**
+ * @brief per-image result of the batch pipeline
+ */
+typedef struct
+{
+    const char *fname;                      /*!< path of the image file */
+    int width, height;                      /*!< image dimensions */
+    int num_cc;                             /*!< number of connected components, -1 if the file could not be processed */
+    unsigned int largest_cc;                /*!< size (in pixels) of the largest connected component */
+} image_batch_result_t;
+
+IMAGE_API int image_batch_list(const char *path, char ***files_out);
+IMAGE_API void image_batch_list_delete(char **files, int num_files);
+IMAGE_API image_batch_options_t image_batch_default_options(void);
+IMAGE_API int image_batch_run(char **files, int num_files, const image_batch_options_t *options, image_batch_result_t *results);
+
+#endif
@@ -0,0 +1,35 @@
+#ifndef IMAGE_BITMAP_H
+#define IMAGE_BITMAP_H
+/**
+ * @file image_bitmap.h
+ * @brief Image processing library: bit-parallel operations on packed bitmap rows
+ * @author Saint-Cirgue Arnaud _ Correge Etienne
+ * @version 0.1
+ * @date november 2023
+ */
+
+#include "image.h"
+
+/**
+ * Bitmap rows hold 8 pixels per byte, most significant bit first (as in PBM files).
+ * Rows allocated by image_new() are padded to IMAGE_ALIGN bytes, i.e. to a whole number of 64-bit words,
+ * so that the following primitives process 64 pixels per operation.
+ * Bits beyond the image width are expected to be zero (see bmp_row_clear_padding()).
+ */
+
+// row primitives
+IMAGE_API int bmp_row_popcount(const uint8_t *row, int width);
+IMAGE_API void bmp_row_and(uint8_t *dst, const uint8_t *a, const uint8_t *b, int width);
+IMAGE_API void bmp_row_or(uint8_t *dst, const uint8_t *a, const uint8_t *b, int width);
+IMAGE_API void bmp_row_xor(uint8_t *dst, const uint8_t *a, const uint8_t *b, int width);
+IMAGE_API bool bmp_row_equal(const uint8_t *a, const uint8_t *b, int width);
+IMAGE_API int bmp_row_find_next(const uint8_t *row, int width, int x, bool bit);
+IMAGE_API void bmp_row_clear_padding(uint8_t *row, int width);
+
+// image-level operations, parallel over rows
+IMAGE_API long image_bmp_popcount(const image_t *self);
+IMAGE_API void image_bmp_and(image_t *dst, const image_t *a, const image_t *b);
+IMAGE_API void image_bmp_or(image_t *dst, const image_t *a, const image_t *b);
+IMAGE_API void image_bmp_xor(image_t *dst, const image_t *a, const image_t *b);
+
+#endif
@@ -0,0 +1,46 @@
+#ifndef IMAGE_CACHE_H
+#define IMAGE_CACHE_H
+/**
+ * @file image_cache.h
+ * @brief Image processing library: content-addressed cache of connected components labeling results
+ * @author Saint-Cirgue Arnaud _ Correge Etienne
+ * @version 0.1
+ * @date november 2023
+ */
+
+#include "image_connected_components.h"
+
+/**
+ * @brief File magic number of cache entries
+ */
+#define CCL_CACHE_MAGIC "CCLC"
+
+/**
+ * @brief Cache entry format version; part of the key, so that old entries are ignored
+ */
+#define CCL_CACHE_VERSION 1
+
+/**
+ * @brief header of a cache entry file
+ */
+typedef struct
+{
+    char magic[4];          /*!< CCL_CACHE_MAGIC */
+    uint32_t version;       /*!< CCL_CACHE_VERSION */
+    uint64_t key;           /*!< cache key (see ccl_cache_key()) */
+    uint32_t width;         /*!< image width (in pixels) */
+    uint32_t height;        /*!< image height (in pixels) */
+    uint32_t num_cc;        /*!< number of connected components */
+    uint32_t largest_cc;    /*!< index of the largest connected component */
+    uint32_t has_labels;    /*!< 1 if the label map follows the components table */
+    uint32_t reserved;
+} ccl_cache_header_t;
+
+IMAGE_API uint64_t image_hash(const image_t *self);
+IMAGE_API void ccl_cache_set_dir(const char *dir, bool store_labels);
+IMAGE_API bool ccl_cache_enabled(void);
+IMAGE_API uint64_t ccl_cache_key(const image_t *self);
+IMAGE_API int ccl_cache_load(uint64_t key, int width, int height, image_t *tags, ccl_stats_t *stats);
+IMAGE_API int ccl_cache_store(uint64_t key, int width, int height, const image_t *tags, int num_cc, const ccl_stats_t *stats);
+
+#endif
@@ -9,8 +9,17 @@
  */
 
 #include "image_lib.h"
+#include "image_memory.h"
 
-#define MAX_TAGS 500000
+/**
+ * @brief size of equivalence tables: temporary tags are stored as 16-bit pixels
+ */
+#define MAX_TAGS 65536
+
+/**
+ * @brief maximum number of OpenMP threads labeling one image (see ccl_temp_tag())
+ */
+#define CCL_MAX_THREADS 20
 
 /**
  * @brief bounding box descriptor of a connected component
@@ -21,11 +30,58 @@ typedef struct
   unsigned int num_pixels;  /*!< number of pixels of that connected component */
 } image_connected_component_t;
 
-color_t class_color(int class);
+/**
+ * @brief first pass algorithm variants
+ */
+typedef enum
+{
+  CCL_TEMP_TAG_ROWS,    /*!< rows shared among threads (ccl_temp_tag()); exact with a single thread only, so always run on one thread */
+  CCL_TEMP_TAG_STRIPS   /*!< independent strips, then seams joined (ccl_temp_tag_strips()) */
+} ccl_variant_t;
+
+/**
+ * @brief labeling parameters, chosen by the auto-tuner (see image_tuning.h)
+ */
+typedef struct
+{
+  int num_threads;          /*!< number of OpenMP threads, 0 to keep the current setting */
+  ccl_variant_t variant;    /*!< first pass algorithm */
+  int strips_per_thread;    /*!< CCL_TEMP_TAG_STRIPS: number of strips per thread */
+  int sections_per_thread;  /*!< analysis: number of row sections per thread */
+} ccl_params_t;
+
+/**
+ * @brief results of image_connected_components(), besides the tags image
+ */
+typedef struct
+{
+  image_connected_component_t *con_cmp; /*!< connected components table (one entry per class); release with free() */
+  int largest_cc;                       /*!< index of the largest connected component in con_cmp */
+  int num_threads;                      /*!< number of OpenMP threads used */
+  int cached;                           /*!< 0: computed; from the cache (see image_cache.h): 1 without tags (tags not written), 2 with tags */
+  double time[7];                       /*!< step timestamps (omp_get_wtime()): start, temp tags, debug output,
+                                             reduced equivalences, retag, analysis, color drawing;
+                                             the cache lookup counts as analysis */
+  mem_track_t mem[7];                   /*!< memory footprint, at the start then at the end of each step (see time),
+                                             with the peak of the step (see image_memory.h) */
+} ccl_stats_t;
+
+IMAGE_API color_t class_color(int class);
 int find_root(int *table, int tag);
 int join(int *table, int tag1, int tag2);
 int min_non_zero(int a, int b);
-int image_connected_components(const image_t *self, image_t *tags, image_t *color);
-void write_time_csv(double *time);
+IMAGE_API int ccl_temp_tag(const image_t *self, image_t *tags, int *equiv_out);
+IMAGE_API int ccl_temp_tag_strips(const image_t *self, image_t *tags, int *equiv_out, int num_strips);
+IMAGE_API ccl_params_t ccl_default_params(void);
+IMAGE_API int ccl_temp_tag_params(const image_t *self, image_t *tags, int *equiv_out, const ccl_params_t *params);
+IMAGE_API int ccl_reduce_equivalences(int *equiv_table, int num_tags, int *class_num_out);
+IMAGE_API void ccl_retag(image_t *tags, int *class_num);
+IMAGE_API int ccl_label(const image_t *self, image_t *tags, int *equiv_table);
+IMAGE_API int ccl_label_params(const image_t *self, image_t *tags, int *equiv_table, const ccl_params_t *params);
+IMAGE_API void ccl_analyze(const image_t *tags, image_connected_component_t *con_cmp, int num_classes);
+IMAGE_API void ccl_analyze_sections(const image_t *tags, image_connected_component_t *con_cmp, int num_classes, int num_sections);
+IMAGE_API void ccl_draw_colors(const image_t *tags, image_t *color);
+IMAGE_API void ccl_draw_bounding_boxes(image_t *color, image_connected_component_t *con_cmp, int num_cc);
+IMAGE_API int image_connected_components(const image_t *self, image_t *tags, image_t *color, ccl_stats_t *stats);
 
 #endif
\ No newline at end of file
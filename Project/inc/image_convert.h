@@ -0,0 +1,17 @@
+#ifndef IMAGE_CONVERT_H
+#define IMAGE_CONVERT_H
+/**
+ * @file image_convert.h
+ * @brief Basic image processing library: pixel format and color space conversions of whole images
+ * @author Saint-Cirgue Arnaud _ Correge Etienne
+ * @version 0.1
+ * @date november 2023
+ */
+
+#include "image.h"
+
+IMAGE_API image_t *image_new_convert(const image_t *self, image_type_t type);
+IMAGE_API void image_hsv_from_rgb(const image_t *self, hsv_t *hsv);
+IMAGE_API void image_rgb_from_hsv(image_t *self, const hsv_t *hsv);
+
+#endif
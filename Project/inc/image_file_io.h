@@ -8,11 +8,29 @@
  * @date october 2020
  */
 
-#include <image.h>
+#include "image.h"
 
-image_t *image_new_open(const char *fname);
-int image_save_ascii(const image_t *self, const char *fname);
-int image_save_binary(const image_t *self, const char *fname);
-int image_save(const image_t *self, const char *fname, int binary_encoding);
+/**
+ * @struct image_info_t
+ * @brief Properties of an image file, read from its header only (see image_probe())
+ */
+typedef struct
+{
+    int width;              /*!< image width (in pixels) */
+    int height;             /*!< image height (in pixels) */
+    image_type_t type;      /*!< image type (pixel format) */
+    int depth;              /*!< maximum value of a pixel channel (1 for bitmaps) */
+    int binary;             /*!< 1 for binary encoding (P4..P7), 0 for ASCII encoding (P1, P2, P3) */
+    int format;             /*!< 1..7, as in magic number P1..P7 */
+    size_t offset;          /*!< offset of the pixel data from the start of the file */
+} image_info_t;
+
+IMAGE_API int image_probe(const char *fname, image_info_t *info);
+IMAGE_API image_t *image_new_open(const char *fname);
+IMAGE_API image_t *image_new_open_mmap(const char *fname);
+IMAGE_API int image_save_ascii(const image_t *self, const char *fname);
+IMAGE_API int image_save_binary(const image_t *self, const char *fname);
+IMAGE_API int image_save(const image_t *self, const char *fname, int binary_encoding);
+IMAGE_API int image_save_pam(const image_t *self, const char *fname);
 
 #endif
\ No newline at end of file
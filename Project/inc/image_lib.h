@@ -11,7 +11,15 @@
 #include "utils.h"
 #include "pixel.h"
 #include "image.h"
+#include "image_memory.h"
+#include "image_bitmap.h"
+#include "image_convert.h"
+#include "image_threshold.h"
 #include "image_file_io.h"
+#include "image_stream.h"
+#include "image_tiled.h"
+#include "image_reader.h"
 #include "image_connected_components.h"
+#include "image_batch.h"
 
 #endif
\ No newline at end of file
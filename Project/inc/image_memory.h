@@ -0,0 +1,33 @@
+#ifndef IMAGE_MEMORY_H
+#define IMAGE_MEMORY_H
+/**
+ * @file image_memory.h
+ * @brief Image processing library: accounting of the memory held by images and labeling tables
+ * @author Saint-Cirgue Arnaud _ Correge Etienne
+ * @version 0.1
+ * @date november 2023
+ */
+
+#include <stddef.h>
+#include "image_api.h"
+
+/**
+ * @brief snapshot of the memory accounting (in bytes)
+ */
+typedef struct
+{
+    size_t current;     /*!< bytes held at the time of the snapshot */
+    size_t peak;        /*!< highest number of bytes held since the previous phase snapshot */
+} mem_track_t;
+
+IMAGE_API void mem_track_add(size_t bytes);
+IMAGE_API void mem_track_sub(size_t bytes);
+IMAGE_API void *mem_track_malloc(size_t bytes);
+IMAGE_API void *mem_track_calloc(size_t n, size_t size);
+IMAGE_API void *mem_track_realloc(void *ptr, size_t old_bytes, size_t new_bytes);
+IMAGE_API void mem_track_free(void *ptr, size_t bytes);
+IMAGE_API size_t mem_track_current(void);
+IMAGE_API size_t mem_track_peak(void);
+IMAGE_API mem_track_t mem_track_phase(void);
+
+#endif
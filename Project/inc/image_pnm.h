@@ -0,0 +1,79 @@
+#ifndef IMAGE_PNM_H
+#define IMAGE_PNM_H
+/**
+ * @file image_pnm.h
+ * @brief Basic image processing library: Netpbm format helpers shared by file readers and writers
+ * @author Saint-Cirgue Arnaud _ Correge Etienne
+ * @version 0.1
+ * @date november 2023
+ */
+
+#include "image.h"
+#include "utils.h"
+
+/**
+ * @struct pnm_header_t
+ * @brief Fields of a Netpbm header
+ */
+typedef struct
+{
+    int format;     /*!< 1..7, as in magic number P1..P7 */
+    int width;      /*!< image width (in pixels) */
+    int height;     /*!< image height (in pixels) */
+    int depth;      /*!< maximum value of a pixel channel (1 for bitmaps) */
+    int channels;   /*!< number of channels per pixel (PAM DEPTH field) */
+    size_t offset;  /*!< offset of the pixel data from the start of the file */
+} pnm_header_t;
+
+int pnm_parse_header(const uint8_t *buf, size_t len, pnm_header_t *hdr);
+image_type_t pnm_image_type(const pnm_header_t *hdr);
+size_t pnm_file_row_bytes(const pnm_header_t *hdr);
+size_t pnm_payload_size(const pnm_header_t *hdr, const uint8_t *data, size_t len);
+int pnm_parse_ascii(image_t *self, const uint8_t *buf, size_t len);
+image_t *pnm_decode(const pnm_header_t *hdr, const uint8_t *data, size_t len);
+char *pnm_format_row(const image_t *self, int y, int depth, char *p);
+int pnm_write_all(int fd, const char *buf, size_t len);
+void pnm_swap16(uint8_t *dst, const uint8_t *src, size_t n);
+
+/**
+ * @brief Parse an unsigned decimal value from ASCII pixel data (no locale, no error checks)
+ * @param p pointer to the first digit
+ * @param end end of buffer
+ * @param v (output) value
+ * @return pointer past the last digit
+ */
+static inline const uint8_t *pnm_scan_uint(const uint8_t *p, const uint8_t *end, uint32_t *v)
+{
+    uint32_t acc = 0;
+    while (p < end && (unsigned)(*p - '0') < 10)
+    {
+        acc = 10 * acc + (*p++ - '0');
+        acc = MIN(acc, 0x10000);
+    }
+    *v = acc;
+    return p;
+}
+
+/**
+ * @brief Format an unsigned value as decimal text (no locale, no format string parsing)
+ * @param p output buffer, with room for at least 10 characters
+ * @param v value
+ * @return pointer past the last character written
+ */
+static inline char *pnm_format_uint(char *p, uint32_t v)
+{
+    char digits[10];
+    int n = 0;
+    do
+    {
+        digits[n++] = '0' + v % 10;
+        v /= 10;
+    } while (v);
+    while (n)
+    {
+        *p++ = digits[--n];
+    }
+    return p;
+}
+
+#endif
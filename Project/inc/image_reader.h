@@ -0,0 +1,32 @@
+#ifndef IMAGE_READER_H
+#define IMAGE_READER_H
+/**
+ * @file image_reader.h
+ * @brief Basic image processing library: read successive images of a multi-image Netpbm file
+ * @author Saint-Cirgue Arnaud _ Correge Etienne
+ * @version 0.1
+ * @date november 2023
+ */
+
+#include "image.h"
+
+/**
+ * @struct image_reader_t
+ * @brief A file holding concatenated Netpbm images (e.g. the pages of a scanned document), read one image at a time
+ */
+typedef struct
+{
+    const char *fname;      /*!< path of the file, for error messages */
+    uint8_t *data;          /*!< file contents */
+    size_t size;            /*!< size of data (in bytes) */
+    int mapped;             /*!< 1 if data is a file mapping, 0 if it was read into memory */
+    size_t pos;             /*!< offset of the next image */
+    int index;              /*!< number of images read */
+    int error;              /*!< 1 if the file holds invalid data after the last image read */
+} image_reader_t;
+
+IMAGE_API image_reader_t *image_reader_open(const char *fname);
+IMAGE_API image_t *image_reader_next(image_reader_t *self);
+IMAGE_API void image_reader_close(image_reader_t *self);
+
+#endif
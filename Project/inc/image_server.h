@@ -0,0 +1,32 @@
+#ifndef IMAGE_SERVER_H
+#define IMAGE_SERVER_H
+/**
+ * @file image_server.h
+ * @brief Image processing library: long-running connected components labeling service
+ * @author Saint-Cirgue Arnaud _ Correge Etienne
+ * @version 0.1
+ * @date november 2023
+ */
+
+#include "image_lib.h"
+
+/**
+ * @brief labeling service state, kept warm from a request to the next
+ */
+typedef struct
+{
+    int num_threads;                        /*!< OpenMP threads for labeling */
+    image_t *tags_buf;                      /*!< tags buffer, grown to the largest image seen so far */
+    int *equiv_table;                       /*!< tag equivalence table (MAX_TAGS entries) */
+    image_connected_component_t *con_cmp;   /*!< connected components table */
+    int con_cmp_size;                       /*!< number of entries of con_cmp */
+    long num_requests;                      /*!< number of requests served */
+} image_server_t;
+
+IMAGE_API image_server_t *image_server_new(int num_threads);
+IMAGE_API void image_server_delete(image_server_t *self);
+IMAGE_API int image_server_handle(image_server_t *self, char *request, FILE *out);
+IMAGE_API int image_server_serve(image_server_t *self, FILE *in, FILE *out);
+IMAGE_API int image_server_listen(image_server_t *self, const char *socket_path);
+
+#endif
@@ -0,0 +1,32 @@
+#ifndef IMAGE_SPATIAL_H
+#define IMAGE_SPATIAL_H
+/**
+ * @file image_spatial.h
+ * @brief Image processing library: spatial index of connected components (uniform grid of bounding boxes)
+ * @author Saint-Cirgue Arnaud _ Correge Etienne
+ * @version 0.1
+ * @date november 2023
+ */
+
+#include "image_connected_components.h"
+
+/**
+ * @brief a uniform grid over the image: each cell lists the components whose bounding box overlaps it
+ */
+typedef struct
+{
+    const image_connected_component_t *con_cmp; /*!< indexed components table (not owned: keep it until ccl_index_delete()) */
+    int num_cc;                                 /*!< number of components in con_cmp */
+    int cell_width, cell_height;                /*!< cell dimensions, in pixels */
+    int cols, rows;                             /*!< grid dimensions, in cells */
+    int *cell_start;                            /*!< components of cell (i, j) are cell_items[cell_start[j * cols + i] .. cell_start[j * cols + i + 1] - 1] */
+    int *cell_items;                            /*!< component indices in con_cmp, cell by cell, in increasing order within a cell */
+} ccl_index_t;
+
+IMAGE_API ccl_index_t *ccl_index_new(const image_connected_component_t *con_cmp, int num_cc, int width, int height);
+IMAGE_API void ccl_index_delete(ccl_index_t *self);
+IMAGE_API int ccl_index_query_rect(const ccl_index_t *self, int x1, int y1, int x2, int y2, int *out, int max_out);
+IMAGE_API int ccl_index_query_point(const ccl_index_t *self, int x, int y, int *out, int max_out);
+IMAGE_API int ccl_index_nearest(const ccl_index_t *self, int x, int y, int k, int *out);
+
+#endif
@@ -0,0 +1,48 @@
+#ifndef IMAGE_STREAM_H
+#define IMAGE_STREAM_H
+/**
+ * @file image_stream.h
+ * @brief Basic image processing library: read/write NetBPM files by blocks of rows
+ * @author Saint-Cirgue Arnaud _ Correge Etienne
+ * @version 0.1
+ * @date november 2023
+ */
+
+#include "image.h"
+
+/**
+ * @brief Size of the input buffer of a stream reading ASCII-encoded pixel data
+ */
+#define IMAGE_STREAM_BUFFER (64 * 1024)
+
+/**
+ * @struct image_stream_t
+ * @brief A NetBPM file opened for reading or writing a band of rows at a time
+ */
+typedef struct
+{
+    FILE *fp;               /*!< underlying file */
+    int writing;            /*!< 1 if the stream was created by image_stream_create() */
+    int width;              /*!< image width (in pixels) */
+    int height;             /*!< image height (in pixels) */
+    image_type_t type;      /*!< image type (pixel format) */
+    int depth;              /*!< maximum value of a pixel channel */
+    int ascii;              /*!< 1 for ASCII encoding (P1, P2, P3) */
+    int next_row;           /*!< index of the next row to read or write */
+    uint8_t *buf;           /*!< input buffer (ASCII reading only) */
+    size_t buf_pos;         /*!< read position in buf */
+    size_t buf_len;         /*!< number of valid bytes in buf */
+} image_stream_t;
+
+// reader
+IMAGE_API image_stream_t *image_stream_open(const char *fname);
+IMAGE_API image_t *image_stream_new_band(const image_stream_t *self, int num_rows);
+IMAGE_API int image_stream_read(image_stream_t *self, image_t *band);
+
+// writer
+IMAGE_API image_stream_t *image_stream_create(const char *fname, int width, int height, image_type_t type, int binary_encoding);
+IMAGE_API int image_stream_write(image_stream_t *self, const image_t *band, int num_rows);
+
+IMAGE_API int image_stream_close(image_stream_t *self);
+
+#endif
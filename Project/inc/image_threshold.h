@@ -0,0 +1,41 @@
+#ifndef IMAGE_THRESHOLD_H
+#define IMAGE_THRESHOLD_H
+/**
+ * @file image_threshold.h
+ * @brief Basic image processing library: binarization of grayscale and color images into bitmaps
+ * @author Saint-Cirgue Arnaud _ Correge Etienne
+ * @version 0.1
+ * @date november 2023
+ */
+
+#include "image.h"
+
+/**
+ * @enum image_threshold_method_t
+ * @brief How the threshold between black and white pixels is chosen
+ */
+typedef enum
+{
+    IMAGE_THRESHOLD_GLOBAL,     /*!< fixed level, for the whole image */
+    IMAGE_THRESHOLD_OTSU,       /*!< level minimizing the intra-class variance (Otsu's method), for the whole image */
+    IMAGE_THRESHOLD_ADAPTIVE    /*!< level depending on the mean level of a window around each pixel */
+} image_threshold_method_t;
+
+/**
+ * @struct image_threshold_options_t
+ * @brief binarization settings
+ */
+typedef struct
+{
+    image_threshold_method_t method;    /*!< threshold method */
+    int level;                          /*!< IMAGE_THRESHOLD_GLOBAL: pixels up to this level are black (0..255, or 0..65535 for 16-bit images) */
+    int window;                         /*!< IMAGE_THRESHOLD_ADAPTIVE: window size (in pixels) */
+    int percent;                        /*!< IMAGE_THRESHOLD_ADAPTIVE: pixels darker than the window mean by this percentage are black */
+} image_threshold_options_t;
+
+IMAGE_API image_threshold_options_t image_threshold_default_options(void);
+IMAGE_API void image_threshold_set_default_options(const image_threshold_options_t *options);
+IMAGE_API int image_threshold_otsu(const image_t *self);
+IMAGE_API image_t *image_new_threshold(const image_t *self, const image_threshold_options_t *options);
+
+#endif
@@ -0,0 +1,53 @@
+#ifndef IMAGE_TILED_H
+#define IMAGE_TILED_H
+/**
+ * @file image_tiled.h
+ * @brief Basic image processing library: tiled, indexed image container files, with random access to regions
+ * @author Saint-Cirgue Arnaud _ Correge Etienne
+ * @version 0.1
+ * @date november 2023
+ */
+
+#include "image.h"
+
+/**
+ * @brief File magic number of tiled image containers
+ */
+#define IMAGE_TILED_MAGIC "CCLT"
+
+/**
+ * @brief File format version
+ */
+#define IMAGE_TILED_VERSION 1
+
+/**
+ * @enum image_tile_encoding_t
+ * @brief Encoding of a tile's pixel data
+ */
+typedef enum
+{
+    IMAGE_TILE_RAW = 0,     /*!< tightly packed pixel rows */
+    IMAGE_TILE_RLE = 1      /*!< run-length encoded pixel rows (see image_tiled.c) */
+} image_tile_encoding_t;
+
+/**
+ * @struct image_tiled_info_t
+ * @brief header of a tiled image container
+ */
+typedef struct
+{
+    image_type_t type;      /*!< image type (pixel format) */
+    int width;              /*!< image width (in pixels) */
+    int height;             /*!< image height (in pixels) */
+    int tile_width;         /*!< tile width (in pixels); a multiple of 8 */
+    int tile_height;        /*!< tile height (in pixels) */
+    int tiles_x;            /*!< number of tile columns */
+    int tiles_y;            /*!< number of tile rows */
+} image_tiled_info_t;
+
+IMAGE_API int image_tiled_save(const image_t *self, const char *fname, int tile_width, int tile_height, int compress);
+IMAGE_API int image_tiled_info(const char *fname, image_tiled_info_t *info);
+IMAGE_API image_t *image_tiled_load_region(const char *fname, int x, int y, int width, int height);
+IMAGE_API image_t *image_tiled_load(const char *fname);
+
+#endif
@@ -0,0 +1,47 @@
+#ifndef IMAGE_TRACKING_H
+#define IMAGE_TRACKING_H
+/**
+ * @file image_tracking.h
+ * @brief Image processing library: tracking of connected components along a sequence of frames
+ * @author Saint-Cirgue Arnaud _ Correge Etienne
+ * @version 0.1
+ * @date november 2023
+ */
+
+#include "image_connected_components.h"
+
+/**
+ * @brief a connected component of the current frame, with its persistent identity
+ */
+typedef struct
+{
+    int id;                             /*!< persistent identifier, kept from frame to frame while the component overlaps its previous self */
+    int age;                            /*!< number of consecutive frames the component was found in (1 for a new component) */
+    int prev;                           /*!< index of the matching component in the previous frame's table, -1 if new */
+    image_connected_component_t cc;     /*!< bounding box and size in the current frame */
+} ccl_track_t;
+
+/**
+ * @brief labeling state of a sequence of frames of identical dimensions
+ */
+typedef struct
+{
+    int width, height;          /*!< frame dimensions */
+    image_t *bitmap;            /*!< previous frame (binary), for frame differencing */
+    image_t *tags;              /*!< label map of the last frame: index in tracks + 1, 0 for background */
+    int *equiv_table;           /*!< tag equivalence table (MAX_TAGS entries), reused by each frame */
+    ccl_track_t *tracks;        /*!< components of the last frame */
+    int num_tracks;             /*!< number of components of the last frame */
+    int next_id;                /*!< identifier of the next new component */
+    int num_frames;             /*!< number of frames pushed */
+    int num_regions;            /*!< number of regions (rectangles) labeled again for the last frame */
+    long relabeled_pixels;      /*!< number of pixels labeled again for the last frame */
+    int num_new;                /*!< components of the last frame without a match in the previous one */
+    int num_lost;               /*!< components of the previous frame without a match in the last one */
+} ccl_sequence_t;
+
+IMAGE_API ccl_sequence_t *ccl_sequence_new(int width, int height);
+IMAGE_API void ccl_sequence_delete(ccl_sequence_t *self);
+IMAGE_API int ccl_sequence_push(ccl_sequence_t *self, const image_t *frame);
+
+#endif
@@ -0,0 +1,35 @@
+#ifndef IMAGE_TUNING_H
+#define IMAGE_TUNING_H
+/**
+ * @file image_tuning.h
+ * @brief Image processing library: auto-tuning of connected components labeling parameters
+ * @author Saint-Cirgue Arnaud _ Correge Etienne
+ * @version 0.1
+ * @date november 2023
+ */
+
+#include "image_connected_components.h"
+
+/**
+ * @brief maximum number of entries of a profile
+ */
+#define CCL_PROFILE_MAX_ENTRIES 64
+
+/**
+ * @brief best labeling parameters measured for a class of images
+ */
+typedef struct
+{
+    long num_pixels;        /*!< image size (in pixels) of the class */
+    float density;          /*!< fraction of foreground pixels of the class */
+    ccl_params_t params;    /*!< best parameters */
+    double time;            /*!< labeling + analysis time measured with these parameters (in seconds) */
+} ccl_profile_entry_t;
+
+IMAGE_API float ccl_sample_density(const image_t *self);
+IMAGE_API int ccl_profile_load(const char *fname);
+IMAGE_API int ccl_profile_save(const char *fname);
+IMAGE_API ccl_params_t ccl_profile_lookup(const image_t *self);
+IMAGE_API int ccl_calibrate(int max_threads, const char *fname);
+
+#endif
@@ -0,0 +1,60 @@
+#ifndef IMAGE_VOLUME_H
+#define IMAGE_VOLUME_H
+/**
+ * @file image_volume.h
+ * @brief Image processing library: volumes (stacks of slices) and 3D connected components labeling
+ * @author Saint-Cirgue Arnaud _ Correge Etienne
+ * @version 0.1
+ * @date november 2023
+ */
+
+#include "image_connected_components.h"
+
+/**
+ * @brief voxel neighborhood of 3D labeling
+ */
+typedef enum
+{
+    CCL_CONNECT_6 = 6,      /*!< voxels sharing a face */
+    CCL_CONNECT_26 = 26     /*!< voxels sharing a face, an edge or a corner */
+} ccl_connectivity_t;
+
+/**
+ * @brief a volume: a stack of binary slices of identical dimensions
+ */
+typedef struct
+{
+    int width, height, depth;   /*!< slice dimensions, and number of slices */
+    image_t **slices;           /*!< depth bitmaps, slice z at slices[z] (owned by the volume) */
+} image_volume_t;
+
+/**
+ * @brief bounding box descriptor of a 3D connected component
+ */
+typedef struct
+{
+    int x1, x2, y1, y2, z1, z2;     /*!< (x1,y1,z1): first voxel, (x2,y2,z2): last voxel of the bounding box */
+    unsigned long num_voxels;       /*!< number of voxels of that connected component */
+} image_volume_component_t;
+
+/**
+ * @brief results of image_volume_connected_components(), besides the labels
+ */
+typedef struct
+{
+    image_volume_component_t *con_cmp;  /*!< connected components table (one entry per class); release with free() */
+    int largest_cc;                     /*!< index of the largest connected component in con_cmp */
+    int num_threads;                    /*!< number of OpenMP threads used */
+    int num_slabs;                      /*!< number of slabs (groups of consecutive slices) tagged in parallel */
+    double time[5];                     /*!< step timestamps (omp_get_wtime()): start, temp tags,
+                                             slab boundaries merged and equivalences reduced, retag, analysis */
+} ccl_volume_stats_t;
+
+IMAGE_API image_volume_t *image_volume_new_from_slices(image_t **slices, int depth);
+IMAGE_API image_volume_t *image_volume_open(const char *path);
+IMAGE_API void image_volume_delete(image_volume_t *self);
+IMAGE_API size_t image_volume_num_voxels(const image_volume_t *self);
+IMAGE_API int image_volume_connected_components(const image_volume_t *self, int *labels,
+    ccl_connectivity_t connectivity, ccl_volume_stats_t *stats);
+
+#endif
@@ -12,6 +12,8 @@
 #include <stdint.h>
 #include <stdbool.h>
 
+#include "image_api.h"
+
 /**
  * @brief alias for 8-bit grayscale pixel value
  */
@@ -61,9 +63,16 @@ typedef struct
 
 
 /* convert pixel values between formats */
-gs8_t gs8_from_3f(float r, float g, float b);
+IMAGE_API gs8_t gs8_from_3f(float r, float g, float b);
 /* color space conversions */
-rgb_t rgb_from_hsv(hsv_t hsv);
-hsv_t hsv_from_rgb(rgb_t rgb);
+IMAGE_API rgb_t rgb_from_hsv(hsv_t hsv);
+IMAGE_API hsv_t hsv_from_rgb(rgb_t rgb);
+
+/* batched conversions, on arrays of n pixels */
+IMAGE_API void gs8_from_rgb_n(gs8_t *restrict dst, const rgb_t *restrict src, int n);
+IMAGE_API void gs8_from_fl_n(gs8_t *restrict dst, const float *restrict src, int n);
+IMAGE_API void fl_from_gs8_n(float *restrict dst, const gs8_t *restrict src, int n);
+IMAGE_API void rgb_from_hsv_n(rgb_t *restrict dst, const hsv_t *restrict src, int n);
+IMAGE_API void hsv_from_rgb_n(hsv_t *restrict dst, const rgb_t *restrict src, int n);
 
 #endif
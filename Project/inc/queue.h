@@ -0,0 +1,42 @@
+#ifndef QUEUE_H
+#define QUEUE_H
+/**
+ * @file queue.h
+ * @brief Bounded, blocking FIFO queue of pointers, for connecting pipeline stages
+ * @author Saint-Cirgue Arnaud _ Correge Etienne
+ * @version 0.1
+ * @date november 2023
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <pthread.h>
+
+enum {
+    QUEUE_OK = 0,
+    QUEUE_CLOSED = -1
+};
+
+/**
+ * @struct queue_t
+ * @brief Circular buffer of items; producers block while it is full (backpressure), consumers block while it is empty
+ */
+typedef struct {
+    void **buffer;          /*!< item storage */
+    int size;               /*!< capacity */
+    int read_idx;           /*!< index of the next item to pop */
+    int length;             /*!< number of items in queue */
+    int closed;             /*!< set once producers are done: pop fails when queue is closed and empty */
+    pthread_mutex_t mutex;
+    pthread_cond_t not_empty;
+    pthread_cond_t not_full;
+} queue_t;
+
+queue_t *queue_new(int size);
+void queue_delete(queue_t *self);
+int queue_push(queue_t *self, void *item);
+int queue_pop(queue_t *self, void **item);
+void queue_close(queue_t *self);
+
+#endif
@@ -7,6 +7,7 @@
  */
 
 #include "image.h"
+#include "image_memory.h"
 #include "utils.h"
 
 #include <stdio.h>
@@ -15,6 +16,173 @@
 #include <assert.h>
 #include <stdint.h>
 #include <ctype.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/mempolicy.h>
+#include <omp.h>
+
+/**
+ * Placement policy applied by image_new() to new pixel buffers
+ */
+static image_alloc_policy_t image_alloc_policy = IMAGE_ALLOC_DEFAULT;
+
+/**
+ * Whether image_new() backs large pixel buffers with transparent huge pages
+ */
+static bool image_alloc_hugepages = false;
+
+/**
+ * @brief Select how image_new() allocates and places pixel buffers
+ * @param policy one of IMAGE_ALLOC_DEFAULT, IMAGE_ALLOC_FIRST_TOUCH, IMAGE_ALLOC_INTERLEAVE
+ *
+ * On NUMA machines, a page is physically placed on the node of the thread that first writes it.
+ * With IMAGE_ALLOC_FIRST_TOUCH, rows are zeroed by a `parallel for schedule(static)` loop,
+ * so that each row lands on the node of the thread which processes it later on.
+ */
+void image_set_alloc_policy(image_alloc_policy_t policy)
+{
+    image_alloc_policy = policy;
+}
+
+/**
+ * @brief Enable or disable huge-page backing of large pixel buffers (at least IMAGE_HUGEPAGE_SIZE bytes)
+ * @param enable true to request transparent huge pages
+ */
+void image_set_alloc_hugepages(bool enable)
+{
+    image_alloc_hugepages = enable;
+}
+
+/**
+ * @brief Get the current pixel buffer allocation policy
+ * @return allocation policy
+ */
+image_alloc_policy_t image_get_alloc_policy(void)
+{
+    return image_alloc_policy;
+}
+
+/**
+ * @brief Zero a pixel buffer in parallel, with the same static row partitioning as the processing loops
+ * @param mem pixel buffer
+ * @param stride row size (in bytes)
+ * @param height number of rows
+ */
+static void image_first_touch(uint8_t *mem, size_t stride, int height)
+{
+    int y;
+
+    #pragma omp parallel for schedule(static)
+    for (y = 0; y < height; ++y)
+    {
+        memset(mem + y * stride, 0, stride);
+    }
+}
+
+/**
+ * @brief Spread the pages of a mapping round-robin over all allowed NUMA nodes
+ * @param mem mapping address
+ * @param bytes mapping size
+ *
+ * Keeps the kernel's default (first-touch) placement if the NUMA policy is not available.
+ */
+static void image_interleave(void *mem, size_t bytes)
+{
+    unsigned long nodemask[16] = {0};
+    unsigned long maxnode = 8 * sizeof(nodemask);
+
+    if (syscall(SYS_get_mempolicy, NULL, nodemask, maxnode, NULL, MPOL_F_MEMS_ALLOWED) != 0 ||
+        syscall(SYS_mbind, mem, bytes, MPOL_INTERLEAVE, nodemask, maxnode, 0) != 0)
+    {
+        DEBUG_PRINT("Interleaved NUMA placement not available, using default placement");
+    }
+}
+
+/**
+ * @brief Allocate a zeroed pixel buffer, aligned on IMAGE_ALIGN bytes, according to the allocation policy
+ * @param stride row size (in bytes)
+ * @param height number of rows
+ * @param kind (output) how the buffer was allocated
+ * @param size (output) actual allocation size
+ * @return pointer to the buffer, NULL if failure
+ */
+static void *image_alloc(size_t stride, int height, image_mem_t *kind, size_t *size)
+{
+    size_t bytes = stride * height;
+    void *mem;
+
+    if (image_alloc_policy == IMAGE_ALLOC_INTERLEAVE ||
+        (image_alloc_hugepages && bytes >= IMAGE_HUGEPAGE_SIZE))
+    {
+        /* anonymous mappings are page-aligned and zero-filled on first touch */
+        if (image_alloc_hugepages)
+        {
+            bytes = (bytes + IMAGE_HUGEPAGE_SIZE - 1) / IMAGE_HUGEPAGE_SIZE * IMAGE_HUGEPAGE_SIZE;
+        }
+        mem = mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (mem == MAP_FAILED)
+        {
+            return NULL;
+        }
+        if (image_alloc_hugepages)
+        {
+            (void)madvise(mem, bytes, MADV_HUGEPAGE);
+        }
+        if (image_alloc_policy == IMAGE_ALLOC_INTERLEAVE)
+        {
+            image_interleave(mem, bytes);
+        }
+        else if (image_alloc_policy == IMAGE_ALLOC_FIRST_TOUCH)
+        {
+            image_first_touch(mem, stride, height);
+        }
+        *kind = IMAGE_MEM_MMAP;
+        *size = bytes;
+        return mem;
+    }
+
+    if (posix_memalign(&mem, IMAGE_ALIGN, bytes) != 0)
+    {
+        return NULL;
+    }
+    if (image_alloc_policy == IMAGE_ALLOC_FIRST_TOUCH)
+    {
+        image_first_touch(mem, stride, height);
+    }
+    else
+    {
+        memset(mem, 0, bytes);
+    }
+    *kind = IMAGE_MEM_HEAP;
+    *size = bytes;
+    return mem;
+}
+
+/**
+ * @brief Number of bytes used by the pixels of one row, without padding
+ * @param width image width
+ * @param type image type (pixel format)
+ * @return row size (in bytes); bitmap rows are padded to an integer number of bytes
+ */
+size_t image_row_bytes(int width, image_type_t type)
+{
+    switch(type)
+    {
+    case IMAGE_BITMAP:
+        return ((size_t)width + 7) / 8;
+    case IMAGE_GRAYSCALE_8:
+        return (size_t)width * sizeof(gs8_t);
+    case IMAGE_GRAYSCALE_16:
+        return (size_t)width * sizeof(gs16_t);
+    case IMAGE_GRAYSCALE_FL:
+        return (size_t)width * sizeof(float);
+    case IMAGE_RGB_888:
+        return (size_t)width * sizeof(rgb_t);
+    default:
+        DIE("Image type %d not supported", type);
+    }
+}
 
 /**
  * @fn image_t *image_new(int width, int height, int channels, int depth)
@@ -24,38 +192,25 @@
  * @param type image type (pixel format)
  * @return Handle of a new image object, NULL if creation fails.
  * Don't forget to call object destructor when you're finished using this image object: image_delete(image_handle);
+ *
+ * Rows are padded to a multiple of IMAGE_ALIGN bytes, and the buffer is aligned on IMAGE_ALIGN bytes:
+ * each row starts on its own cache line.
  */
 image_t *image_new(int width, int height, image_type_t type)
 {
     image_t *self;
     void *mem;
-    int bytes;
+    size_t stride;
+    size_t size;
+    image_mem_t kind;
 
     assert(0 < width && width < 100000);
     assert(0 < height && height < 100000);
 
-    switch(type)
-    {
-    case IMAGE_BITMAP:
-        bytes = (width * height + 7) / 8;
-    case IMAGE_GRAYSCALE_8:
-        bytes = width * height * 1;
-        break;
-    case IMAGE_GRAYSCALE_16:
-        bytes = width * height * 2;
-        break;
-    case IMAGE_GRAYSCALE_FL:
-        bytes = width * height * sizeof(float);
-        break;
-    case IMAGE_RGB_888:
-        bytes = width * height * 3;
-        break;
-    default:
-        DIE("Image type %d not supported", type);
-    }
+    stride = (image_row_bytes(width, type) + IMAGE_ALIGN - 1) / IMAGE_ALIGN * IMAGE_ALIGN;
 
     /* allocate pixel data space as a continuous memory block */
-    mem = calloc(1, bytes);
+    mem = image_alloc(stride, height, &kind, &size);
     if (!mem)
     {
         DEBUG_PRINT("Failed to allocate memory for image pixels");
@@ -63,7 +218,11 @@ image_t *image_new(int width, int height, image_type_t type)
     }
 
     /* use constructor from memory */
-    self = image_new_from_mem(width, height, type, mem);
+    self = image_new_from_mem_stride(width, height, type, mem, stride);
+    if (self)
+    {
+        image_set_mem(self, kind, mem, size);
+    }
     return self;
 }
 
@@ -76,13 +235,28 @@ image_t *image_new(int width, int height, image_type_t type)
  * @param mem pointer to pixel data in memory
  * @return Handle of a new image object, NULL if creation fails.
  * 
- * Make sure that mem points to pixel data, of proper length and format
+ * Make sure that mem points to pixel data, of proper length and format; rows are expected to be tightly packed.
  */
 image_t *image_new_from_mem(int width, int height, image_type_t type, void *mem)
+{
+    return image_new_from_mem_stride(width, height, type, mem, image_row_bytes(width, type));
+}
+
+/**
+ * @brief Image constructor; creates an image container, with pixel data from mem pointer, and given row stride.
+ * @param width image width
+ * @param height image height
+ * @param type image type (pixel format)
+ * @param mem pointer to pixel data in memory
+ * @param stride distance between the starts of two consecutive rows (in bytes)
+ * @return Handle of a new image object, NULL if creation fails.
+ */
+image_t *image_new_from_mem_stride(int width, int height, image_type_t type, void *mem, size_t stride)
 {
     assert(0 < width && width < 100000);
     assert(0 < height && height < 100000);
     assert(mem);
+    assert(stride >= image_row_bytes(width, type));
     image_t *self;
 
     /* create image container */
@@ -96,9 +270,11 @@ image_t *image_new_from_mem(int width, int height, image_type_t type, void *mem)
     self->width = width;
     self->height = height;
     self->type = type;
+    self->stride = stride;
 
-    /* assign data buffer */
+    /* assign data buffer; by default, consider it as a heap block owned by the image */
     self->data = mem;
+    image_set_mem(self, IMAGE_MEM_HEAP, mem, stride * height);
 
     /* assign get/set pixel member functions */
     switch(self->type)
@@ -130,16 +306,97 @@ image_t *image_new_from_mem(int width, int height, image_type_t type, void *mem)
     return self;
 }
 
+/**
+ * @brief Image view constructor; creates a container for a sub-rectangle of an image, without copying pixels.
+ * @param parent image (or view) holding the pixel data
+ * @param x abscissa of the upper-left pixel of the region, in parent coordinates
+ * @param y ordinate of the upper-left pixel of the region, in parent coordinates
+ * @param width region width
+ * @param height region height
+ * @return Handle of a new image object, NULL if creation fails.
+ *
+ * The view shares the parent's buffer and stride: pixels written through the view are written in the parent.
+ * image_delete() on a view only releases the container; the parent must outlive its views.
+ * Bitmap pixels are packed 8 per byte, hence bitmap views must start on a multiple of 8 pixels (x % 8 == 0).
+ */
+image_t *image_new_view(const image_t *parent, int x, int y, int width, int height)
+{
+    image_t *self;
+    size_t offset;
+
+    assert(parent && parent->data);
+    assert(0 <= x && 0 < width && x + width <= parent->width);
+    assert(0 <= y && 0 < height && y + height <= parent->height);
+
+    switch(parent->type)
+    {
+    case IMAGE_BITMAP:
+        assert(x % 8 == 0);
+        offset = x / 8;
+        break;
+    default:
+        offset = image_row_bytes(x, parent->type);
+        break;
+    }
+    offset += (size_t)y * parent->stride;
+
+    self = image_new_from_mem_stride(width, height, parent->type, parent->data + offset, parent->stride);
+    if (self)
+    {
+        image_set_mem(self, IMAGE_MEM_VIEW, NULL, 0);
+    }
+    return self;
+}
+
+/**
+ * @brief Hand over a pixel data allocation to an image, which releases it in image_delete()
+ * @param self an image
+ * @param kind how the allocation was obtained (IMAGE_MEM_VIEW: borrowed, not released)
+ * @param base start of the allocation (self->data may point past a file header)
+ * @param size size of the allocation (in bytes)
+ *
+ * Allocations owned by images are accounted in the library's memory footprint (see image_memory.h).
+ */
+void image_set_mem(image_t *self, image_mem_t kind, void *base, size_t size)
+{
+    if (self->mem != IMAGE_MEM_VIEW)
+    {
+        mem_track_sub(self->mem_size);
+    }
+    self->mem = kind;
+    self->mem_base = base;
+    self->mem_size = size;
+    if (self->mem != IMAGE_MEM_VIEW)
+    {
+        mem_track_add(self->mem_size);
+    }
+}
+
 /**
  * @fn void image_delete(image_t *self)
- * @brief object destructor. Deallocates pixel data and image object.
+ * @brief object destructor. Deallocates pixel data (unless self is a view) and image object.
  * Please make sure that you don't keep dangling pointers on image data.
  */
 void image_delete(image_t *self) 
 {
     DEBUG_PRINT("Deleting image @%p", (void*)self);
  //   image_print_details(self);
-    free(self->data);
+    switch(self->mem)
+    {
+    case IMAGE_MEM_MMAP:
+        munmap(self->mem_base, self->mem_size);
+        break;
+    case IMAGE_MEM_VIEW:
+        /* pixel data belongs to the parent image */
+        break;
+    default:
+        free(self->mem_base);
+        break;
+    }
+    if (self->mem != IMAGE_MEM_VIEW)
+    {
+        mem_track_sub(self->mem_size);
+    }
     self->data = NULL;
     free(self);
 }
@@ -176,25 +433,27 @@ void image_print_ascii(const image_t *self)
     for (disp_y = 0; disp_y < disp_h; disp_y++)
     {
         img_y = disp_y * self->height / disp_h;
+        const uint8_t *row = image_row(self, img_y);
         printf("|");
         for (disp_x = 0; disp_x < disp_w; disp_x++)
         {
             img_x = disp_x * self->width / disp_w;
-            c = self->getpixel(self, img_x, img_y);
             switch (self->type)
             {
             case IMAGE_BITMAP:
-                disp_c = c.bit ? '#' : ' ';
+                disp_c = image_bmp_row_get(row, img_x) ? '#' : ' ';
                 break;
             case IMAGE_GRAYSCALE_8:
-                disp_c = " -+#" [c.gs8 >> 6];
+                disp_c = " -+#" [((const gs8_t *)row)[img_x] >> 6];
                 break;
             case IMAGE_GRAYSCALE_16:
-                disp_c = " -+#" [c.gs16 >> 14];
+                disp_c = " -+#" [((const gs16_t *)row)[img_x] >> 14];
                 break;
             case IMAGE_GRAYSCALE_FL:
-                disp_c = " -+#" [(int)(c.fl * 4.0)];
+                disp_c = " -+#" [(int)(LIMIT(((const float *)row)[img_x], 0.0, 0.999) * 4.0)];
+                break;
             default:
+                c.rgb = ((const rgb_t *)row)[img_x];
                 disp_c = " -+#" [((c.rgb.r + c.rgb.g + c.rgb.b) / 3) >> 6];
                 break;
             }
@@ -232,17 +491,8 @@ uint8_t image_coord_check(const image_t *self, int x, int y)
  */
 void image_bmp_setpixel(image_t *self, int x, int y, color_t c)
 {
-    assert(image_coord_check(self, x, y));
-    long int byte_idx = (int)((self->width + 7)/8) * y + x / 8;
-    int bit_idx = 7 - (x % 8);
-    if (c.bit)
-    {
-        self->data[byte_idx] |= 1 << bit_idx;
-    }
-    else
-    {
-        self->data[byte_idx] &= 0xFF ^ (1 << bit_idx);
-    }
+    IMAGE_COORD_ASSERT(self, x, y);
+    image_bmp_row_set(image_row(self, y), x, c.bit);
 }
 
 /** 
@@ -254,10 +504,8 @@ void image_bmp_setpixel(image_t *self, int x, int y, color_t c)
 color_t image_bmp_getpixel(const image_t *self, int x, int y)
 {
     color_t res;
-    assert(image_coord_check(self, x, y));
-    long int byte_idx = (int)((self->width + 7)/8) * y + x / 8;
-    int bit_idx = 7 - (x % 8);
-    res.bit = self->data[byte_idx] & (1 << bit_idx);
+    IMAGE_COORD_ASSERT(self, x, y);
+    res.bit = image_bmp_row_get(image_row(self, y), x);
     return res;
 }
 
@@ -269,8 +517,8 @@ color_t image_bmp_getpixel(const image_t *self, int x, int y)
  */
 void image_gs8_setpixel(image_t *self, int x, int y, color_t c)
 {
-    assert(image_coord_check(self, x, y));
-    self->data[y * self->width + x] = c.gs8;
+    IMAGE_COORD_ASSERT(self, x, y);
+    self->data[(size_t)y * self->stride + x] = c.gs8;
 }
 
 /** 
@@ -282,8 +530,8 @@ void image_gs8_setpixel(image_t *self, int x, int y, color_t c)
 color_t image_gs8_getpixel(const image_t *self, int x, int y)
 {
     color_t res;
-    assert(image_coord_check(self, x, y));
-    res.gs8 = self->data[y * self->width + x];
+    IMAGE_COORD_ASSERT(self, x, y);
+    res.gs8 = self->data[(size_t)y * self->stride + x];
     return res;
 }
 
@@ -295,8 +543,8 @@ color_t image_gs8_getpixel(const image_t *self, int x, int y)
  */
 void image_gs16_setpixel(image_t *self, int x, int y, color_t c)
 {
-    assert(image_coord_check(self, x, y));
-    memcpy(&(self->data[2 * (y * self->width + x)]), &(c.gs16), sizeof(gs16_t));
+    IMAGE_COORD_ASSERT(self, x, y);
+    memcpy(&(self->data[(size_t)y * self->stride + 2 * x]), &(c.gs16), sizeof(gs16_t));
 }
 
 /** 
@@ -308,8 +556,8 @@ void image_gs16_setpixel(image_t *self, int x, int y, color_t c)
 color_t image_gs16_getpixel(const image_t *self, int x, int y)
 {
     color_t res;
-    assert(image_coord_check(self, x, y));
-    memcpy(&(res.gs16), &(self->data[2 * (y * self->width + x)]), sizeof(gs16_t));
+    IMAGE_COORD_ASSERT(self, x, y);
+    memcpy(&(res.gs16), &(self->data[(size_t)y * self->stride + 2 * x]), sizeof(gs16_t));
     return res;
 }
 
@@ -321,8 +569,8 @@ color_t image_gs16_getpixel(const image_t *self, int x, int y)
  */
 void image_gsfl_setpixel(image_t *self, int x, int y, color_t c)
 {
-    assert(image_coord_check(self, x, y));
-    memcpy(&(self->data[sizeof(float) * (y * self->width + x)]), &(c.fl), sizeof(float));
+    IMAGE_COORD_ASSERT(self, x, y);
+    memcpy(&(self->data[(size_t)y * self->stride + sizeof(float) * x]), &(c.fl), sizeof(float));
 }
 
 /** 
@@ -334,8 +582,8 @@ void image_gsfl_setpixel(image_t *self, int x, int y, color_t c)
 color_t image_gsfl_getpixel(const image_t *self, int x, int y)
 {
     color_t res;
-    assert(image_coord_check(self, x, y));
-    memcpy(&(res.fl), &(self->data[sizeof(float) * (y * self->width + x)]), sizeof(float));
+    IMAGE_COORD_ASSERT(self, x, y);
+    memcpy(&(res.fl), &(self->data[(size_t)y * self->stride + sizeof(float) * x]), sizeof(float));
     return res;
 }
 
@@ -347,8 +595,8 @@ color_t image_gsfl_getpixel(const image_t *self, int x, int y)
  */
 void image_rgb_setpixel(image_t *self, int x, int y, color_t c)
 {
-    assert(image_coord_check(self, x, y));
-    memcpy(&(self->data[sizeof(rgb_t) * (y * self->width + x)]), &c.rgb, sizeof(rgb_t));
+    IMAGE_COORD_ASSERT(self, x, y);
+    memcpy(&(self->data[(size_t)y * self->stride + sizeof(rgb_t) * x]), &c.rgb, sizeof(rgb_t));
 }
 
 /** 
@@ -360,7 +608,7 @@ void image_rgb_setpixel(image_t *self, int x, int y, color_t c)
 color_t image_rgb_getpixel(const image_t *self, int x, int y)
 {
     color_t res;
-    assert(image_coord_check(self, x, y));
-    memcpy(&res.rgb, &(self->data[sizeof(rgb_t) * (y * self->width + x)]), sizeof(rgb_t));
+    IMAGE_COORD_ASSERT(self, x, y);
+    memcpy(&res.rgb, &(self->data[(size_t)y * self->stride + sizeof(rgb_t) * x]), sizeof(rgb_t));
     return res;
 }
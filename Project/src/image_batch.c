@@ -0,0 +1,621 @@
+/**
+ * @file image_batch.c
+ * @brief Image processing library: pipelined connected components labeling of batches of images
+ * @author Saint-Cirgue Arnaud _ Correge Etienne
+ * @version 0.1
+ * @date november 2023
+ */
+
+/**
+ * Each image goes through 4 stages, connected by bounded queues:
+ *
+ *   loaders (N threads) -> labelers (M workers) -> analyzer -> writer
+ *
+ * Stages run concurrently, so that reading image i+1 and writing results of image i-1
+ * overlap with the labeling of image i. A full queue blocks its producers (backpressure):
+ * at most queue_size images wait between two stages.
+ *
+ * Before starting, the header of every file is probed: images are dispatched largest first
+ * (so that a big image does not end the batch alone on one worker), and tag images are
+ * views on a few buffers sized for the largest image, allocated once and recycled by the writer.
+ *
+ * Parallelism has two levels: several images are labeled at once, each by an OpenMP team whose size
+ * depends on the image size (small images do not scale past a few threads). Teams draw their threads
+ * from a budget of cores: a worker waits for free cores before starting an image, and may get fewer
+ * threads than it asked for, so that the teams of all workers never oversubscribe the machine.
+ * Each worker keeps its own OpenMP team alive from an image to the next: labeling functions open their own
+ * parallel regions, so a worker is the master of a pool of threads, sized by its largest team so far. Idle pools
+ * hold threads but no cores; their total size is capped (options->max_pool_threads): a worker's team only grows
+ * past its pool size while the cap allows it.
+ */
+
+#include "image_batch.h"
+#include "queue.h"
+
+#include <dirent.h>
+#include <sys/stat.h>
+#include <omp.h>
+
+/**
+ * @brief an image traveling through the pipeline
+ */
+typedef struct
+{
+    int index;                              /*!< index of the file in the batch */
+    image_t *img;                           /*!< input image (released after labeling) */
+    image_t *tags;                          /*!< connected component numbers (a view on tags_buf) */
+    image_t *tags_buf;                      /*!< buffer of the tag pool holding tags */
+    image_connected_component_t *con_cmp;   /*!< connected components table */
+    int num_cc;                             /*!< number of connected components */
+} batch_job_t;
+
+/**
+ * @brief state shared by all pipeline stages
+ */
+typedef struct
+{
+    char **files;
+    int num_files;
+    const image_batch_options_t *options;
+    image_batch_result_t *results;
+    int *order;                 /*!< indices of the files to load, largest image first */
+    int num_jobs;               /*!< number of files to load */
+    int next_file;              /*!< position in order of the next file to load */
+    int loaders_running;        /*!< number of loader threads still running */
+    int labelers_running;       /*!< number of labeling workers still running */
+    int cores_free;             /*!< number of cores not used by a labeling or analysis team */
+    int pool_threads;           /*!< number of threads in the OpenMP pools of all workers (workers included) */
+    int max_pool_threads;       /*!< cap on pool_threads */
+    pthread_cond_t cores_released;
+    pthread_mutex_t mutex;
+    queue_t *to_label;
+    queue_t *to_analyze;
+    queue_t *to_write;
+    queue_t *free_tags;         /*!< pool of tag buffers, sized for the largest image */
+} batch_pipeline_t;
+
+/**
+ * @brief Leave a stage; the last thread of the stage closes the downstream queue
+ * @param self the pipeline
+ * @param running counter of running threads of the stage
+ * @param next the downstream queue
+ */
+static void batch_stage_exit(batch_pipeline_t *self, int *running, queue_t *next)
+{
+    pthread_mutex_lock(&self->mutex);
+    if (--(*running) == 0)
+    {
+        queue_close(next);
+    }
+    pthread_mutex_unlock(&self->mutex);
+}
+
+/**
+ * @brief Start the threads of a stage; a thread that cannot be created leaves the stage at once
+ * @param self the pipeline
+ * @param stage thread function of the stage
+ * @param num number of threads of the stage
+ * @param running counter of running threads of the stage (initially num)
+ * @param next the downstream queue
+ * @param threads (output) handles of the threads created
+ * @return number of threads created (at least one, or the program exits)
+ */
+static int batch_stage_start(batch_pipeline_t *self, void *(*stage)(void *), int num, int *running, queue_t *next,
+    pthread_t *threads)
+{
+    int n = 0;
+    for (int i = 0; i < num; ++i)
+    {
+        if (pthread_create(&threads[n], NULL, stage, self) == 0)
+        {
+            n++;
+        }
+        else
+        {
+            batch_stage_exit(self, running, next);
+        }
+    }
+    if (n == 0)
+    {
+        DIE("Cannot create the threads of the batch pipeline\n");
+    }
+    return n;
+}
+
+/**
+ * @brief Number of threads wanted for an image
+ * @param self the pipeline
+ * @param img an image
+ * @return number of threads, 1 to options->num_threads (at most CCL_MAX_THREADS)
+ */
+static int batch_threads_wanted(const batch_pipeline_t *self, const image_t *img)
+{
+    long num_pixels = (long)img->width * img->height;
+    long wanted = num_pixels / MAX(self->options->pixels_per_thread, 1);
+    return LIMIT(wanted, 1, LIMIT(self->options->num_threads, 1, CCL_MAX_THREADS));
+}
+
+/**
+ * @brief Take cores from the budget; wait until at least one is free
+ * @param self the pipeline
+ * @param wanted number of cores wanted
+ * @param pool_size (input/output) size of the calling worker's OpenMP pool (1 before its first team)
+ * @return number of cores granted, 1 to wanted; a team larger than the pool grows it, within the cap
+ */
+static int batch_cores_acquire(batch_pipeline_t *self, int wanted, int *pool_size)
+{
+    pthread_mutex_lock(&self->mutex);
+    while (self->cores_free == 0)
+    {
+        pthread_cond_wait(&self->cores_released, &self->mutex);
+    }
+    int granted = MIN(wanted, self->cores_free);
+    if (granted > *pool_size)
+    {
+        int growth = LIMIT(self->max_pool_threads - self->pool_threads, 0, granted - *pool_size);
+        self->pool_threads += growth;
+        *pool_size += growth;
+        granted = *pool_size;
+    }
+    self->cores_free -= granted;
+    pthread_mutex_unlock(&self->mutex);
+    return granted;
+}
+
+/**
+ * @brief Give cores back to the budget
+ * @param self the pipeline
+ * @param num_cores number of cores
+ */
+static void batch_cores_release(batch_pipeline_t *self, int num_cores)
+{
+    pthread_mutex_lock(&self->mutex);
+    self->cores_free += num_cores;
+    pthread_cond_broadcast(&self->cores_released);
+    pthread_mutex_unlock(&self->mutex);
+}
+
+/**
+ * @brief Loader stage: read image files, in batch order
+ */
+static void *batch_loader(void *arg)
+{
+    batch_pipeline_t *self = arg;
+
+    /* loaders are outside the core budget: keep their decoding sequential */
+    omp_set_num_threads(1);
+
+    for (;;)
+    {
+        pthread_mutex_lock(&self->mutex);
+        int k = self->next_file++;
+        pthread_mutex_unlock(&self->mutex);
+        if (k >= self->num_jobs)
+        {
+            break;
+        }
+        int i = self->order[k];
+
+        image_t *img = image_new_open_mmap(self->files[i]);
+        if (!img || img->width != self->results[i].width || img->height != self->results[i].height)
+        {
+            /* the file changed since it was probed */
+            fprintf(stderr, "%s: skipped (not a supported image)\n", self->files[i]);
+            if (img)
+            {
+                image_delete(img);
+            }
+            continue;
+        }
+        if (img->type != IMAGE_BITMAP)
+        {
+            /* grayscale/color scans: binarize while loading, with the default settings */
+            image_t *bitmap = image_new_threshold(img, NULL);
+            image_delete(img);
+            img = bitmap;
+            assert(img);
+        }
+
+        batch_job_t *job = calloc(1, sizeof(batch_job_t));
+        assert(job);
+        job->index = i;
+        job->img = img;
+        queue_push(self->to_label, job);
+    }
+
+    batch_stage_exit(self, &self->loaders_running, self->to_label);
+    return NULL;
+}
+
+/**
+ * @brief Labeling stage: tag connected components; the equivalence table is reused from an image to the next,
+ * and tags are written to a buffer of the pool
+ */
+static void *batch_labeler(void *arg)
+{
+    batch_pipeline_t *self = arg;
+    batch_job_t *job;
+    int *equiv_table;
+    int pool_size = 1;
+
+    equiv_table = mem_track_malloc(MAX_TAGS * sizeof(int));
+    assert(equiv_table);
+
+    while (queue_pop(self->to_label, (void **)&job) == QUEUE_OK)
+    {
+        queue_pop(self->free_tags, (void **)&job->tags_buf);
+        job->tags = image_new_view(job->tags_buf, 0, 0, job->img->width, job->img->height);
+        assert(job->tags);
+
+        int num_threads = batch_cores_acquire(self, batch_threads_wanted(self, job->img), &pool_size);
+        omp_set_num_threads(num_threads);
+        job->num_cc = ccl_label(job->img, job->tags, equiv_table);
+        batch_cores_release(self, num_threads);
+
+        /* the input image is not needed any more */
+        image_delete(job->img);
+        job->img = NULL;
+        if (job->num_cc < 0)
+        {
+            /* too many temporary tags: the image is skipped (its result keeps num_cc = -1), the batch goes on */
+            fprintf(stderr, "%s: skipped (more than %d temporary tags)\n", self->files[job->index], MAX_TAGS - 1);
+            image_delete(job->tags);
+            queue_push(self->free_tags, job->tags_buf);
+            free(job);
+            continue;
+        }
+        queue_push(self->to_analyze, job);
+    }
+
+    mem_track_free(equiv_table, MAX_TAGS * sizeof(int));
+    batch_stage_exit(self, &self->labelers_running, self->to_analyze);
+    return NULL;
+}
+
+/**
+ * @brief Analysis stage: bounding box and size of each connected component
+ */
+static void *batch_analyzer(void *arg)
+{
+    batch_pipeline_t *self = arg;
+    batch_job_t *job;
+    int pool_size = 1;
+
+    while (queue_pop(self->to_analyze, (void **)&job) == QUEUE_OK)
+    {
+        job->con_cmp = mem_track_calloc(MAX(job->num_cc, 1), sizeof(image_connected_component_t));
+        assert(job->con_cmp);
+
+        int num_threads = batch_cores_acquire(self, batch_threads_wanted(self, job->tags), &pool_size);
+        omp_set_num_threads(num_threads);
+        ccl_analyze(job->tags, job->con_cmp, job->num_cc);
+        batch_cores_release(self, num_threads);
+        queue_push(self->to_write, job);
+    }
+    queue_close(self->to_write);
+    return NULL;
+}
+
+/**
+ * @brief Build the path of an output file: <out_dir>/<input file name without extension><suffix>
+ * @param out_dir output directory
+ * @param fname input file path
+ * @param suffix output file suffix
+ * @return newly allocated path
+ */
+static char *batch_output_path(const char *out_dir, const char *fname, const char *suffix)
+{
+    const char *base = strrchr(fname, '/');
+    base = base ? base + 1 : fname;
+    const char *ext = strrchr(base, '.');
+    int base_len = ext ? (int)(ext - base) : (int)strlen(base);
+
+    size_t len = strlen(out_dir) + base_len + strlen(suffix) + 2;
+    char *path = malloc(len);
+    assert(path);
+    snprintf(path, len, "%s/%.*s%s", out_dir, base_len, base, suffix);
+    return path;
+}
+
+/**
+ * @brief Writer stage: collect results, and write output files (connected components table, and class image)
+ */
+static void *batch_writer(void *arg)
+{
+    batch_pipeline_t *self = arg;
+    const char *out_dir = self->options->out_dir;
+    batch_job_t *job;
+
+    while (queue_pop(self->to_write, (void **)&job) == QUEUE_OK)
+    {
+        image_batch_result_t *res = &self->results[job->index];
+        res->num_cc = job->num_cc;
+        for (int t = 0; t < job->num_cc; ++t)
+        {
+            res->largest_cc = MAX(res->largest_cc, job->con_cmp[t].num_pixels);
+        }
+
+        if (out_dir)
+        {
+            char *path = batch_output_path(out_dir, res->fname, ".classes.pgm");
+            image_save_binary(job->tags, path);
+            free(path);
+
+            path = batch_output_path(out_dir, res->fname, ".cc.csv");
+            FILE *fp = fopen(path, "w");
+            if (fp)
+            {
+                fprintf(fp, "class,x1,y1,x2,y2,num_pixels\n");
+                for (int t = 0; t < job->num_cc; ++t)
+                {
+                    image_connected_component_t *cc = &job->con_cmp[t];
+                    fprintf(fp, "%d,%d,%d,%d,%d,%u\n", t + 1, cc->x1, cc->y1, cc->x2, cc->y2, cc->num_pixels);
+                }
+                fclose(fp);
+            }
+            free(path);
+        }
+
+        image_delete(job->tags);
+        queue_push(self->free_tags, job->tags_buf);
+        mem_track_free(job->con_cmp, MAX(job->num_cc, 1) * sizeof(image_connected_component_t));
+        free(job);
+    }
+    return NULL;
+}
+
+/**
+ * @brief Default pipeline settings: 2 loaders, one labeling worker per core, all cores in the budget,
+ * pools of at most 2 threads per core in total, one thread per 256k pixels, queues of 4 images
+ * @return settings
+ */
+image_batch_options_t image_batch_default_options(void)
+{
+    int num_cores = omp_get_num_procs();
+    return (image_batch_options_t){
+        .num_loaders = 2,
+        .num_labelers = num_cores,
+        .num_threads = MIN(num_cores, CCL_MAX_THREADS),
+        .num_cores = num_cores,
+        .max_pool_threads = 2 * num_cores,
+        .pixels_per_thread = 256 * 1024,
+        .queue_size = 4,
+        .out_dir = NULL};
+}
+
+/**
+ * @brief a file of the batch, for sorting by size
+ */
+typedef struct
+{
+    int index;              /*!< index of the file in the batch */
+    long num_pixels;        /*!< image size (in pixels) */
+} batch_size_t;
+
+/**
+ * @brief Compare two files by decreasing size, then by batch order, for qsort()
+ */
+static int batch_compare_sizes(const void *a, const void *b)
+{
+    const batch_size_t *sa = a, *sb = b;
+    if (sa->num_pixels != sb->num_pixels)
+    {
+        return (sa->num_pixels < sb->num_pixels) ? 1 : -1;
+    }
+    return sa->index - sb->index;
+}
+
+/**
+ * @brief Label connected components of a batch of image files (bitmaps, or grayscale/color images binarized while loading), with a pipeline of concurrent stages
+ * @param files paths of image files
+ * @param num_files number of files
+ * @param options pipeline settings (see image_batch_default_options())
+ * @param results (output) table of num_files results, in batch order
+ * @return number of images processed
+ */
+int image_batch_run(char **files, int num_files, const image_batch_options_t *options, image_batch_result_t *results)
+{
+    batch_pipeline_t self = {
+        .files = files,
+        .num_files = num_files,
+        .options = options,
+        .results = results,
+        .cores_free = MAX(1, options->num_cores)};
+    int num_loaders = MAX(1, options->num_loaders), num_labelers = MAX(1, options->num_labelers);
+    /* stage counters are decremented by running threads: only read them under the mutex from now on */
+    self.loaders_running = num_loaders;
+    self.labelers_running = num_labelers;
+    /* labeling workers and the analyzer each hold a pool of at least one thread (themselves) */
+    self.pool_threads = num_labelers + 1;
+    self.max_pool_threads = MAX(options->max_pool_threads, self.pool_threads);
+    int num_threads = num_loaders + num_labelers + 2;
+    int num_buffers = num_labelers + 2;
+    pthread_t *threads = calloc(num_threads, sizeof(pthread_t));
+    batch_size_t *sizes = calloc(MAX(num_files, 1), sizeof(batch_size_t));
+    int max_width = 1, max_height = 1;
+    int i, n = 0, processed = 0;
+
+    assert(threads && sizes);
+    for (i = 0; i < num_files; ++i)
+    {
+        results[i] = (image_batch_result_t){.fname = files[i], .num_cc = -1};
+    }
+
+    /* probe headers: dimensions of all images, without reading pixel data */
+    #pragma omp parallel for schedule(dynamic) reduction(max:max_width, max_height)
+    for (i = 0; i < num_files; ++i)
+    {
+        image_info_t info;
+        sizes[i] = (batch_size_t){.index = i, .num_pixels = -1};
+        if (image_probe(files[i], &info) != 0)
+        {
+            continue;
+        }
+        results[i].width = info.width;
+        results[i].height = info.height;
+        sizes[i].num_pixels = (long)info.width * info.height;
+        max_width = MAX(max_width, info.width);
+        max_height = MAX(max_height, info.height);
+    }
+
+    qsort(sizes, num_files, sizeof(batch_size_t), batch_compare_sizes);
+    self.order = malloc(MAX(num_files, 1) * sizeof(int));
+    assert(self.order);
+    for (i = 0; i < num_files; ++i)
+    {
+        if (sizes[i].num_pixels < 0)
+        {
+            fprintf(stderr, "%s: skipped (not a supported image)\n", files[sizes[i].index]);
+            continue;
+        }
+        self.order[self.num_jobs++] = sizes[i].index;
+    }
+    free(sizes);
+
+    pthread_mutex_init(&self.mutex, NULL);
+    pthread_cond_init(&self.cores_released, NULL);
+    self.to_label = queue_new(options->queue_size);
+    self.to_analyze = queue_new(options->queue_size);
+    self.to_write = queue_new(options->queue_size);
+    self.free_tags = queue_new(num_buffers);
+    assert(self.to_label && self.to_analyze && self.to_write && self.free_tags);
+
+    /* tag buffers: enough for every labeling worker, the analyzer and the writer to hold one */
+    for (i = 0; i < MIN(num_buffers, self.num_jobs); ++i)
+    {
+        image_t *buf = image_new(max_width, max_height, IMAGE_GRAYSCALE_16);
+        assert(buf);
+        queue_push(self.free_tags, buf);
+    }
+
+    n += batch_stage_start(&self, batch_loader, num_loaders, &self.loaders_running, self.to_label, &threads[n]);
+    n += batch_stage_start(&self, batch_labeler, num_labelers, &self.labelers_running, self.to_analyze, &threads[n]);
+    if (pthread_create(&threads[n++], NULL, batch_analyzer, &self) != 0
+        || pthread_create(&threads[n++], NULL, batch_writer, &self) != 0)
+    {
+        DIE("Cannot create the threads of the batch pipeline\n");
+    }
+
+    for (i = 0; i < n; ++i)
+    {
+        pthread_join(threads[i], NULL);
+    }
+
+    queue_delete(self.to_label);
+    queue_delete(self.to_analyze);
+    queue_delete(self.to_write);
+
+    queue_close(self.free_tags);
+    image_t *buf;
+    while (queue_pop(self.free_tags, (void **)&buf) == QUEUE_OK)
+    {
+        image_delete(buf);
+    }
+    queue_delete(self.free_tags);
+    pthread_cond_destroy(&self.cores_released);
+    pthread_mutex_destroy(&self.mutex);
+    free(self.order);
+    free(threads);
+
+    for (i = 0; i < num_files; ++i)
+    {
+        processed += (results[i].num_cc >= 0);
+    }
+    return processed;
+}
+
+/**
+ * @brief Compare two strings, for qsort()
+ */
+static int batch_compare_names(const void *a, const void *b)
+{
+    return strcmp(*(char * const *)a, *(char * const *)b);
+}
+
+/**
+ * @brief Build the list of files of a batch
+ * @param path either a directory (all its .pbm files, sorted by name), or a text file listing one image path per line
+ * @param files_out (output) newly allocated table of paths; release with image_batch_list_delete()
+ * @return number of files, -1 if path cannot be read
+ */
+int image_batch_list(const char *path, char ***files_out)
+{
+    struct stat st;
+    char **files = NULL;
+    int num_files = 0, capacity = 0;
+    char line[4096];
+
+    if (stat(path, &st) != 0)
+    {
+        return -1;
+    }
+
+    if (S_ISDIR(st.st_mode))
+    {
+        DIR *dir = opendir(path);
+        struct dirent *entry;
+        if (!dir)
+        {
+            return -1;
+        }
+        while ((entry = readdir(dir)) != NULL)
+        {
+            const char *ext = strrchr(entry->d_name, '.');
+            if (!ext || strcmp(ext, ".pbm"))
+            {
+                continue;
+            }
+            if (num_files == capacity)
+            {
+                capacity = MAX(16, 2 * capacity);
+                files = realloc(files, capacity * sizeof(char *));
+                assert(files);
+            }
+            snprintf(line, sizeof(line), "%s/%s", path, entry->d_name);
+            files[num_files++] = strdup(line);
+        }
+        closedir(dir);
+        qsort(files, num_files, sizeof(char *), batch_compare_names);
+    }
+    else
+    {
+        FILE *fp = fopen(path, "r");
+        if (!fp)
+        {
+            return -1;
+        }
+        while (fgets(line, sizeof(line), fp))
+        {
+            line[strcspn(line, "\r\n")] = '\0';
+            if (line[0] == '\0' || line[0] == '#')
+            {
+                continue;
+            }
+            if (num_files == capacity)
+            {
+                capacity = MAX(16, 2 * capacity);
+                files = realloc(files, capacity * sizeof(char *));
+                assert(files);
+            }
+            files[num_files++] = strdup(line);
+        }
+        fclose(fp);
+    }
+
+    *files_out = files;
+    return num_files;
+}
+
+/**
+ * @brief Release a list of files built by image_batch_list()
+ * @param files table of paths
+ * @param num_files number of paths
+ */
+void image_batch_list_delete(char **files, int num_files)
+{
+    for (int i = 0; i < num_files; ++i)
+    {
+        free(files[i]);
+    }
+    free(files);
+}
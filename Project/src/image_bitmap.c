@@ -0,0 +1,213 @@
+/**
+ * @file image_bitmap.c
+ * @brief Image processing library: bit-parallel operations on packed bitmap rows
+ * @author Saint-Cirgue Arnaud _ Correge Etienne
+ * @version 0.1
+ * @date november 2023
+ */
+#include "image_bitmap.h"
+#include "utils.h"
+#include <omp.h>
+
+/**
+ * @brief Load up to 8 bytes of a bitmap row as a 64-bit word, pixel order preserved
+ * @param bytes pointer into a bitmap row
+ * @param nbytes number of valid bytes from that pointer (missing bytes read as 0)
+ * @return a word where pixel #i (counted from the pointer) is bit 63-i
+ */
+static inline uint64_t bmp_load_word(const uint8_t *bytes, int nbytes)
+{
+    uint64_t w = 0;
+    memcpy(&w, bytes, (nbytes >= 8) ? 8 : nbytes);
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    w = __builtin_bswap64(w);
+#endif
+    return w;
+}
+
+/**
+ * @brief Mask of the valid pixels in the last byte of a bitmap row
+ * @param width row width (in pixels)
+ * @return byte mask
+ */
+static inline uint8_t bmp_last_byte_mask(int width)
+{
+    return (width % 8) ? (uint8_t)(0xFF << (8 - width % 8)) : 0xFF;
+}
+
+/**
+ * @brief Count the set pixels of a bitmap row
+ * @param row pointer to bitmap row
+ * @param width row width (in pixels)
+ * @return number of pixels set to 1
+ */
+int bmp_row_popcount(const uint8_t *row, int width)
+{
+    int nbytes = (width + 7) / 8;
+    int count = 0;
+    int i = 0;
+    uint64_t w;
+
+    for (; i + 8 < nbytes; i += 8)
+    {
+        memcpy(&w, row + i, 8);
+        count += __builtin_popcountll(w);
+    }
+    for (; i < nbytes - 1; ++i)
+    {
+        count += __builtin_popcount(row[i]);
+    }
+    return count + __builtin_popcount(row[nbytes - 1] & bmp_last_byte_mask(width));
+}
+
+/**
+ * Generate a bitwise row operation, processing 64 pixels per iteration
+ */
+#define BMP_ROW_OPERATION(name, op) \
+    void bmp_row_##name(uint8_t *dst, const uint8_t *a, const uint8_t *b, int width) \
+    { \
+        int nbytes = (width + 7) / 8; \
+        int i = 0; \
+        uint64_t wa, wb; \
+        for (; i + 8 <= nbytes; i += 8) \
+        { \
+            memcpy(&wa, a + i, 8); \
+            memcpy(&wb, b + i, 8); \
+            wa = wa op wb; \
+            memcpy(dst + i, &wa, 8); \
+        } \
+        for (; i < nbytes; ++i) \
+        { \
+            dst[i] = a[i] op b[i]; \
+        } \
+    }
+
+/**
+ * @fn void bmp_row_and(uint8_t *dst, const uint8_t *a, const uint8_t *b, int width)
+ * @brief Pixel-wise AND of two bitmap rows (dst may alias a or b)
+ */
+BMP_ROW_OPERATION(and, &)
+
+/**
+ * @fn void bmp_row_or(uint8_t *dst, const uint8_t *a, const uint8_t *b, int width)
+ * @brief Pixel-wise OR of two bitmap rows (dst may alias a or b)
+ */
+BMP_ROW_OPERATION(or, |)
+
+/**
+ * @fn void bmp_row_xor(uint8_t *dst, const uint8_t *a, const uint8_t *b, int width)
+ * @brief Pixel-wise XOR of two bitmap rows (dst may alias a or b)
+ */
+BMP_ROW_OPERATION(xor, ^)
+
+/**
+ * @brief Compare two bitmap rows, ignoring padding bits
+ * @param a pointer to bitmap row
+ * @param b pointer to bitmap row
+ * @param width row width (in pixels)
+ * @return true iff all pixels are equal
+ */
+bool bmp_row_equal(const uint8_t *a, const uint8_t *b, int width)
+{
+    int nbytes = (width + 7) / 8;
+    return !memcmp(a, b, nbytes - 1) &&
+        !((a[nbytes - 1] ^ b[nbytes - 1]) & bmp_last_byte_mask(width));
+}
+
+/**
+ * @brief Find the next pixel of given value in a bitmap row
+ * @param row pointer to bitmap row
+ * @param width row width (in pixels)
+ * @param x abscissa where to start the search
+ * @param bit pixel value to look for
+ * @return abscissa of the first pixel >= x with value bit, or width if there is none
+ *
+ * Scans 64 pixels per iteration, with a count-leading-zeros on the first matching word.
+ */
+int bmp_row_find_next(const uint8_t *row, int width, int x, bool bit)
+{
+    int nbytes = (width + 7) / 8;
+
+    while (x < width)
+    {
+        int byte0 = (x / 64) * 8;
+        uint64_t w = bmp_load_word(row + byte0, nbytes - byte0);
+        if (!bit)
+        {
+            w = ~w;
+        }
+        /* ignore pixels before x */
+        w &= ~0ULL >> (x % 64);
+        if (w)
+        {
+            return MIN(8 * byte0 + __builtin_clzll(w), width);
+        }
+        x = 8 * byte0 + 64;
+    }
+    return width;
+}
+
+/**
+ * @brief Clear the bits after the last pixel of a bitmap row
+ * @param row pointer to bitmap row
+ * @param width row width (in pixels)
+ */
+void bmp_row_clear_padding(uint8_t *row, int width)
+{
+    row[(width - 1) / 8] &= bmp_last_byte_mask(width);
+}
+
+/**
+ * @brief Count the set pixels of a bitmap image
+ * @param self a bitmap image
+ * @return number of pixels set to 1
+ */
+long image_bmp_popcount(const image_t *self)
+{
+    long count = 0;
+    int y;
+    assert(self && self->type == IMAGE_BITMAP);
+
+    #pragma omp parallel for reduction(+:count)
+    for (y = 0; y < self->height; ++y)
+    {
+        count += bmp_row_popcount(image_row(self, y), self->width);
+    }
+    return count;
+}
+
+/**
+ * Generate an image-level bitwise operation, parallel over rows
+ */
+#define IMAGE_BMP_OPERATION(name) \
+    void image_bmp_##name(image_t *dst, const image_t *a, const image_t *b) \
+    { \
+        int y; \
+        assert(dst && a && b); \
+        assert(dst->type == IMAGE_BITMAP && a->type == IMAGE_BITMAP && b->type == IMAGE_BITMAP); \
+        assert(a->width == dst->width && b->width == dst->width); \
+        assert(a->height == dst->height && b->height == dst->height); \
+        _Pragma("omp parallel for") \
+        for (y = 0; y < dst->height; ++y) \
+        { \
+            bmp_row_##name(image_row(dst, y), image_row(a, y), image_row(b, y), dst->width); \
+        } \
+    }
+
+/**
+ * @fn void image_bmp_and(image_t *dst, const image_t *a, const image_t *b)
+ * @brief Pixel-wise AND of two bitmap images of the same size (dst may be a or b)
+ */
+IMAGE_BMP_OPERATION(and)
+
+/**
+ * @fn void image_bmp_or(image_t *dst, const image_t *a, const image_t *b)
+ * @brief Pixel-wise OR of two bitmap images of the same size (dst may be a or b)
+ */
+IMAGE_BMP_OPERATION(or)
+
+/**
+ * @fn void image_bmp_xor(image_t *dst, const image_t *a, const image_t *b)
+ * @brief Pixel-wise XOR of two bitmap images of the same size (dst may be a or b)
+ */
+IMAGE_BMP_OPERATION(xor)
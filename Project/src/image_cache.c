@@ -0,0 +1,460 @@
+/**
+ * @file image_cache.c
+ * @brief Image processing library: content-addressed cache of connected components labeling results
+ * @author Saint-Cirgue Arnaud _ Correge Etienne
+ * @version 0.1
+ * @date november 2023
+ */
+
+/**
+ * The cache is a directory of files named after a 64-bit key (<key>.ccl); the key hashes the pixel
+ * data and everything that changes the result (image type, binarization settings, format version).
+ * An entry holds a ccl_cache_header_t, the connected components table, and optionally the label map:
+ *
+ *     header | num_cc x image_connected_component_t | height x uint32_t (runs per row) | runs
+ *
+ * The label map is run-length encoded row by row, as (tag, length) pairs: rows are encoded and
+ * decoded in parallel. Entries are written to a temporary file (one per process and per store), then
+ * renamed: concurrent processes and threads sharing a cache never read a partial entry.
+ *
+ * Hashing reads the image once, rows in parallel, 32 bytes per step on 4 independent lanes
+ * (in the manner of xxHash64): it is bound by memory bandwidth, far cheaper than labeling.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <unistd.h>
+#include <omp.h>
+
+#include "image_cache.h"
+#include "image_threshold.h"
+
+/**
+ * @brief cache settings
+ */
+static char *cache_dir = NULL;
+static bool cache_store_labels = false;
+
+static const uint64_t CACHE_PRIME1 = 0x9E3779B185EBCA87ULL;
+static const uint64_t CACHE_PRIME2 = 0xC2B2AE3D27D4EB4FULL;
+static const uint64_t CACHE_PRIME3 = 0x165667B19E3779F9ULL;
+
+/**
+ * @brief a run of the label map: length pixels with the same tag
+ */
+typedef struct
+{
+    uint32_t tag;
+    uint32_t length;
+} cache_run_t;
+
+static inline uint64_t cache_rotl(uint64_t x, int r)
+{
+    return (x << r) | (x >> (64 - r));
+}
+
+/**
+ * @brief Accumulate a 64-bit word into a lane
+ */
+static inline uint64_t cache_round(uint64_t acc, uint64_t w)
+{
+    acc += w * CACHE_PRIME2;
+    return cache_rotl(acc, 31) * CACHE_PRIME1;
+}
+
+/**
+ * @brief Final mixing of a hash value (avalanche)
+ */
+static inline uint64_t cache_mix(uint64_t h)
+{
+    h ^= h >> 33;
+    h *= CACHE_PRIME2;
+    h ^= h >> 29;
+    h *= CACHE_PRIME3;
+    h ^= h >> 32;
+    return h;
+}
+
+static inline uint64_t cache_load64(const uint8_t *p)
+{
+    uint64_t w;
+    memcpy(&w, p, 8);
+    return w;
+}
+
+/**
+ * @brief Hash the bytes of a pixel row
+ * @param p row
+ * @param len number of bytes (at least 1)
+ * @param last_mask mask of the significant bits of the last byte (bitmap padding is ignored)
+ * @param seed seed
+ * @return hash value
+ */
+static uint64_t cache_hash_row(const uint8_t *p, size_t len, uint8_t last_mask, uint64_t seed)
+{
+    uint64_t acc[4] = {seed + CACHE_PRIME1 + CACHE_PRIME2, seed + CACHE_PRIME2, seed, seed - CACHE_PRIME1};
+    size_t i = 0;
+
+    /* the last byte is always left for the tail */
+    for (; i + 32 < len; i += 32)
+    {
+        acc[0] = cache_round(acc[0], cache_load64(p + i));
+        acc[1] = cache_round(acc[1], cache_load64(p + i + 8));
+        acc[2] = cache_round(acc[2], cache_load64(p + i + 16));
+        acc[3] = cache_round(acc[3], cache_load64(p + i + 24));
+    }
+    for (; i + 8 < len; i += 8)
+    {
+        acc[0] = cache_round(acc[0], cache_load64(p + i));
+    }
+    uint8_t tail[8] = {0};
+    memcpy(tail, p + i, len - i);
+    tail[len - i - 1] &= last_mask;
+    acc[1] = cache_round(acc[1], cache_load64(tail));
+
+    uint64_t h = cache_rotl(acc[0], 1) + cache_rotl(acc[1], 7) + cache_rotl(acc[2], 12) + cache_rotl(acc[3], 18);
+    return cache_mix(h + len);
+}
+
+/**
+ * @brief Hash the pixel data of an image (ignoring row padding), rows in parallel
+ * @param self an image
+ * @return 64-bit hash value
+ */
+uint64_t image_hash(const image_t *self)
+{
+    size_t row_bytes = image_row_bytes(self->width, self->type);
+    uint8_t last_mask = (self->type == IMAGE_BITMAP && self->width % 8) ? (uint8_t)(0xFF << (8 - self->width % 8)) : 0xFF;
+    uint64_t *row_hash = malloc(self->height * sizeof(uint64_t));
+    int y;
+    assert(row_hash);
+
+    #pragma omp parallel for schedule(static)
+    for (y = 0; y < self->height; ++y)
+    {
+        row_hash[y] = cache_hash_row(image_row(self, y), row_bytes, last_mask, y);
+    }
+
+    /* combine in row order */
+    uint64_t h = cache_mix(((uint64_t)self->width << 32) ^ ((uint64_t)self->height << 8) ^ self->type);
+    for (y = 0; y < self->height; ++y)
+    {
+        h = cache_round(h, row_hash[y]);
+    }
+    free(row_hash);
+    return cache_mix(h);
+}
+
+/**
+ * @brief Enable (or disable) the cache of image_connected_components() results
+ * @param dir cache directory (must exist), or NULL to disable the cache
+ * @param store_labels true to store label maps too (image_connected_components() then also fills tags from the cache)
+ */
+void ccl_cache_set_dir(const char *dir, bool store_labels)
+{
+    free(cache_dir);
+    cache_dir = dir ? strdup(dir) : NULL;
+    cache_store_labels = store_labels;
+}
+
+/**
+ * @brief Tell whether the cache is enabled
+ */
+bool ccl_cache_enabled(void)
+{
+    return cache_dir != NULL;
+}
+
+/**
+ * @brief Cache key of an input image of image_connected_components()
+ * @param self input image
+ * @return key: hash of the pixel data, and of the settings the result depends on
+ */
+uint64_t ccl_cache_key(const image_t *self)
+{
+    uint64_t key = cache_round(image_hash(self), CCL_CACHE_VERSION);
+    if (self->type != IMAGE_BITMAP)
+    {
+        /* grayscale/color images are binarized first (see image_threshold.h) */
+        image_threshold_options_t options = image_threshold_default_options();
+        key = cache_round(key, options.method);
+        key = cache_round(key, options.level);
+        key = cache_round(key, options.window);
+        key = cache_round(key, options.percent);
+    }
+    return cache_mix(key);
+}
+
+/**
+ * @brief Path of a cache entry
+ * @param key cache key
+ * @param suffix path suffix
+ * @return newly allocated path
+ */
+static char *cache_path(uint64_t key, const char *suffix)
+{
+    size_t len = strlen(cache_dir) + strlen(suffix) + 32;
+    char *path = malloc(len);
+    assert(path);
+    snprintf(path, len, "%s/%016llx.ccl%s", cache_dir, (unsigned long long)key, suffix);
+    return path;
+}
+
+/**
+ * @brief Decode a run-length encoded label map
+ * @return 0 if success, -1 if the runs do not match the image
+ */
+static int cache_decode_labels(image_t *tags, const uint32_t *row_runs, const cache_run_t *runs, size_t num_runs)
+{
+    size_t *first_run = malloc((tags->height + 1) * sizeof(size_t));
+    int y, error = 0;
+    assert(first_run);
+
+    first_run[0] = 0;
+    for (y = 0; y < tags->height; ++y)
+    {
+        first_run[y + 1] = first_run[y] + row_runs[y];
+    }
+    if (first_run[tags->height] != num_runs)
+    {
+        free(first_run);
+        return -1;
+    }
+
+    #pragma omp parallel for schedule(static) reduction(|:error)
+    for (y = 0; y < tags->height; ++y)
+    {
+        gs16_t *tag_row = image_gs16_row(tags, y);
+        int x = 0;
+        for (size_t r = first_run[y]; r < first_run[y + 1]; ++r)
+        {
+            if (runs[r].length > (uint32_t)(tags->width - x))
+            {
+                error = 1;
+                break;
+            }
+            for (uint32_t i = 0; i < runs[r].length; ++i)
+            {
+                tag_row[x++] = runs[r].tag;
+            }
+        }
+        error |= (x != tags->width);
+    }
+    free(first_run);
+    return error ? -1 : 0;
+}
+
+/**
+ * @brief Look up the results of image_connected_components() in the cache
+ * @param key cache key (see ccl_cache_key())
+ * @param width image width
+ * @param height image height
+ * @param tags (output) connected component numbers, if the entry holds a label map; or NULL
+ * @param stats (output) connected components table (stats->cached is 1 without label map, 2 with it)
+ * @return number of connected components, -1 if not found
+ */
+int ccl_cache_load(uint64_t key, int width, int height, image_t *tags, ccl_stats_t *stats)
+{
+    ccl_cache_header_t hdr;
+    int res = -1;
+
+    if (!cache_dir)
+    {
+        return -1;
+    }
+    char *path = cache_path(key, "");
+    FILE *fp = fopen(path, "rb");
+    free(path);
+    if (!fp)
+    {
+        return -1;
+    }
+
+    if (fread(&hdr, sizeof(hdr), 1, fp) != 1 || memcmp(hdr.magic, CCL_CACHE_MAGIC, 4) != 0 ||
+        hdr.version != CCL_CACHE_VERSION || hdr.key != key ||
+        hdr.width != (uint32_t)width || hdr.height != (uint32_t)height)
+    {
+        DEBUG_PRINT("Cache entry %016llx does not match", (unsigned long long)key);
+        fclose(fp);
+        return -1;
+    }
+
+    image_connected_component_t *con_cmp = malloc(MAX(hdr.num_cc, 1) * sizeof(image_connected_component_t));
+    assert(con_cmp);
+    if (fread(con_cmp, sizeof(image_connected_component_t), hdr.num_cc, fp) != hdr.num_cc)
+    {
+        free(con_cmp);
+        fclose(fp);
+        return -1;
+    }
+    int cached = 1;
+
+    if (hdr.has_labels && tags)
+    {
+        uint32_t *row_runs = malloc(height * sizeof(uint32_t));
+        assert(row_runs);
+        if (fread(row_runs, sizeof(uint32_t), height, fp) == (size_t)height)
+        {
+            size_t num_runs = 0;
+            for (int y = 0; y < height; ++y)
+            {
+                num_runs += row_runs[y];
+            }
+            cache_run_t *runs = malloc(MAX(num_runs, 1) * sizeof(cache_run_t));
+            assert(runs);
+            /* tags may be larger than the image */
+            image_t *view = image_new_view(tags, 0, 0, width, height);
+            assert(view);
+            if (fread(runs, sizeof(cache_run_t), num_runs, fp) == num_runs &&
+                cache_decode_labels(view, row_runs, runs, num_runs) == 0)
+            {
+                cached = 2;
+            }
+            image_delete(view);
+            free(runs);
+        }
+        free(row_runs);
+        if (cached != 2)
+        {
+            /* damaged label map: the caller recomputes everything */
+            free(con_cmp);
+            fclose(fp);
+            return -1;
+        }
+    }
+    fclose(fp);
+
+    stats->con_cmp = con_cmp;
+    stats->largest_cc = hdr.largest_cc;
+    stats->cached = cached;
+    res = hdr.num_cc;
+    DEBUG_PRINT("Cache hit %016llx: %d connected components", (unsigned long long)key, res);
+    return res;
+}
+
+/**
+ * @brief Store the results of image_connected_components() in the cache
+ * @param key cache key (see ccl_cache_key())
+ * @param width image width
+ * @param height image height
+ * @param tags connected component numbers (may be larger than the image)
+ * @param num_cc number of connected components
+ * @param stats connected components table
+ * @return 0 if success, -1 if failure (or cache disabled)
+ */
+int ccl_cache_store(uint64_t key, int width, int height, const image_t *tags, int num_cc, const ccl_stats_t *stats)
+{
+    ccl_cache_header_t hdr = {
+        .magic = CCL_CACHE_MAGIC,
+        .version = CCL_CACHE_VERSION,
+        .key = key,
+        .width = width,
+        .height = height,
+        .num_cc = num_cc,
+        .largest_cc = stats->largest_cc,
+        .has_labels = cache_store_labels};
+    uint32_t *row_runs = NULL;
+    cache_run_t *runs = NULL;
+    size_t num_runs = 0;
+    int y;
+
+    if (!cache_dir)
+    {
+        return -1;
+    }
+
+    if (cache_store_labels)
+    {
+        tags = image_new_view(tags, 0, 0, width, height);
+        assert(tags);
+
+        /* run-length encode rows in parallel: count runs, then fill them at their offsets */
+        size_t *first_run = malloc((tags->height + 1) * sizeof(size_t));
+        row_runs = malloc(tags->height * sizeof(uint32_t));
+        assert(first_run && row_runs);
+
+        #pragma omp parallel for schedule(static)
+        for (y = 0; y < tags->height; ++y)
+        {
+            const gs16_t *tag_row = image_gs16_row(tags, y);
+            uint32_t n = 1;
+            for (int x = 1; x < tags->width; ++x)
+            {
+                n += (tag_row[x] != tag_row[x - 1]);
+            }
+            row_runs[y] = n;
+        }
+        first_run[0] = 0;
+        for (y = 0; y < tags->height; ++y)
+        {
+            first_run[y + 1] = first_run[y] + row_runs[y];
+        }
+        num_runs = first_run[tags->height];
+        runs = malloc(num_runs * sizeof(cache_run_t));
+        assert(runs);
+
+        #pragma omp parallel for schedule(static)
+        for (y = 0; y < tags->height; ++y)
+        {
+            const gs16_t *tag_row = image_gs16_row(tags, y);
+            cache_run_t *run = &runs[first_run[y]];
+            *run = (cache_run_t){.tag = tag_row[0], .length = 1};
+            for (int x = 1; x < tags->width; ++x)
+            {
+                if (tag_row[x] == run->tag)
+                {
+                    run->length++;
+                }
+                else
+                {
+                    *++run = (cache_run_t){.tag = tag_row[x], .length = 1};
+                }
+            }
+        }
+        free(first_run);
+    }
+
+    /* temporary file unique to this process and this call: threads may store identical pages at once */
+    static unsigned long num_stores = 0;
+    unsigned long store;
+    #pragma omp atomic capture
+    store = num_stores++;
+    char suffix[48];
+    snprintf(suffix, sizeof(suffix), ".%d.%lu.tmp", (int)getpid(), store);
+    char *tmp_path = cache_path(key, suffix);
+    char *path = cache_path(key, "");
+    FILE *fp = fopen(tmp_path, "wb");
+    int res = -1;
+    if (fp)
+    {
+        bool ok = fwrite(&hdr, sizeof(hdr), 1, fp) == 1 &&
+            fwrite(stats->con_cmp, sizeof(image_connected_component_t), num_cc, fp) == (size_t)num_cc;
+        if (ok && cache_store_labels)
+        {
+            ok = fwrite(row_runs, sizeof(uint32_t), height, fp) == (size_t)height &&
+                fwrite(runs, sizeof(cache_run_t), num_runs, fp) == num_runs;
+        }
+        ok = (fclose(fp) == 0) && ok;
+        res = (ok && rename(tmp_path, path) == 0) ? 0 : -1;
+        if (res != 0)
+        {
+            unlink(tmp_path);
+        }
+    }
+    if (res != 0)
+    {
+        fprintf(stderr, "Cannot write cache entry `%s`\n", path);
+    }
+
+    if (cache_store_labels)
+    {
+        image_delete((image_t *)tags);
+    }
+    free(path);
+    free(tmp_path);
+    free(runs);
+    free(row_runs);
+    return res;
+}
@@ -6,6 +6,9 @@
  * @date octobre 2020
  */
 #include "image_connected_components.h"
+#include "image_tuning.h"
+#include "image_cache.h"
+#include "image_memory.h"
 #include <omp.h>
 
 /**
@@ -84,7 +87,11 @@ int min_non_zero(int a, int b)
  * @param self the input image (binary)
  * @param tags the (output) image for storing pixel tags
  * @param equiv_out the table holding equivalence classes
- * @return the number of temporary tags assigned
+ * @return the number of temporary tags assigned, -1 if the image needs more than MAX_TAGS - 1 tags
+ *
+ * Rows shared among threads are only exact with a single thread (joins at the row seams race with tagging):
+ * this pass always runs on one thread, whatever the OpenMP setting (restored on return).
+ * Use ccl_temp_tag_strips() for a parallel first pass.
  */
 int ccl_temp_tag(
       const image_t *self,
@@ -95,16 +102,19 @@ int ccl_temp_tag(
   int num_tags = 0;
   int x, y;
   bool bg_color;
+  bool overflow = false;
+  int saved_threads = omp_get_max_threads();
   
-  int first_line_thread[20] = {0};
-  bool first_line_flag[20] = {0};
+  int first_line_thread[CCL_MAX_THREADS] = {0};
+  bool first_line_flag[CCL_MAX_THREADS] = {0};
 
   DEBUG_PRINT("First step: assign temporary class tag");
 
   /* Detect background color: by convention, background is the color of the top-left pixel */
-  bg_color = image_bmp_getpixel(self, 0, 0).bit;
+  bg_color = image_bmp_row_get(image_row(self, 0), 0);
 
-  #pragma omp parallel shared(equiv_out, first_line_thread, num_tags)
+  omp_set_num_threads(1);
+  #pragma omp parallel shared(equiv_out, first_line_thread, num_tags, overflow)
   {  
     #pragma omp for private(x)
     for(y = 0; y < self->height; ++y)
@@ -114,48 +124,57 @@ int ccl_temp_tag(
         #pragma omp critical
         {
         first_line_thread[omp_get_thread_num()] = y;
-        printf("\nThread %d Y = %d",omp_get_thread_num(), y);
+        DEBUG_PRINT("Thread %d Y = %d", omp_get_thread_num(), y);
         first_line_flag[omp_get_thread_num()] = 1;
         }
       }
       
-      for (x = 0; x < self->width; ++x)
+      /* typed row pointers: current pixel row, current and North tag rows */
+      const uint8_t *pxl_row = image_row(self, y);
+      gs16_t *tag_row = image_gs16_row(tags, y);
+      const gs16_t *tag_row_n = (y > 0) ? image_gs16_row(tags, y - 1) : NULL;
+
+      x = 0;
+      while (x < self->width)
       {
-        /* read current pixel color */
-        bool pxl_color = image_bmp_getpixel(self, x, y).bit;
-        
-        /* by default, pixel tag is zero (background) */
-        int tag = 0;
+        /* skip the background run, 64 pixels at a time: its tags are zero */
+        int x_fg = bmp_row_find_next(pxl_row, self->width, x, !bg_color);
+        memset(&tag_row[x], 0, (x_fg - x) * sizeof(gs16_t));
 
-        if (pxl_color != bg_color) 
+        /* then tag the foreground run */
+        int x_bg = bmp_row_find_next(pxl_row, self->width, x_fg, bg_color);
+        for (x = x_fg; x < x_bg; ++x)
         {
           /* Current pixel is foreground color: give it a tag, but which one? */
 
           /* Read the tag (if any) of the North and West adjacent pixels */
           /* or 0, if outside image coordinate ranges */
-          int tag_n = image_coord_check(tags, x, y-1) ? 
-                image_gs16_getpixel(tags, x, y-1).gs16 
-                : 0;
-          int tag_w = image_coord_check(tags, x-1, y) ? 
-                image_gs16_getpixel(tags, x-1, y).gs16
-                : 0;
+          int tag_n = tag_row_n ? tag_row_n[x] : 0;
+          int tag_w = (x > 0) ? tag_row[x-1] : 0;
 
           /* Current pixel tag is the minimum non-zero of adjacent tags */
-          tag = min_non_zero(tag_n, tag_w);
+          int tag = min_non_zero(tag_n, tag_w);
 
           /*S'il n'y a pas de voisins connexes alors on incrémentes dans la table des équivalences*/
           if (tag == 0)
           {
             #pragma omp critical
             {
-              num_tags+=1;
-              if(num_tags%100 == 0)
+              if (num_tags + 1 < MAX_TAGS)
+              {
+                num_tags+=1;
+                if(num_tags%100 == 0)
+                {
+                  DEBUG_PRINT("number of tags : %d", num_tags);
+                }
+                tag = num_tags;
+                equiv_out[tag] = tag;
+              }
+              else
               {
-                printf("\nnumber of tags : %d", num_tags);
+                /* out of 16-bit tags: the pixel is left untagged, and the pass fails */
+                overflow = true;
               }
-              assert(num_tags < MAX_TAGS);
-              tag = num_tags;
-              equiv_out[tag] = tag;
             }
           }
           
@@ -164,36 +183,38 @@ int ccl_temp_tag(
             /* if neighbors have different tags: join them */
             join(equiv_out, tag_n, tag_w);
           }
+
+          /* store tag in the tags image structure */
+          tag_row[x] = tag;
         }
-        /* store tag in the tags image structure */
-        image_gs16_setpixel(tags, x, y, (color_t){.gs16 = tag});
       }
     }
 
     //printf("\n\nFIN DE LA PREMIERE SECTION\n");
     #pragma omp barrier
 
-    for(y=0 ; y < 20 ; y++)
+    for(y=0 ; y < CCL_MAX_THREADS ; y++)
     {
       //printf("\nStart_line %d = %d", y, first_line_thread[y]);
     } 
     #pragma omp for private(x)
     for(y=1 ; y < omp_get_max_threads() ; y++)
     {
+      int y_first = first_line_thread[y];
+      const uint8_t *pxl_row = image_row(self, y_first);
+      const gs16_t *tag_row = image_gs16_row(tags, y_first);
+      const gs16_t *tag_row_n = (y_first > 0) ? image_gs16_row(tags, y_first - 1) : NULL;
+
       for(x=0 ; x < self->width ; x++)
       {
         //printf("\nThread %d x = %d || y = %d",omp_get_thread_num(), x, first_line_thread[y]);
-        bool pxl_color = image_bmp_getpixel(self, x, first_line_thread[y]).bit;
+        bool pxl_color = image_bmp_row_get(pxl_row, x);
 
         if (pxl_color != bg_color) 
         {
-          int tag = image_coord_check(tags, x, first_line_thread[y]) ? 
-                  image_gs16_getpixel(tags, x, first_line_thread[y]).gs16 
-                  : 0;
+          int tag = tag_row[x];
           //printf("\nTrouvééé");
-          int tag_n = image_coord_check(tags, x, first_line_thread[y]-1) ? 
-                  image_gs16_getpixel(tags, x, first_line_thread[y]-1).gs16 
-                  : 0;
+          int tag_n = tag_row_n ? tag_row_n[x] : 0;
 
           if( tag_n > 0 )
           {
@@ -204,9 +225,214 @@ int ccl_temp_tag(
       }
     }
   }
+  omp_set_num_threads(saved_threads);
+  return overflow ? -1 : num_tags;
+}
+
+/**
+ * @brief Assign temporary tags to the pixels of a strip of rows, ignoring pixels outside the strip
+ * @param self the input image (binary)
+ * @param tags the (output) image for storing pixel tags (local to the strip: 1..n)
+ * @param y_begin first row of the strip
+ * @param y_end row after the last row of the strip
+ * @param bg_color background color
+ * @param equiv (input/output) equivalence table of the strip, grown as needed
+ * @param capacity (input/output) number of entries of *equiv
+ * @return the number of temporary tags of the strip, -1 if the strip needs more than MAX_TAGS - 1 tags
+ */
+static int ccl_tag_strip(
+      const image_t *self,
+      image_t *tags,
+      int y_begin,
+      int y_end,
+      bool bg_color,
+      int **equiv,
+      int *capacity)
+{
+  int num_tags = 0;
+
+  for (int y = y_begin; y < y_end; ++y)
+  {
+    const uint8_t *pxl_row = image_row(self, y);
+    gs16_t *tag_row = image_gs16_row(tags, y);
+    const gs16_t *tag_row_n = (y > y_begin) ? image_gs16_row(tags, y - 1) : NULL;
+
+    int x = 0;
+    while (x < self->width)
+    {
+      int x_fg = bmp_row_find_next(pxl_row, self->width, x, !bg_color);
+      memset(&tag_row[x], 0, (x_fg - x) * sizeof(gs16_t));
+
+      int x_bg = bmp_row_find_next(pxl_row, self->width, x_fg, bg_color);
+      for (x = x_fg; x < x_bg; ++x)
+      {
+        int tag_n = tag_row_n ? tag_row_n[x] : 0;
+        int tag_w = (x > x_fg) ? tag_row[x-1] : 0;
+        int tag = min_non_zero(tag_n, tag_w);
+
+        if (tag == 0)
+        {
+          if (num_tags + 1 >= MAX_TAGS)
+          {
+            return -1;
+          }
+          if (++num_tags >= *capacity)
+          {
+            int old_capacity = *capacity;
+            *capacity = 2 * *capacity + 256;
+            *equiv = mem_track_realloc(*equiv, old_capacity * sizeof(int), *capacity * sizeof(int));
+            assert(*equiv);
+          }
+          tag = num_tags;
+          (*equiv)[tag] = tag;
+        }
+        else if (tag_n > 0 && tag_w > 0 && tag_w != tag_n)
+        {
+          join(*equiv, tag_n, tag_w);
+        }
+        tag_row[x] = tag;
+      }
+    }
+  }
+  return num_tags;
+}
+
+/**
+ * @brief First pass, by strips: assign a temporary tag to each pixel, and store equivalences in given table
+ * @param self the input image (binary)
+ * @param tags the (output) image for storing pixel tags
+ * @param equiv_out the table holding equivalence classes
+ * @param num_strips number of horizontal strips (any number: several strips per thread balance the load)
+ * @return the number of temporary tags assigned, -1 if the image needs more than MAX_TAGS - 1 tags
+ *
+ * Strips are tagged independently, each with its own equivalence table: no locks, no shared writes.
+ * Local tags are then shifted by the number of tags of the previous strips, so that tags follow the
+ * raster order (as with a sequential first pass), and the seam between two strips is joined.
+ */
+int ccl_temp_tag_strips(
+      const image_t *self,
+      image_t *tags,
+      int *equiv_out,
+      int num_strips)
+{
+  assert(self && tags && equiv_out);
+  num_strips = LIMIT(num_strips, 1, self->height);
+
+  int *first_tag = mem_track_calloc(num_strips + 1, sizeof(int));
+  int **strip_equiv = mem_track_calloc(num_strips, sizeof(int *));
+  int *capacity = mem_track_calloc(num_strips, sizeof(int));
+  assert(first_tag && strip_equiv && capacity);
+
+  /* Detect background color: by convention, background is the color of the top-left pixel */
+  bool bg_color = image_bmp_row_get(image_row(self, 0), 0);
+
+  #pragma omp parallel for schedule(dynamic)
+  for (int s = 0; s < num_strips; ++s)
+  {
+    int y_begin = (long)self->height * s / num_strips;
+    int y_end = (long)self->height * (s + 1) / num_strips;
+    first_tag[s + 1] = ccl_tag_strip(self, tags, y_begin, y_end, bg_color, &strip_equiv[s], &capacity[s]);
+  }
+
+  /* tags of strip s are first_tag[s]+1 .. first_tag[s+1] */
+  bool overflow = false;
+  for (int s = 0; s < num_strips; ++s)
+  {
+    overflow |= (first_tag[s + 1] < 0);
+    first_tag[s + 1] += first_tag[s];
+  }
+  int num_tags = first_tag[num_strips];
+  if (overflow || num_tags >= MAX_TAGS)
+  {
+    for (int s = 0; s < num_strips; ++s)
+    {
+      mem_track_free(strip_equiv[s], capacity[s] * sizeof(int));
+    }
+    mem_track_free(capacity, num_strips * sizeof(int));
+    mem_track_free(strip_equiv, num_strips * sizeof(int *));
+    mem_track_free(first_tag, (num_strips + 1) * sizeof(int));
+    return -1;
+  }
+
+  #pragma omp parallel for schedule(dynamic)
+  for (int s = 0; s < num_strips; ++s)
+  {
+    int offset = first_tag[s];
+    int num_local = first_tag[s + 1] - offset;
+    for (int t = 1; t <= num_local; ++t)
+    {
+      equiv_out[offset + t] = offset + strip_equiv[s][t];
+    }
+    mem_track_free(strip_equiv[s], capacity[s] * sizeof(int));
+
+    if (offset > 0)
+    {
+      int y_begin = (long)self->height * s / num_strips;
+      int y_end = (long)self->height * (s + 1) / num_strips;
+      for (int y = y_begin; y < y_end; ++y)
+      {
+        gs16_t *tag_row = image_gs16_row(tags, y);
+        for (int x = 0; x < self->width; ++x)
+        {
+          tag_row[x] += (tag_row[x] != 0) ? offset : 0;
+        }
+      }
+    }
+  }
+
+  /* seams: join the first row of each strip with the last row of the previous one */
+  for (int s = 1; s < num_strips; ++s)
+  {
+    int y = (long)self->height * s / num_strips;
+    const gs16_t *tag_row = image_gs16_row(tags, y);
+    const gs16_t *tag_row_n = image_gs16_row(tags, y - 1);
+    for (int x = 0; x < self->width; ++x)
+    {
+      if (tag_row[x] > 0 && tag_row_n[x] > 0)
+      {
+        join(equiv_out, tag_row_n[x], tag_row[x]);
+      }
+    }
+  }
+
+  mem_track_free(capacity, num_strips * sizeof(int));
+  mem_track_free(strip_equiv, num_strips * sizeof(int *));
+  mem_track_free(first_tag, (num_strips + 1) * sizeof(int));
   return num_tags;
 }
 
+/**
+ * @brief Default labeling parameters: strips first pass, one strip and one analysis section per thread
+ * @return parameters
+ */
+ccl_params_t ccl_default_params(void)
+{
+  return (ccl_params_t){
+    .num_threads = 0,
+    .variant = CCL_TEMP_TAG_STRIPS,
+    .strips_per_thread = 1,
+    .sections_per_thread = 1};
+}
+
+/**
+ * @brief First pass, with the algorithm variant of given parameters
+ * @param self the input image (binary)
+ * @param tags the (output) image for storing pixel tags
+ * @param equiv_out the table holding equivalence classes
+ * @param params labeling parameters (the number of threads is the current OpenMP setting,
+ *  except for the rows variant which always runs on a single thread, see ccl_temp_tag())
+ * @return the number of temporary tags assigned, -1 if the image needs more than MAX_TAGS - 1 tags
+ */
+int ccl_temp_tag_params(const image_t *self, image_t *tags, int *equiv_out, const ccl_params_t *params)
+{
+  if (params->variant == CCL_TEMP_TAG_ROWS)
+  {
+    /* profiles only choose the rows variant with one thread (see ccl_calibrate()) */
+    return ccl_temp_tag(self, tags, equiv_out);
+  }
+  return ccl_temp_tag_strips(self, tags, equiv_out, omp_get_max_threads() * MAX(params->strips_per_thread, 1));
+}
+
 /**
  * @brief Reduce equivalence table and renumber classes
  * @param equiv_table the input equivalence table
@@ -251,20 +477,64 @@ void ccl_retag(image_t *tags, int *class_num)
   #pragma omp parallel for private(x, t) shared(tags, class_num)
   for (y = 0; y < tags->height; ++y)
   {
+    gs16_t *tag_row = image_gs16_row(tags, y);
     for (x = 0; x < tags->width; ++x)
     {
       /* initial pixel tag */
-      t = image_gs16_getpixel(tags, x, y).gs16;
+      t = tag_row[x];
       if (t != 0) 
       {
         /* get connected component number from tag */
-        t = class_num[t];
-        image_gs16_setpixel(tags, x, y, (color_t){.gs16 = t});
+        tag_row[x] = class_num[t];
       }
     }
   }
 }
 
+/**
+ * @brief Label connected components, without any output: temporary tags, equivalences reduction, re-tag
+ * @param self the input image (binary)
+ * @param tags the (output) image for storing connected component numbers (1..num_cc, 0 for background)
+ * @param equiv_table an equivalence table of MAX_TAGS entries (need not be initialized, may be reused between calls)
+ * @return the number of connected components, -1 if the image needs more than MAX_TAGS - 1 temporary tags
+ *  (tags are then undefined)
+ */
+int ccl_label(const image_t *self, image_t *tags, int *equiv_table)
+{
+  ccl_params_t params = ccl_profile_lookup(self);
+  return ccl_label_params(self, tags, equiv_table, &params);
+}
+
+/**
+ * @brief Label connected components, with given parameters (see ccl_label())
+ * @param self the input image (binary)
+ * @param tags the (output) image for storing connected component numbers
+ * @param equiv_table an equivalence table of MAX_TAGS entries
+ * @param params labeling parameters (params->num_threads is ignored: the current OpenMP setting applies,
+ *  except that the rows variant runs on a single thread, see ccl_temp_tag_params())
+ * @return the number of connected components, -1 if the image needs more than MAX_TAGS - 1 temporary tags
+ */
+int ccl_label_params(const image_t *self, image_t *tags, int *equiv_table, const ccl_params_t *params)
+{
+  int num_tags;
+  int num_cc;
+  int *class_num;
+
+  num_tags = ccl_temp_tag_params(self, tags, equiv_table, params);
+  if (num_tags < 0)
+  {
+    return -1;
+  }
+
+  class_num = mem_track_calloc(num_tags + 1, sizeof(int));
+  assert(class_num);
+  num_cc = ccl_reduce_equivalences(equiv_table, num_tags, class_num);
+
+  ccl_retag(tags, class_num);
+  mem_track_free(class_num, (num_tags + 1) * sizeof(int));
+  return num_cc;
+}
+
 /**
  * @brief Analyze connected components
  * @param tags an image containing pixel (renumbered) tags
@@ -275,13 +545,28 @@ void ccl_analyze(
       const image_t *tags,
     image_connected_component_t *con_cmp,
     int num_classes) {
+  ccl_analyze_sections(tags, con_cmp, num_classes, 4);
+}
 
-  const int num_sections = 4;  // Nombre de sections pour diviser l'image
+/**
+ * @brief Analyze connected components, by sections of rows
+ * @param tags an image containing pixel (renumbered) tags
+ * @param con_cmp table of connected components
+ * @param num_classes number of connected components
+ * @param num_sections number of row sections (each one has its own partial table, merged at the end)
+ */
+void ccl_analyze_sections(
+      const image_t *tags,
+    image_connected_component_t *con_cmp,
+    int num_classes,
+    int num_sections) {
+
+  num_sections = LIMIT(num_sections, 1, tags->height);  // Nombre de sections pour diviser l'image
   const int section_height = tags->height / num_sections;
 
   // Tableaux temporaires pour stocker les mises à jour par thread
   image_connected_component_t *temp_con_cmp =
-      (image_connected_component_t *)calloc(num_sections * num_classes, sizeof(image_connected_component_t));
+      (image_connected_component_t *)mem_track_calloc(num_sections * num_classes, sizeof(image_connected_component_t));
   assert(temp_con_cmp != NULL);
 
   #pragma omp parallel for shared(tags, con_cmp, num_classes, temp_con_cmp) schedule(dynamic)
@@ -290,8 +575,9 @@ void ccl_analyze(
     int end_y = (section == num_sections - 1) ? tags->height : start_y + section_height;
 
     for (int y = start_y; y < end_y; ++y) {
+      const gs16_t *tag_row = image_gs16_row(tags, y);
       for (int x = 0; x < tags->width; ++x) {
-        int tag = image_gs16_getpixel(tags, x, y).gs16;
+        int tag = tag_row[x];
         if (tag > 0 && tag <= num_classes) {
           int t = tag - 1;
           if (temp_con_cmp[section * num_classes + t].num_pixels == 0) {
@@ -334,7 +620,7 @@ void ccl_analyze(
     }
   }
 
-  free(temp_con_cmp);
+  mem_track_free(temp_con_cmp, num_sections * num_classes * sizeof(image_connected_component_t));
 }
 
 /**
@@ -345,18 +631,45 @@ void ccl_analyze(
 void ccl_draw_colors(const image_t *tags, image_t *color)
 {
   int x, y, t;
+  int max_tag = 0;
   assert(tags && color);
+
+  #pragma omp parallel for reduction(max:max_tag) private(x)
   for (y = 0; y < tags->height; ++y)
   {
+    const gs16_t *tag_row = image_gs16_row(tags, y);
     for (x = 0; x < tags->width; ++x)
     {
-      t = image_gs16_getpixel(tags, x, y).gs16;
+      max_tag = MAX(max_tag, tag_row[x]);
+    }
+  }
+
+  /* palette: one color per tag, converted from HSV at once */
+  hsv_t *hsv = malloc(MAX(max_tag, 1) * sizeof(hsv_t));
+  rgb_t *palette = malloc(MAX(max_tag, 1) * sizeof(rgb_t));
+  assert(hsv && palette);
+  for (t = 0; t < max_tag; ++t)
+  {
+    hsv[t] = (hsv_t){.h = 137.507 * t, .s = 0.33 * (3 - t % 3), .v = 0.33 * (3 - (t / 3) % 3)};
+  }
+  rgb_from_hsv_n(palette, hsv, max_tag);
+
+  #pragma omp parallel for private(x, t)
+  for (y = 0; y < tags->height; ++y)
+  {
+    const gs16_t *tag_row = image_gs16_row(tags, y);
+    rgb_t *color_row = image_rgb_row(color, y);
+    for (x = 0; x < tags->width; ++x)
+    {
+      t = tag_row[x];
       if (t != 0)
       {
-        image_rgb_setpixel(color, x, y, class_color(t-1));
+        color_row[x] = palette[t - 1];
       }
     }
   }
+  free(palette);
+  free(hsv);
 }
 
 /**
@@ -390,43 +703,29 @@ void ccl_draw_bounding_boxes(image_t *color,
   }
 }
 
-/**
- * @brief 
- * @param 
- * @return 
- */
-void write_time_csv(double *time)
-{
-  FILE *csvFile = fopen("main.csv", "a");  // Ouvre le fichier en mode écriture
-
-  if (csvFile == NULL) {
-    perror("Erreur lors de l'ouverture du fichier");
-  }
-
-  // Exemple de données
-  fprintf(csvFile, "%d,%.6f,%.6f,%.6f,%.6f\n",
-    omp_get_max_threads(),
-    time[5] - time[0],
-    time[1] - time[0],  
-    time[4] - time[3],
-    time[5] - time[4]);
-
-  fclose(csvFile);  // Ferme le fichier
-}
-
 /**
  * @brief Identify connected components in given image
- * @param self the input image (should be a binary black & white image, i.e. self->type = IMAGE_BITMAP)
- * @param tags an image structure for holding the connected components tags (should be a 16-bit grayscale image), or NULL
- * @param color an output image structure for holding a color visualization of connected components, or NULL
- * @param con_cmp_out pointer to a image_connected_component_t[] table that will be written by this procedure, for returning the detected connected components, or NULL
- * @param debug 1 if we shall print out equivalence classes, generate intermediate files, etc. Good for debug, not for performance.
- * @return the number of classes detected 
+ * @param self the input image: a binary black & white image (self->type = IMAGE_BITMAP), or a grayscale
+ *  or color image, then binarized with the default settings (see image_threshold_default_options())
+ * @param tags an image structure for holding the connected components tags (should be a 16-bit grayscale image);
+ *  left untouched on a cache hit without label map (then stats->cached = 1, see image_cache.h)
+ * @param color an output image structure for holding a color visualization of connected components
+ *  (drawn in debug builds only), or NULL
+ * @param stats (output) connected components table, step timings, etc., or NULL
+ * @return the number of classes detected, -1 if the image needs more than MAX_TAGS - 1 temporary tags
+ *  (tags are then undefined, and stats->con_cmp is NULL)
+ *
+ * Nothing is printed or written to files (except intermediate tags in debug builds): the caller
+ * saves tags and reports statistics as needed.
+ *
+ * Each table is released as soon as its step is over (binarized input after the first pass,
+ * equivalences after their reduction, renumbering after the re-tag), to keep the peak footprint low.
  */
 int image_connected_components(
       const image_t *self, 
       image_t *tags, 
-      image_t *color)
+      image_t *color,
+      ccl_stats_t *stats)
 {
   int *equiv_table;
   int num_tags = 0;
@@ -435,30 +734,106 @@ int image_connected_components(
   int num_cc;
   int t;
   double time[7];
+  mem_track_t mem[7];
+  image_t *bitmap = NULL;
+  ccl_params_t params;
+  int saved_threads = omp_get_max_threads();
 
   /* ~~~~~~~~~~ Verify input arguments, initialize tables ~~~~~~~~~~ */
-  assert(self && 
-        (self->type == IMAGE_BITMAP));
-
+  assert(self);
   assert(tags && 
         (tags->type == IMAGE_GRAYSCALE_16) &&
         (tags->width >= self->width) && 
         (tags->height >= self->height));
 
-  assert(color &&
-        (color->type == IMAGE_RGB_888) &&
-        (color->width >= self->width) && 
-        (color->height >= self->height));
+  /* ~~~~~~~~~~ Results of identical pixel data may be cached ~~~~~~~~~~ */
+  uint64_t cache_key = 0;
+  int width = self->width;
+  int height = self->height;
+  mem[0] = mem_track_phase();
+  if (ccl_cache_enabled())
+  {
+    ccl_stats_t cached = {0};
+    time[0] = omp_get_wtime();
+    cache_key = ccl_cache_key(self);
+    num_cc = ccl_cache_load(cache_key, self->width, self->height, tags, &cached);
+    if (num_cc >= 0 && cached.cached == 1 && !stats)
+    {
+      /* the entry has no label map, and the caller cannot tell that tags are not written: label */
+      free(cached.con_cmp);
+      num_cc = -1;
+    }
+    if (num_cc >= 0)
+    {
+      for (t = 1; t < 7; ++t)
+      {
+        time[t] = (t < 5) ? time[0] : omp_get_wtime();
+        mem[t] = (t < 5) ? mem[0] : mem_track_phase();
+      }
+      if (stats)
+      {
+        *stats = cached;
+        stats->num_threads = omp_get_max_threads();
+        memcpy(stats->time, time, sizeof(time));
+        memcpy(stats->mem, mem, sizeof(mem));
+      }
+      else
+      {
+        free(cached.con_cmp);
+      }
+      return num_cc;
+    }
+  }
+
+  if (self->type != IMAGE_BITMAP)
+  {
+    /* label dark areas of grayscale/color images: binarize in memory, no intermediate file */
+    bitmap = image_new_threshold(self, NULL);
+    assert(bitmap);
+    self = bitmap;
+  }
+
+  assert(!color ||
+        ((color->type == IMAGE_RGB_888) &&
+         (color->width >= self->width) && 
+         (color->height >= self->height)));
 
   /* Allocate the equivalence table */
-  equiv_table = calloc(MAX_TAGS, sizeof(int));
+  equiv_table = mem_track_calloc(MAX_TAGS, sizeof(int));
   assert(equiv_table);
+
+  /* parameters tuned for this kind of image (see image_tuning.h) */
+  params = ccl_profile_lookup(self);
+  if (params.num_threads > 0)
+  {
+    omp_set_num_threads(params.num_threads);
+  }
   
   time[0] = omp_get_wtime();
   /* ~~~~~~~~~~ First step: assign temporary class tags ~~~~~~~~~~ */
-  num_tags = ccl_temp_tag(self, tags, equiv_table);
+  num_tags = ccl_temp_tag_params(self, tags, equiv_table, &params);
+
+  /* the binarized input is not needed anymore */
+  if (bitmap)
+  {
+    image_delete(bitmap);
+    self = NULL;
+  }
+
+  if (num_tags < 0)
+  {
+    DEBUG_PRINT("Too many temporary tags: more than %d", MAX_TAGS - 1);
+    mem_track_free(equiv_table, MAX_TAGS * sizeof(int));
+    if (stats)
+    {
+      *stats = (ccl_stats_t){.con_cmp = NULL};
+    }
+    omp_set_num_threads(saved_threads);
+    return -1;
+  }
 
   time[1] = omp_get_wtime();
+  mem[1] = mem_track_phase();
   
 
 #ifdef DEBUG
@@ -472,6 +847,7 @@ int image_connected_components(
 #endif
   
   time[2] = omp_get_wtime();
+  mem[2] = mem_track_phase();
 
   /* ~~~~~~~~~~ Second step: reduce equivalence classes and renumber ~~~~~~~~~~ */
   DEBUG_PRINT("Now reduce tag equivalence classes, and renumber those classes");
@@ -480,9 +856,10 @@ int image_connected_components(
    * Renumber classes, so that they are numbered 0 .. num_classes-1
    * Recall: a class root ancestor A is charcterized by table[A] = A.
    */
-  class_num = calloc(num_tags+1, sizeof(int));
+  class_num = mem_track_calloc(num_tags + 1, sizeof(int));
   assert(class_num);
   num_cc = ccl_reduce_equivalences(equiv_table, num_tags, class_num);
+  mem_track_free(equiv_table, MAX_TAGS * sizeof(int));
 
 #ifdef DEBUG
   DEBUG_PRINT("Tags renumbering:");
@@ -493,28 +870,25 @@ int image_connected_components(
 #endif
 
   time[3] = omp_get_wtime();
+  mem[3] = mem_track_phase();
 
 
   /* ~~~~~~~~~~ Third step: replace temp tags by connected component number ~~~~~~~~~~ */
   DEBUG_PRINT("Re-tag");
   ccl_retag(tags, class_num);
-
-#ifdef DEBUG
-  image_save_ascii(tags, "classes.pgm");
-#else
-  image_save_binary(tags, "classes.pgm");
-#endif
+  mem_track_free(class_num, (num_tags + 1) * sizeof(int));
 
   time[4] = omp_get_wtime();
+  mem[4] = mem_track_phase();
 
 
   /* ~~~~~~~~~~ Fourth step: generate useful outputs ~~~~~~~~~~ */
   DEBUG_PRINT("Analyze connected components");
 
   /* allocate & initialize connected components output structure */
-  image_connected_component_t *con_cmp = calloc(num_cc, sizeof(image_connected_component_t));
+  image_connected_component_t *con_cmp = mem_track_calloc(num_cc, sizeof(image_connected_component_t));
   assert(con_cmp);
-  ccl_analyze(tags, con_cmp, num_cc);
+  ccl_analyze_sections(tags, con_cmp, num_cc, omp_get_max_threads() * MAX(params.sections_per_thread, 1));
 
   /* What's the size of the largest connected component found? */
   int largest_cc = 0;
@@ -526,38 +900,46 @@ int image_connected_components(
   }
 
   time[5] = omp_get_wtime();
+  mem[5] = mem_track_phase();
 
 #ifdef DEBUG
-  DEBUG_PRINT("Draw color output");
-  /* draw connected components as a color image */
-  ccl_draw_colors(tags, color);
-
-  /* use BIN format for large images: optimize for speed */
-  image_save_binary(color, "color.ppm");
+  if (color)
+  {
+    DEBUG_PRINT("Draw color output");
+    /* draw connected components as a color image */
+    ccl_draw_colors(tags, color);
+  }
 #endif
 
   time[6] = omp_get_wtime();
+  mem[6] = mem_track_phase();
 
-  /* liberate allocated memory */
-  free(equiv_table);
-  free(class_num);
+  /* results of this pixel data, for next time */
+  if (ccl_cache_enabled())
+  {
+    (void)ccl_cache_store(cache_key, width, height, tags, num_cc,
+      &(ccl_stats_t){.con_cmp = con_cmp, .largest_cc = largest_cc});
+  }
 
   /* note: caller is responsible for liberating the tags and color images */
   DEBUG_PRINT("End of connected components labeling");
 
-  printf("Found %d connected components.\n", num_cc);
-  printf("Largest connected component is class #%06d, has %9d pixels.\n", largest_cc, con_cmp[largest_cc].num_pixels);
-
-  printf("Total time: %.6fs; temp tag: %.6f, save tags %.6f, reduce_equiv %.6f, retag/save %.6f, analyze %.6f, color %.6f\n", 
-    time[5] - time[0],
-    time[1] - time[0], 
-    time[2] - time[1], 
-    time[3] - time[2], 
-    time[4] - time[3],
-    time[5] - time[4],
-    time[6] - time[5]);
-
-  write_time_csv(time);
+  if (stats)
+  {
+    /* the components table now belongs to the caller */
+    mem_track_sub(num_cc * sizeof(image_connected_component_t));
+    stats->con_cmp = con_cmp;
+    stats->largest_cc = largest_cc;
+    stats->cached = 0;
+    stats->num_threads = omp_get_max_threads();
+    memcpy(stats->time, time, sizeof(time));
+    memcpy(stats->mem, mem, sizeof(mem));
+  }
+  else
+  {
+    mem_track_free(con_cmp, num_cc * sizeof(image_connected_component_t));
+  }
+  omp_set_num_threads(saved_threads);
     
   return num_cc;
 }
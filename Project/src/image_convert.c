@@ -0,0 +1,123 @@
+/**
+ * @file image_convert.c
+ * @brief Basic image processing library: pixel format and color space conversions of whole images
+ * @author Saint-Cirgue Arnaud _ Correge Etienne
+ * @version 0.1
+ * @date november 2023
+ */
+
+/**
+ * Rows are converted in parallel, each one with the batched (vectorized) kernels of pixel.c.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+
+#include "image_convert.h"
+#include "utils.h"
+#include <omp.h>
+
+/**
+ * @fn image_t *image_new_convert(const image_t *self, image_type_t type)
+ * @brief Image constructor; creates a copy of an image, converted to another pixel format
+ * @param self source image
+ * @param type pixel format of the new image
+ * @return Handle of a new image object, NULL if creation fails.
+ *
+ * Supported conversions: color or floating-point grayscale to 8-bit grayscale,
+ * color or 8-bit grayscale to floating-point grayscale.
+ */
+image_t *image_new_convert(const image_t *self, image_type_t type)
+{
+    image_t *dst;
+    int y;
+
+    assert(self && self->data);
+    dst = image_new(self->width, self->height, type);
+    if (!dst)
+    {
+        return NULL;
+    }
+
+    if (self->type == IMAGE_RGB_888 && type == IMAGE_GRAYSCALE_8)
+    {
+        #pragma omp parallel for schedule(static)
+        for (y = 0; y < self->height; ++y)
+        {
+            gs8_from_rgb_n(image_gs8_row(dst, y), image_rgb_row(self, y), self->width);
+        }
+    }
+    else if (self->type == IMAGE_GRAYSCALE_FL && type == IMAGE_GRAYSCALE_8)
+    {
+        #pragma omp parallel for schedule(static)
+        for (y = 0; y < self->height; ++y)
+        {
+            gs8_from_fl_n(image_gs8_row(dst, y), image_gsfl_row(self, y), self->width);
+        }
+    }
+    else if (self->type == IMAGE_GRAYSCALE_8 && type == IMAGE_GRAYSCALE_FL)
+    {
+        #pragma omp parallel for schedule(static)
+        for (y = 0; y < self->height; ++y)
+        {
+            fl_from_gs8_n(image_gsfl_row(dst, y), image_gs8_row(self, y), self->width);
+        }
+    }
+    else if (self->type == IMAGE_RGB_888 && type == IMAGE_GRAYSCALE_FL)
+    {
+        #pragma omp parallel
+        {
+            /* per-thread 8-bit row */
+            gs8_t *tmp = malloc(self->width * sizeof(gs8_t));
+            assert(tmp);
+
+            #pragma omp for schedule(static)
+            for (y = 0; y < self->height; ++y)
+            {
+                gs8_from_rgb_n(tmp, image_rgb_row(self, y), self->width);
+                fl_from_gs8_n(image_gsfl_row(dst, y), tmp, self->width);
+            }
+            free(tmp);
+        }
+    }
+    else
+    {
+        DIE("Unsupported");
+    }
+    return dst;
+}
+
+/**
+ * @brief Convert the pixels of a color image into hue-saturation-value colors
+ * @param self a color image (IMAGE_RGB_888)
+ * @param hsv (output) table of width x height colors, row after row
+ */
+void image_hsv_from_rgb(const image_t *self, hsv_t *hsv)
+{
+    int y;
+
+    assert(self && self->type == IMAGE_RGB_888 && hsv);
+    #pragma omp parallel for schedule(static)
+    for (y = 0; y < self->height; ++y)
+    {
+        hsv_from_rgb_n(hsv + (size_t)y * self->width, image_rgb_row(self, y), self->width);
+    }
+}
+
+/**
+ * @brief Set the pixels of a color image from hue-saturation-value colors
+ * @param self a color image (IMAGE_RGB_888)
+ * @param hsv table of width x height colors, row after row
+ */
+void image_rgb_from_hsv(image_t *self, const hsv_t *hsv)
+{
+    int y;
+
+    assert(self && self->type == IMAGE_RGB_888 && hsv);
+    #pragma omp parallel for schedule(static)
+    for (y = 0; y < self->height; ++y)
+    {
+        rgb_from_hsv_n(image_rgb_row(self, y), hsv + (size_t)y * self->width, self->width);
+    }
+}
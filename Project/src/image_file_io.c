@@ -25,10 +25,221 @@
 #include <assert.h>
 #include <stdint.h>
 #include <ctype.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #include "image_file_io.h"
+#include "image_bitmap.h"
+#include "image_pnm.h"
 #include "utils.h"
+#include <omp.h>
 
+/**
+ * @brief Number of bytes of binary pixel data converted (16-bit samples) or written per block of rows
+ */
+#define PNM_BLOCK_BYTES (256 * 1024)
+
+/**
+ * @brief Maximum number of bytes read by image_probe() to parse a header (comments included)
+ */
+#define PROBE_MAX_HEADER (64 * 1024)
+
+/**
+ * @brief Convert the 16-bit samples of a range of rows between big-endian and host byte order, in parallel
+ * @param self image object (IMAGE_GRAYSCALE_16)
+ * @param y_begin first row
+ * @param y_end row after the last row
+ */
+static void pnm_swap16_rows(image_t *self, int y_begin, int y_end)
+{
+    #pragma omp parallel for schedule(static)
+    for (int y = y_begin; y < y_end; ++y)
+    {
+        pnm_swap16(image_row(self, y), image_row(self, y), self->width);
+    }
+}
+
+/**
+ * @fn image_probe(const char *fname, image_info_t *info)
+ * @brief Read the properties of a PBM/PGM/PPM file; only the header is read, no pixel data is allocated.
+ * @param fname path of image file
+ * @param info (output) image properties
+ * @return 0 if success, -1 if the file cannot be read or is not a Netpbm file
+ */
+int image_probe(const char *fname, image_info_t *info)
+{
+    pnm_header_t hdr;
+    uint8_t *head = NULL;
+    size_t head_size = 4096;
+    ssize_t len;
+    int res;
+    int fd;
+
+    fd = open(fname, O_RDONLY);
+    if (fd < 0)
+    {
+        return -1;
+    }
+
+    /* parse header; read more only if comments make it longer than the buffer (not a Netpbm file, or a
+    malformed header: rejected at once), up to PROBE_MAX_HEADER bytes */
+    for (;;)
+    {
+        head = realloc(head, head_size);
+        assert(head);
+        len = pread(fd, head, head_size, 0);
+        if (len < 0)
+        {
+            res = -1;
+            break;
+        }
+        res = pnm_parse_header(head, len, &hdr);
+        if (res != -2 || (size_t)len < head_size || head_size >= PROBE_MAX_HEADER)
+        {
+            break;
+        }
+        head_size *= 2;
+    }
+    free(head);
+    close(fd);
+    if (res != 0)
+    {
+        return -1;
+    }
+
+    info->width = hdr.width;
+    info->height = hdr.height;
+    info->type = pnm_image_type(&hdr);
+    info->depth = hdr.depth;
+    info->binary = (hdr.format > 3);
+    info->format = hdr.format;
+    info->offset = hdr.offset;
+    return 0;
+}
+
+/**
+ * @fn image_new_open_mmap(const char *fname)
+ * @brief Image constructor; creates a read-only image object that maps the pixel data of a PBM/PGM/PPM file.
+ * @param fname path of image file
+ * @return Handle of a new image object, NULL in case of failure.
+ *
+ * For binary P4, 8-bit P5, P6 and 8-bit P7 (except black and white) files, pixel data is used in place from the file mapping:
+ * there is no copy, and no zeroing of a new buffer. Rows are tightly packed (stride = row size),
+ * and pixels must not be written (the mapping is read-only). image_delete() unmaps the file.
+ * ASCII files (P1, P2, P3) and PAM black and white images are decoded in parallel straight from the mapping, into a new image.
+ * 16-bit samples are big-endian in files: they are copied to a new image in parallel,
+ * with byte order conversion on the fly.
+ */
+image_t *image_new_open_mmap(const char *fname)
+{
+    struct stat st;
+    pnm_header_t hdr;
+    image_type_t type;
+    image_t *self;
+    uint8_t *map;
+    size_t row_bytes;
+    int fd;
+
+    fd = open(fname, O_RDONLY);
+    if (fd < 0)
+    {
+        fprintf(stderr, "Failed to open file `%s`\n", fname);
+        return NULL;
+    }
+    if (fstat(fd, &st) != 0 || st.st_size == 0)
+    {
+        close(fd);
+        fprintf(stderr, "%s: empty or unreadable file\n", fname);
+        return NULL;
+    }
+    map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+    {
+        return image_new_open(fname);
+    }
+
+    if (pnm_parse_header(map, st.st_size, &hdr) != 0)
+    {
+        munmap(map, st.st_size);
+        fprintf(stderr, "%s: not a Netpbm file\n", fname);
+        return NULL;
+    }
+
+    type = pnm_image_type(&hdr);
+    if (hdr.format < 4 || type == IMAGE_GRAYSCALE_16 || (type == IMAGE_BITMAP && hdr.format == 7))
+    {
+        /* pixel data cannot be used as is: decode it in parallel straight from the mapping */
+        (void)madvise(map, st.st_size, MADV_SEQUENTIAL);
+        self = pnm_decode(&hdr, map + hdr.offset, st.st_size - hdr.offset);
+        munmap(map, st.st_size);
+        return self;
+    }
+
+    row_bytes = pnm_file_row_bytes(&hdr);
+    if (hdr.offset + row_bytes * hdr.height > (size_t)st.st_size)
+    {
+        munmap(map, st.st_size);
+        fprintf(stderr, "%s: truncated pixel data\n", fname);
+        return NULL;
+    }
+
+    /* pixel data will be scanned row after row: read ahead aggressively */
+    (void)madvise(map, st.st_size, MADV_SEQUENTIAL);
+    (void)madvise(map, st.st_size, MADV_WILLNEED);
+
+    self = image_new_from_mem_stride(hdr.width, hdr.height, type, map + hdr.offset, row_bytes);
+    if (!self)
+    {
+        munmap(map, st.st_size);
+        return NULL;
+    }
+    image_set_mem(self, IMAGE_MEM_MMAP, map, st.st_size);
+
+    DEBUG_PRINT("Mapped file `%s` : ", fname);
+    return self;
+}
+
+/**
+ * @brief Read a whole PAM (P7) file, then decode it
+ * @param fname path of image file
+ * @return Handle of a new image object, NULL in case of failure.
+ */
+static image_t *image_new_open_pam(const char *fname)
+{
+    pnm_header_t hdr;
+    image_t *self = NULL;
+    uint8_t *buf;
+    long len;
+    FILE *fp;
+
+    fp = fopen(fname, "rb");
+    if (!fp)
+    {
+        fprintf(stderr, "Failed to open file `%s`\n", fname);
+        return NULL;
+    }
+    fseek(fp, 0, SEEK_END);
+    len = ftell(fp);
+    rewind(fp);
+    buf = malloc(MAX(len, 1));
+    assert(buf);
+    len = fread(buf, 1, len, fp);
+    fclose(fp);
+
+    if (pnm_parse_header(buf, len, &hdr) != 0)
+    {
+        fprintf(stderr, "%s: not a supported PAM file\n", fname);
+    }
+    else
+    {
+        self = pnm_decode(&hdr, buf + hdr.offset, len - hdr.offset);
+    }
+    free(buf);
+    return self;
+}
 
 /**
  * @fn image_new_open(const char *fname)
@@ -60,6 +271,12 @@ image_t *image_new_open(const char *fname)
     }
 
     pnm_format = getc(fp) - '0';
+    if (pnm_format == 7)
+    {
+        /* PAM: keyword-based header; decode from memory */
+        fclose(fp);
+        return image_new_open_pam(fname);
+    }
     if (pnm_format <= 0 || pnm_format > 6)
     {
         DIE("Not a Netpbm file");
@@ -95,22 +312,15 @@ image_t *image_new_open(const char *fname)
         type = IMAGE_BITMAP;
         break;
     case 4: // P4 = black/white, 1 bit ; binary encoding
-        do 
-        {
-            c = fgetc(fp);
-        } while (c == '\r' || c == '\n');
-        ungetc(c, fp);
         type = IMAGE_BITMAP;
         break;
     case 2: // P2 = 0-255 or 0-65535 grayascale ; ascii
-        assert(1 == fscanf(fp,"%d", &depth));
         ascii_encoding = 1;
     case 5: // P5 = 0-255 or 0-65535 grayascale ; binary
         assert(1 == fscanf(fp,"%d", &depth));
         type = (depth < 256) ? IMAGE_GRAYSCALE_8 : IMAGE_GRAYSCALE_16;
         break;
     case 3: // P3 = 0-255 x 3 channels (R, G, B) color ; ascii
-        assert(1 == fscanf(fp,"%d", &depth));
         ascii_encoding = 1;
     case 6: // P6 = 0-255 x 3 channels (R, G, B) color ; binary
         assert(1 == fscanf(fp,"%d", &depth));
@@ -119,6 +329,11 @@ image_t *image_new_open(const char *fname)
     default:
         DIE("Format not supported");
     }
+    if (!ascii_encoding)
+    {
+        /* a single whitespace character separates the header from binary pixel data */
+        fgetc(fp);
+    }
 
     self = image_new(width, height, type);
     if (!self) 
@@ -130,65 +345,82 @@ image_t *image_new_open(const char *fname)
     if (ascii_encoding) 
     {
         //DEBUG("Reading ASCII-encoded pixel data");
-        FOR_YX(self, y, x)
-        {
-            uint32_t v, r, g, b;
+        /* bulk-read the rest of the file, then decode it in parallel */
+        long start = ftell(fp);
+        fseek(fp, 0, SEEK_END);
+        long len = ftell(fp) - start;
+        fseek(fp, start, SEEK_SET);
 
-            switch(self->type)
-            {
-            case IMAGE_BITMAP:
-                assert(1 == fscanf(fp, "%d", &v));
-                self->setpixel(self, x, y, (color_t){.bit = LIMIT(v, 0, 1)});
-                break;
-            case IMAGE_GRAYSCALE_8:
-                assert(1 == fscanf(fp, "%d", &v));
-                self->setpixel(self, x, y, (color_t){.gs8 = LIMIT(v, 0, 255)});
-                break;
-            case IMAGE_GRAYSCALE_16:
-                assert(1 == fscanf(fp, "%d", &v));
-                self->setpixel(self, x, y, (color_t){.gs16 = LIMIT(v, 0, 65535)});
-                break;
-            case IMAGE_RGB_888:
-                assert(3 == fscanf(fp, "%d%d%d", &r, &g, &b));
-                printf("%d %d %d\n", r, g, b);
-                self->setpixel(self, x, y, (color_t){.rgb.r = LIMIT(r, 0, 255), .rgb.g = LIMIT(g, 0, 255), .rgb.b = LIMIT(b, 0, 255)});
-                break;
-            default:
-                DIE("Not supported");
-            }
+        uint8_t *buf = malloc(MAX(len, 1));
+        assert(buf);
+        len = fread(buf, 1, len, fp);
+        if (pnm_parse_ascii(self, buf, len) != 0)
+        {
+            DIE("%s: incomplete pixel data", fname);
         }
+        free(buf);
     }
     else 
     {
         //DEBUG_PRINT("Reading binary-encoded pixel data");
-        long int nbytes;
-        long int read;
+        /* each pixel row is padded to an integer number of bytes in the file,
+        and to self->stride bytes in memory */
+        size_t row_bytes;
+        size_t read = 0;
+        int block_rows;
         switch(self->type)
         {
         case IMAGE_BITMAP:
-            // each pixel row is padded to an integer number of bytes
-            nbytes = self->height * (int)((self->width + 7)/8);
-            break;
         case IMAGE_GRAYSCALE_8:
-            nbytes = self->width * self->height;
-            break;
         case IMAGE_GRAYSCALE_16:
-            nbytes = self->width * self->height * 2;
-            break;
         case IMAGE_RGB_888:
-            nbytes = self->width * self->height * 3;
+            row_bytes = image_row_bytes(self->width, self->type);
             break;
         default:
             DIE("Unsupported");
         }
 
-        read = fread(self->data, 1, nbytes, fp); //(self->width + 7)/8, self->height, fp);
-        if (read < nbytes)
+        /* 16-bit samples are big-endian in the file: convert them by blocks of rows,
+        right after each block is read, while it is still in cache */
+        block_rows = (self->type == IMAGE_GRAYSCALE_16) ? MAX(1, PNM_BLOCK_BYTES / row_bytes) : self->height;
+        for (int y0 = 0; y0 < self->height; y0 += block_rows)
         {
-            DIE("Expected %ld bytes, could read only %ld bytes.\n", nbytes, read);
+            int y1 = MIN(self->height, y0 + block_rows);
+            if (row_bytes == self->stride)
+            {
+                read += fread(image_row(self, y0), row_bytes, y1 - y0, fp);
+            }
+            else
+            {
+                for (int y = y0; y < y1 && fread(image_row(self, y), row_bytes, 1, fp) == 1; ++y)
+                {
+                    read++;
+                }
+            }
+            if (read < (size_t)y1)
+            {
+                break;
+            }
+            if (self->type == IMAGE_GRAYSCALE_16)
+            {
+                pnm_swap16_rows(self, y0, y1);
+            }
+        }
+        if (read < (size_t)self->height)
+        {
+            DIE("Expected %d rows, could read only %ld rows.\n", self->height, (long)read);
+        }
+        if (self->type == IMAGE_BITMAP)
+        {
+            /* bit-parallel row operations expect zero padding bits */
+            FOR_Y(self, y)
+            {
+                bmp_row_clear_padding(image_row(self, y), self->width);
+            }
         }
     }
 
+    fclose(fp);
     DEBUG_PRINT("Read file `%s` : ", fname);
     
     //image_print_details(self);
@@ -197,6 +429,184 @@ image_t *image_new_open(const char *fname)
 
 
 
+/**
+ * @brief Write pixel data with ASCII encoding, in parallel
+ * @param self image object
+ * @param fd file descriptor, positioned after the header
+ * @param depth maximum value (for floating-point images)
+ * @return 0 if success, -1 if failure
+ *
+ * Blocks of rows are formatted into per-thread buffers in parallel;
+ * an ordered section then writes the blocks in file order, with one large write() per block,
+ * while other threads keep formatting the next blocks.
+ */
+static int pnm_write_ascii(const image_t *self, int fd, int depth)
+{
+    /* worst case: 5 digits + tab per value, 3 values per RGB pixel */
+    size_t row_max = (size_t)self->width * ((self->type == IMAGE_RGB_888) ? 3 * 6 : 6) + 1;
+    int block_rows = MAX(1, (1 << 18) / row_max);
+    int num_blocks = (self->height + block_rows - 1) / block_rows;
+    int failed = 0;
+
+    #pragma omp parallel
+    {
+        char *buf = malloc(row_max * block_rows);
+        assert(buf);
+
+        #pragma omp for ordered schedule(static, 1)
+        for (int b = 0; b < num_blocks; ++b)
+        {
+            char *p = buf;
+            int y_end = MIN(self->height, (b + 1) * block_rows);
+            for (int y = b * block_rows; y < y_end; ++y)
+            {
+                p = pnm_format_row(self, y, depth, p);
+            }
+
+            #pragma omp ordered
+            {
+                if (!failed && pnm_write_all(fd, buf, p - buf) != 0)
+                {
+                    failed = 1;
+                }
+            }
+        }
+        free(buf);
+    }
+    return failed ? -1 : 0;
+}
+
+/**
+ * @brief Write 16-bit pixel data with binary encoding (big-endian samples), in parallel
+ * @param self image object (IMAGE_GRAYSCALE_16)
+ * @param fd file descriptor, positioned after the header
+ * @return 0 if success, -1 if failure
+ *
+ * Blocks of rows are converted into per-thread buffers in parallel, and written in file order.
+ */
+static int pnm_write_binary16(const image_t *self, int fd)
+{
+    size_t row_bytes = image_row_bytes(self->width, self->type);
+    int block_rows = MAX(1, PNM_BLOCK_BYTES / row_bytes);
+    int num_blocks = (self->height + block_rows - 1) / block_rows;
+    int failed = 0;
+
+    #pragma omp parallel
+    {
+        uint8_t *buf = malloc(row_bytes * block_rows);
+        assert(buf);
+
+        #pragma omp for ordered schedule(static, 1)
+        for (int b = 0; b < num_blocks; ++b)
+        {
+            uint8_t *p = buf;
+            int y_end = MIN(self->height, (b + 1) * block_rows);
+            for (int y = b * block_rows; y < y_end; ++y)
+            {
+                pnm_swap16(p, image_row(self, y), self->width);
+                p += row_bytes;
+            }
+
+            #pragma omp ordered
+            {
+                if (!failed && pnm_write_all(fd, (const char *)buf, p - buf) != 0)
+                {
+                    failed = 1;
+                }
+            }
+        }
+        free(buf);
+    }
+    return failed ? -1 : 0;
+}
+
+/**
+ * @fn int image_save_pam(const image_t *self, const char *fname)
+ * @brief saves image data to a PAM (P7) file
+ * @param self image object
+ * @param fname path to file
+ * @return 0 if success, -1 if failure
+ *
+ * Bitmaps are saved as BLACKANDWHITE tuples (one byte per pixel, 1 = white), 8-bit and 16-bit grayscale images
+ * (such as tag images) as GRAYSCALE tuples, color images as RGB tuples.
+ */
+int image_save_pam(const image_t *self, const char *fname)
+{
+    const char *tupltype;
+    int depth;
+    int channels = 1;
+    int res = 0;
+    FILE *fp;
+
+    assert(self && self->data);
+    switch(self->type)
+    {
+    case IMAGE_BITMAP:
+        tupltype = "BLACKANDWHITE";
+        depth = 1;
+        break;
+    case IMAGE_GRAYSCALE_8:
+        tupltype = "GRAYSCALE";
+        depth = 255;
+        break;
+    case IMAGE_GRAYSCALE_16:
+        tupltype = "GRAYSCALE";
+        depth = 65535;
+        break;
+    case IMAGE_RGB_888:
+        tupltype = "RGB";
+        depth = 255;
+        channels = 3;
+        break;
+    default:
+        DIE("Unsupported");
+    }
+
+    fp = fopen(fname, "wb");
+    if (!fp)
+    {
+        fprintf(stderr, "Could not open file %s\n", fname);
+        return -1;
+    }
+    fprintf(fp, "P7\nWIDTH %d\nHEIGHT %d\nDEPTH %d\nMAXVAL %d\nTUPLTYPE %s\nENDHDR\n",
+        self->width, self->height, channels, depth, tupltype);
+
+    if (self->type == IMAGE_GRAYSCALE_16)
+    {
+        fflush(fp);
+        res = pnm_write_binary16(self, fileno(fp));
+    }
+    else if (self->type == IMAGE_BITMAP)
+    {
+        uint8_t *row = malloc(self->width);
+        assert(row);
+        FOR_Y(self, y)
+        {
+            const uint8_t *bits = image_row(self, y);
+            FOR_X(self, x)
+            {
+                row[x] = !image_bmp_row_get(bits, x);
+            }
+            fwrite(row, 1, self->width, fp);
+        }
+        free(row);
+    }
+    else
+    {
+        size_t row_bytes = image_row_bytes(self->width, self->type);
+        FOR_Y(self, y)
+        {
+            fwrite(image_row(self, y), row_bytes, 1, fp);
+        }
+    }
+    if (ferror(fp))
+    {
+        res = -1;
+    }
+    fclose(fp);
+    return res;
+}
+
 /** 
  * @fn int image_save_ascii(const image_t *self, const char *fname)
  * @brief saves image data to NetBPM file, with ASCII encoding
@@ -246,7 +656,6 @@ int image_save(const image_t *self, const char *fname, int binary_encoding)
 
     DEBUG_PRINT("Saving image @%p to file %s",
         (void *)self, fname);
-    image_print_details(self);
 
     switch(self->type)
     {
@@ -280,27 +689,23 @@ int image_save(const image_t *self, const char *fname, int binary_encoding)
         format += 3;
     }
 
-    fprintf(fp, "P%d\n%d %d\n%d\n",
-            format,
-            self->width, self->height,
-            depth);
+    /* note: bitmaps (P1/P4) have no maximum value field */
+    fprintf(fp, "P%d\n%d %d\n", format, self->width, self->height);
+    if (self->type != IMAGE_BITMAP)
+    {
+        fprintf(fp, "%d\n", depth);
+    }
 
     if (binary_encoding)
     {
-        long int nbytes;
+        size_t row_bytes;
         switch(self->type)
         {
         case IMAGE_BITMAP:
-            nbytes = (self->height * self->width + 7) / 8;
-            break;
         case IMAGE_GRAYSCALE_8:
-            nbytes = (self->height * self->width);
-            break;
         case IMAGE_GRAYSCALE_16:
-            nbytes = (self->height * self->width) * 2;
-            break;
         case IMAGE_RGB_888:
-            nbytes = (self->height * self->width) * 3;
+            row_bytes = image_row_bytes(self->width, self->type);
             break;
 
         case IMAGE_GRAYSCALE_FL:
@@ -308,40 +713,38 @@ int image_save(const image_t *self, const char *fname, int binary_encoding)
             DIE("Unsupported");
             break;
         }
-        fwrite(self->data, nbytes, 1, fp);
-    }
-    else
-    {
-        FOR_YX(self, y, x)
+        if (self->type == IMAGE_GRAYSCALE_16)
         {
-            color_t c;
-            c = self->getpixel(self, x, y);
-
-            switch(self->type)
+            /* header goes through the stdio buffer, pixel data through large write() calls */
+            fflush(fp);
+            if (pnm_write_binary16(self, fileno(fp)) != 0)
             {
-            case IMAGE_BITMAP:
-                fprintf(fp, "%d\t", c.bit);
-                break;
-            case IMAGE_GRAYSCALE_8:
-                fprintf(fp, "%d\t", c.gs8);
-                break;
-            case IMAGE_GRAYSCALE_16:
-                fprintf(fp, "%d\t", c.gs16);
-                break;
-            case IMAGE_GRAYSCALE_FL:
-                fprintf(fp, "%d\t", (uint16_t)(depth * LIMIT(c.fl, 0.0, 1.0)));
-                break;
-            case IMAGE_RGB_888:
-                fprintf(fp, "%d\t%d\t%d\t", c.rgb.r, c.rgb.g, c.rgb.b);
-                break;
+                fclose(fp);
+                return -1;
             }
-
-            if (x == self->width - 1)
+        }
+        else if (row_bytes == self->stride)
+        {
+            fwrite(self->data, row_bytes, self->height, fp);
+        }
+        else
+        {
+            FOR_Y(self, y)
             {
-                fprintf(fp, "\n");
+                fwrite(self->data + y * self->stride, row_bytes, 1, fp);
             }
         }
     }
+    else
+    {
+        /* header goes through the stdio buffer, pixel data through large write() calls */
+        fflush(fp);
+        if (pnm_write_ascii(self, fileno(fp), depth) != 0)
+        {
+            fclose(fp);
+            return -1;
+        }
+    }
     DEBUG_PRINT("File saved");
     fclose(fp);
     return 0;
@@ -0,0 +1,153 @@
+/**
+ * @file image_memory.c
+ * @brief Image processing library: accounting of the memory held by images and labeling tables
+ * @author Saint-Cirgue Arnaud _ Correge Etienne
+ * @version 0.1
+ * @date november 2023
+ */
+
+/**
+ * Pixel buffers are accounted by image constructors and image_delete(); labeling tables
+ * (equivalences, renumbering, components) are allocated with the mem_track_*() functions, which
+ * take the block size on release, like munmap(). Counters are process-wide and lock-free:
+ * when several images are labeled at once (see image_batch.h), a phase peak covers all of them.
+ *
+ * A phase is delimited by two calls of mem_track_phase():
+ *
+ *     mem_track_phase();
+ *     ... first pass ...
+ *     mem_track_t first_pass = mem_track_phase();
+ */
+
+#include <stdlib.h>
+
+#include "image_memory.h"
+#include "utils.h"
+
+/**
+ * Number of bytes held
+ */
+static size_t mem_current = 0;
+
+/**
+ * Highest value of mem_current since the last phase snapshot
+ */
+static size_t mem_peak = 0;
+
+/**
+ * @brief Account for memory that was acquired
+ * @param bytes number of bytes
+ */
+void mem_track_add(size_t bytes)
+{
+    size_t current = __atomic_add_fetch(&mem_current, bytes, __ATOMIC_RELAXED);
+    size_t peak = __atomic_load_n(&mem_peak, __ATOMIC_RELAXED);
+
+    while (current > peak &&
+           !__atomic_compare_exchange_n(&mem_peak, &peak, current, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+    {
+        /* peak was reloaded by the failed exchange */
+    }
+}
+
+/**
+ * @brief Account for memory that was released
+ * @param bytes number of bytes, as given to mem_track_add()
+ */
+void mem_track_sub(size_t bytes)
+{
+    __atomic_sub_fetch(&mem_current, bytes, __ATOMIC_RELAXED);
+}
+
+/**
+ * @brief malloc(), accounted
+ * @param bytes block size
+ * @return block, NULL if failure
+ */
+void *mem_track_malloc(size_t bytes)
+{
+    void *ptr = malloc(bytes);
+    if (ptr)
+    {
+        mem_track_add(bytes);
+    }
+    return ptr;
+}
+
+/**
+ * @brief calloc(), accounted
+ * @param n number of elements
+ * @param size element size
+ * @return zeroed block, NULL if failure
+ */
+void *mem_track_calloc(size_t n, size_t size)
+{
+    void *ptr = calloc(n, size);
+    if (ptr)
+    {
+        mem_track_add(n * size);
+    }
+    return ptr;
+}
+
+/**
+ * @brief realloc(), accounted
+ * @param ptr block, or NULL
+ * @param old_bytes current block size (0 if ptr is NULL)
+ * @param new_bytes new block size
+ * @return resized block, NULL if failure (ptr is then still valid)
+ */
+void *mem_track_realloc(void *ptr, size_t old_bytes, size_t new_bytes)
+{
+    void *res = realloc(ptr, new_bytes);
+    if (res)
+    {
+        mem_track_add(new_bytes);
+        mem_track_sub(old_bytes);
+    }
+    return res;
+}
+
+/**
+ * @brief free(), accounted
+ * @param ptr block allocated by mem_track_malloc(), mem_track_calloc() or mem_track_realloc(), or NULL
+ * @param bytes block size
+ */
+void mem_track_free(void *ptr, size_t bytes)
+{
+    if (ptr)
+    {
+        free(ptr);
+        mem_track_sub(bytes);
+    }
+}
+
+/**
+ * @brief Number of bytes currently held
+ */
+size_t mem_track_current(void)
+{
+    return __atomic_load_n(&mem_current, __ATOMIC_RELAXED);
+}
+
+/**
+ * @brief Highest number of bytes held since the last phase snapshot
+ */
+size_t mem_track_peak(void)
+{
+    return __atomic_load_n(&mem_peak, __ATOMIC_RELAXED);
+}
+
+/**
+ * @brief End a phase: snapshot of the counters, then start the next phase from the current footprint
+ * @return bytes currently held, and peak of the phase
+ */
+mem_track_t mem_track_phase(void)
+{
+    mem_track_t snapshot;
+
+    snapshot.current = mem_track_current();
+    snapshot.peak = __atomic_exchange_n(&mem_peak, snapshot.current, __ATOMIC_RELAXED);
+    snapshot.peak = MAX(snapshot.peak, snapshot.current);
+    return snapshot;
+}
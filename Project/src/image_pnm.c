@@ -0,0 +1,642 @@
+/**
+ * @file image_pnm.c
+ * @brief Basic image processing library: Netpbm format helpers shared by file readers and writers
+ * @author Saint-Cirgue Arnaud _ Correge Etienne
+ * @version 0.1
+ * @date november 2023
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <stdint.h>
+#include <ctype.h>
+#include <unistd.h>
+
+#include "image_pnm.h"
+#include "image_bitmap.h"
+#include "utils.h"
+#include <omp.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+/**
+ * @brief Read an unsigned decimal header field from memory, skipping whitespace and comments
+ * @param buf file contents
+ * @param len length of buf
+ * @param pos (input/output) current position in buf
+ * @param value (output) value read
+ * @return 0 if success, -1 if failure, -2 if buf ends before the value
+ */
+static int pnm_read_uint(const uint8_t *buf, size_t len, size_t *pos, int *value)
+{
+    size_t i = *pos;
+    long v = 0;
+
+    while (i < len && (isspace(buf[i]) || buf[i] == '#'))
+    {
+        if (buf[i] == '#')
+        {
+            /* comment: skip until end of line */
+            while (i < len && buf[i] != '\n')
+                i++;
+        }
+        else
+        {
+            i++;
+        }
+    }
+    if (i >= len)
+    {
+        return -2;
+    }
+    if (!isdigit(buf[i]))
+    {
+        return -1;
+    }
+    while (i < len && isdigit(buf[i]) && v < 100000)
+    {
+        v = 10 * v + (buf[i++] - '0');
+    }
+    *value = v;
+    *pos = i;
+    return 0;
+}
+
+/**
+ * @brief Parse the header of a PAM (P7) file from memory: "KEYWORD value" lines, up to ENDHDR
+ * @param buf file contents
+ * @param len length of buf
+ * @param hdr (output) header fields
+ * @return 0 if success, -1 if buf does not start with a valid PAM header, -2 if buf ends before ENDHDR
+ */
+static int pnm_parse_pam_header(const uint8_t *buf, size_t len, pnm_header_t *hdr)
+{
+    size_t pos = 2;
+    char tupltype[32] = "";
+
+    hdr->width = hdr->height = hdr->channels = hdr->depth = 0;
+    for (;;)
+    {
+        /* next keyword, skipping whitespace and comments */
+        while (pos < len && (isspace(buf[pos]) || buf[pos] == '#'))
+        {
+            if (buf[pos] == '#')
+            {
+                while (pos < len && buf[pos] != '\n')
+                    pos++;
+            }
+            else
+            {
+                pos++;
+            }
+        }
+        size_t key = pos;
+        while (pos < len && !isspace(buf[pos]))
+            pos++;
+        size_t key_len = pos - key;
+        if (pos >= len)
+        {
+            return -2;
+        }
+        if (key_len == 0)
+        {
+            return -1;
+        }
+
+#define PAM_KEY(name) (key_len == sizeof(name) - 1 && !memcmp(buf + key, name, key_len))
+        if (PAM_KEY("ENDHDR"))
+        {
+            /* the header ends with the newline of the ENDHDR line */
+            while (pos < len && buf[pos] != '\n')
+                pos++;
+            if (pos >= len)
+            {
+                return -2;
+            }
+            hdr->offset = pos + 1;
+            break;
+        }
+        else if (PAM_KEY("TUPLTYPE"))
+        {
+            /* value: rest of the line */
+            while (pos < len && buf[pos] != '\n' && isspace(buf[pos]))
+                pos++;
+            size_t v = pos;
+            while (pos < len && buf[pos] != '\n')
+                pos++;
+            size_t v_len = MIN(pos - v, sizeof(tupltype) - 1);
+            memcpy(tupltype, buf + v, v_len);
+            tupltype[v_len] = '\0';
+        }
+        else
+        {
+            int res = 0;
+            res = PAM_KEY("WIDTH") ? pnm_read_uint(buf, len, &pos, &hdr->width) : res;
+            res = PAM_KEY("HEIGHT") ? pnm_read_uint(buf, len, &pos, &hdr->height) : res;
+            res = PAM_KEY("DEPTH") ? pnm_read_uint(buf, len, &pos, &hdr->channels) : res;
+            res = PAM_KEY("MAXVAL") ? pnm_read_uint(buf, len, &pos, &hdr->depth) : res;
+            if (res != 0)
+            {
+                return res;
+            }
+        }
+#undef PAM_KEY
+    }
+
+    /* tuple types with an image type: GRAYSCALE, BLACKANDWHITE, RGB (and label images with any maxval) */
+    if (hdr->channels != 1 && hdr->channels != 3)
+    {
+        DEBUG_PRINT("PAM tuple type `%s` with depth %d is not supported", tupltype, hdr->channels);
+        return -1;
+    }
+    if (hdr->channels == 3 && hdr->depth > 255)
+    {
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Parse a P1..P7 Netpbm header from memory
+ * @param buf file contents
+ * @param len length of buf
+ * @param hdr (output) header fields
+ * @return 0 if success, -1 if buf does not start with a valid header,
+ *  -2 if buf ends before the end of the header (a longer buffer may parse)
+ */
+int pnm_parse_header(const uint8_t *buf, size_t len, pnm_header_t *hdr)
+{
+    size_t pos = 2;
+    int res;
+
+    if ((len >= 1 && buf[0] != 'P') || (len >= 2 && (buf[1] < '1' || buf[1] > '7')))
+    {
+        return -1;
+    }
+    if (len < 3)
+    {
+        return -2;
+    }
+    hdr->format = buf[1] - '0';
+    hdr->depth = 1;
+    hdr->channels = (hdr->format == 3 || hdr->format == 6) ? 3 : 1;
+    if (hdr->format == 7)
+    {
+        if ((res = pnm_parse_pam_header(buf, len, hdr)) != 0)
+        {
+            return res;
+        }
+    }
+    else if ((res = pnm_read_uint(buf, len, &pos, &hdr->width)) ||
+        (res = pnm_read_uint(buf, len, &pos, &hdr->height)) ||
+        ((hdr->format != 1 && hdr->format != 4) && (res = pnm_read_uint(buf, len, &pos, &hdr->depth))))
+    {
+        return res;
+    }
+    if (hdr->width <= 0 || hdr->width >= 100000 || hdr->height <= 0 || hdr->height >= 100000 ||
+        hdr->depth <= 0 || hdr->depth > 65535)
+    {
+        return -1;
+    }
+    if (hdr->format == 7)
+    {
+        return 0;
+    }
+    /* a single whitespace character separates the header from pixel data */
+    if (pos >= len)
+    {
+        return -2;
+    }
+    if (!isspace(buf[pos]))
+    {
+        return -1;
+    }
+    hdr->offset = pos + 1;
+    return 0;
+}
+
+/**
+ * @brief Image type corresponding to a Netpbm header
+ * @param hdr header fields
+ * @return image type
+ */
+image_type_t pnm_image_type(const pnm_header_t *hdr)
+{
+    switch(hdr->format)
+    {
+    case 1:
+    case 4:
+        return IMAGE_BITMAP;
+    case 2:
+    case 5:
+        return (hdr->depth < 256) ? IMAGE_GRAYSCALE_8 : IMAGE_GRAYSCALE_16;
+    case 7:
+        if (hdr->channels == 3)
+        {
+            return IMAGE_RGB_888;
+        }
+        if (hdr->depth == 1)
+        {
+            return IMAGE_BITMAP;
+        }
+        return (hdr->depth < 256) ? IMAGE_GRAYSCALE_8 : IMAGE_GRAYSCALE_16;
+    default:
+        return IMAGE_RGB_888;
+    }
+}
+
+/**
+ * @brief Count or decode the values of a chunk of ASCII pixel data
+ * @param self image receiving pixels, or NULL to only count values
+ * @param p start of chunk
+ * @param end end of chunk
+ * @param single_digit true for P1 bitmaps, where each digit is a value ("0110" is 4 pixels)
+ * @param first index of the first value of the chunk (over all channels of all pixels)
+ * @return number of values found in the chunk
+ *
+ * Values beyond the image size are counted, but not stored.
+ */
+static long pnm_ascii_chunk(image_t *self, const uint8_t *p, const uint8_t *end, bool single_digit, long first)
+{
+    int channels = (self && self->type == IMAGE_RGB_888) ? 3 : 1;
+    long count = 0;
+    long total = 0;
+    int x = 0, y = 0, ch = 0;
+    uint8_t *row = NULL;
+    uint32_t v;
+
+    if (self)
+    {
+        total = (long)self->width * self->height * channels;
+        x = (first / channels) % self->width;
+        y = (first / channels) / self->width;
+        ch = first % channels;
+        row = (first < total) ? image_row(self, y) : NULL;
+    }
+
+    while (p < end)
+    {
+        if ((unsigned)(*p - '0') < 10)
+        {
+            if (single_digit)
+            {
+                v = *p++ - '0';
+            }
+            else
+            {
+                p = pnm_scan_uint(p, end, &v);
+            }
+            count++;
+            if (!row)
+            {
+                continue;
+            }
+
+            switch(self->type)
+            {
+            case IMAGE_BITMAP:
+                if (v)
+                {
+                    /* neighbor chunks may share this byte */
+                    #pragma omp atomic update
+                    row[x >> 3] |= 0x80 >> (x & 7);
+                }
+                break;
+            case IMAGE_GRAYSCALE_8:
+                ((gs8_t *)row)[x] = LIMIT(v, 0, 255);
+                break;
+            case IMAGE_GRAYSCALE_16:
+                ((gs16_t *)row)[x] = LIMIT(v, 0, 65535);
+                break;
+            case IMAGE_RGB_888:
+                row[3 * x + ch] = LIMIT(v, 0, 255);
+                break;
+            default:
+                DIE("Not supported");
+            }
+
+            /* move to next value */
+            if (++ch == channels)
+            {
+                ch = 0;
+                if (++x == self->width)
+                {
+                    x = 0;
+                    row = (++y < self->height) ? image_row(self, y) : NULL;
+                }
+            }
+        }
+        else if (*p == '#')
+        {
+            /* comment: skip until end of line */
+            while (p < end && *p != '\n')
+                p++;
+        }
+        else
+        {
+            p++;
+        }
+    }
+    return count;
+}
+
+/**
+ * @brief Decode ASCII-encoded (P1, P2, P3) pixel data, in parallel
+ * @param self image receiving pixels (zero-initialized)
+ * @param buf pixel data
+ * @param len length of pixel data
+ * @return 0 if success, -1 if pixel data is incomplete
+ *
+ * The buffer is split in one chunk per thread, at whitespace boundaries.
+ * A first pass counts the values of each chunk, so that each thread knows the index of its first value;
+ * a second pass converts values with a hand-written scanner, and writes them directly into pixel rows.
+ * Comments may only be split safely at line level: buffers containing comments are parsed by a single thread.
+ */
+int pnm_parse_ascii(image_t *self, const uint8_t *buf, size_t len)
+{
+    bool single_digit = (self->type == IMAGE_BITMAP);
+    int channels = (self->type == IMAGE_RGB_888) ? 3 : 1;
+    long expected = (long)self->width * self->height * channels;
+    int num_chunks = omp_get_max_threads();
+    int k;
+
+    if (len < (1 << 16) || memchr(buf, '#', len))
+    {
+        num_chunks = 1;
+    }
+
+    size_t *bounds = malloc((num_chunks + 1) * sizeof(size_t));
+    long *first = malloc((num_chunks + 1) * sizeof(long));
+    assert(bounds && first);
+
+    /* chunk boundaries: move forward to the next whitespace, so that no value is split */
+    bounds[0] = 0;
+    bounds[num_chunks] = len;
+    for (k = 1; k < num_chunks; ++k)
+    {
+        size_t b = MAX(bounds[k - 1], len / num_chunks * k);
+        while (b < len && !single_digit && !isspace(buf[b]))
+            b++;
+        bounds[k] = b;
+    }
+
+    /* first pass: count values per chunk, then prefix sum */
+    first[0] = 0;
+    #pragma omp parallel for schedule(static)
+    for (k = 0; k < num_chunks; ++k)
+    {
+        first[k + 1] = pnm_ascii_chunk(NULL, buf + bounds[k], buf + bounds[k + 1], single_digit, 0);
+    }
+    for (k = 0; k < num_chunks; ++k)
+    {
+        first[k + 1] += first[k];
+    }
+
+    /* second pass: decode values into pixel rows */
+    #pragma omp parallel for schedule(static)
+    for (k = 0; k < num_chunks; ++k)
+    {
+        pnm_ascii_chunk(self, buf + bounds[k], buf + bounds[k + 1], single_digit, first[k]);
+    }
+
+    long found = first[num_chunks];
+    free(bounds);
+    free(first);
+    if (found < expected)
+    {
+        fprintf(stderr, "Expected %ld values, could read only %ld values.\n", expected, found);
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Size of a pixel row in a binary-encoded (P4..P7) file
+ * @param hdr header fields
+ * @return row size (in bytes)
+ */
+size_t pnm_file_row_bytes(const pnm_header_t *hdr)
+{
+    if (hdr->format == 4)
+    {
+        return (hdr->width + 7) / 8;
+    }
+    return (size_t)hdr->width * hdr->channels * ((hdr->depth > 255) ? 2 : 1);
+}
+
+/**
+ * @brief Size of the pixel data of an image, in a buffer which may hold more images after it
+ * @param hdr header fields
+ * @param data pixel data (after the header)
+ * @param len bytes available from data
+ * @return size of pixel data (in bytes); may be more than len if data is truncated
+ *
+ * ASCII pixel data ends where the next image starts (magic number 'P', outside comments), or at the end of the buffer.
+ */
+size_t pnm_payload_size(const pnm_header_t *hdr, const uint8_t *data, size_t len)
+{
+    if (hdr->format > 3)
+    {
+        return pnm_file_row_bytes(hdr) * hdr->height;
+    }
+
+    size_t pos = 0;
+    while (pos < len && data[pos] != 'P')
+    {
+        if (data[pos] == '#')
+        {
+            /* comment: skip until end of line */
+            while (pos < len && data[pos] != '\n')
+                pos++;
+        }
+        else
+        {
+            pos++;
+        }
+    }
+    return pos;
+}
+
+/**
+ * @brief Create an image from the pixel data of a Netpbm file in memory
+ * @param hdr header fields
+ * @param data pixel data (after the header)
+ * @param len size of the pixel data (see pnm_payload_size())
+ * @return Handle of a new image object, NULL if pixel data is incomplete
+ *
+ * ASCII data is parsed in parallel (see pnm_parse_ascii()); binary rows are copied in parallel,
+ * converting 16-bit samples from big-endian, and PAM black and white bytes (1 = white) to bits (1 = black).
+ */
+image_t *pnm_decode(const pnm_header_t *hdr, const uint8_t *data, size_t len)
+{
+    image_type_t type = pnm_image_type(hdr);
+    image_t *self = image_new(hdr->width, hdr->height, type);
+    if (!self)
+    {
+        return NULL;
+    }
+
+    if (hdr->format < 4)
+    {
+        if (pnm_parse_ascii(self, data, len) != 0)
+        {
+            image_delete(self);
+            return NULL;
+        }
+        return self;
+    }
+
+    size_t row_bytes = pnm_file_row_bytes(hdr);
+    if (row_bytes * hdr->height > len)
+    {
+        fprintf(stderr, "Expected %d rows, could read only %ld rows.\n", hdr->height, (long)(len / row_bytes));
+        image_delete(self);
+        return NULL;
+    }
+
+    #pragma omp parallel for schedule(static)
+    for (int y = 0; y < hdr->height; ++y)
+    {
+        const uint8_t *src = data + y * row_bytes;
+        uint8_t *dst = image_row(self, y);
+        if (type == IMAGE_GRAYSCALE_16)
+        {
+            pnm_swap16(dst, src, hdr->width);
+        }
+        else if (type == IMAGE_BITMAP && hdr->format == 7)
+        {
+            for (int x = 0; x < hdr->width; ++x)
+            {
+                image_bmp_row_set(dst, x, !src[x]);
+            }
+        }
+        else
+        {
+            memcpy(dst, src, row_bytes);
+            if (type == IMAGE_BITMAP)
+            {
+                bmp_row_clear_padding(dst, hdr->width);
+            }
+        }
+    }
+    return self;
+}
+
+/**
+ * @brief Format one pixel row as ASCII text: tab-separated values, ending with a newline
+ * @param self image object
+ * @param y ordinate of the row
+ * @param depth maximum value (for floating-point images)
+ * @param p output buffer, large enough for the row
+ * @return pointer past the last character written
+ */
+char *pnm_format_row(const image_t *self, int y, int depth, char *p)
+{
+    const uint8_t *row = image_row(self, y);
+
+    /* dispatch on the image type once per row */
+    switch(self->type)
+    {
+    case IMAGE_BITMAP:
+        FOR_X(self, x)
+        {
+            *p++ = '0' + image_bmp_row_get(row, x);
+            *p++ = '\t';
+        }
+        break;
+    case IMAGE_GRAYSCALE_8:
+        FOR_X(self, x)
+        {
+            p = pnm_format_uint(p, ((const gs8_t *)row)[x]);
+            *p++ = '\t';
+        }
+        break;
+    case IMAGE_GRAYSCALE_16:
+        FOR_X(self, x)
+        {
+            p = pnm_format_uint(p, ((const gs16_t *)row)[x]);
+            *p++ = '\t';
+        }
+        break;
+    case IMAGE_GRAYSCALE_FL:
+        FOR_X(self, x)
+        {
+            p = pnm_format_uint(p, (uint16_t)(depth * LIMIT(((const float *)row)[x], 0.0, 1.0)));
+            *p++ = '\t';
+        }
+        break;
+    case IMAGE_RGB_888:
+        FOR_X(self, x)
+        {
+            p = pnm_format_uint(p, row[3 * x]);
+            *p++ = '\t';
+            p = pnm_format_uint(p, row[3 * x + 1]);
+            *p++ = '\t';
+            p = pnm_format_uint(p, row[3 * x + 2]);
+            *p++ = '\t';
+        }
+        break;
+    default:
+        DIE("Unsupported");
+    }
+    *p++ = '\n';
+    return p;
+}
+
+/**
+ * @brief Write all bytes of a buffer to a file descriptor
+ * @param fd file descriptor
+ * @param buf data
+ * @param len data length
+ * @return 0 if success, -1 if failure
+ */
+int pnm_write_all(int fd, const char *buf, size_t len)
+{
+    while (len > 0)
+    {
+        ssize_t n = write(fd, buf, len);
+        if (n <= 0)
+        {
+            return -1;
+        }
+        buf += n;
+        len -= n;
+    }
+    return 0;
+}
+
+/**
+ * @brief Convert 16-bit samples between big-endian (Netpbm byte order) and host byte order
+ * @param dst output samples (may be src, for in-place conversion)
+ * @param src input samples; no alignment required
+ * @param n number of samples
+ *
+ * The conversion is its own inverse. On little-endian hosts, bytes of each sample are swapped,
+ * 8 samples at a time with SSE2 (shift left | shift right of each 16-bit lane).
+ */
+void pnm_swap16(uint8_t *dst, const uint8_t *src, size_t n)
+{
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    memmove(dst, src, 2 * n);
+#else
+    size_t i = 0;
+#ifdef __SSE2__
+    for (; i + 8 <= n; i += 8)
+    {
+        __m128i v = _mm_loadu_si128((const __m128i *)(src + 2 * i));
+        v = _mm_or_si128(_mm_slli_epi16(v, 8), _mm_srli_epi16(v, 8));
+        _mm_storeu_si128((__m128i *)(dst + 2 * i), v);
+    }
+#endif
+    for (; i < n; ++i)
+    {
+        uint8_t hi = src[2 * i];
+        dst[2 * i] = src[2 * i + 1];
+        dst[2 * i + 1] = hi;
+    }
+#endif
+}
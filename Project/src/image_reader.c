@@ -0,0 +1,183 @@
+/**
+ * @file image_reader.c
+ * @brief Basic image processing library: read successive images of a multi-image Netpbm file
+ * @author Saint-Cirgue Arnaud _ Correge Etienne
+ * @version 0.1
+ * @date november 2023
+ */
+
+/**
+ * Netpbm files may hold several images, one after the other (header, pixel data, header, pixel data, ...).
+ * The file is mapped (or read, for pipes and standard input "-") once; each image is then decoded in parallel
+ * straight from memory. Typical use:
+ *
+ *     image_reader_t *reader = image_reader_open("document.pbm");
+ *     while ((page = image_reader_next(reader)) != NULL) { ... image_delete(page); }
+ *     if (reader->error) { ... }
+ *     image_reader_close(reader);
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <stdint.h>
+#include <ctype.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "image_reader.h"
+#include "image_pnm.h"
+#include "utils.h"
+
+/**
+ * @brief Read a whole file into memory
+ * @param fp file
+ * @param size (output) number of bytes read
+ * @return newly allocated buffer
+ */
+static uint8_t *reader_read_all(FILE *fp, size_t *size)
+{
+    size_t capacity = 1 << 20;
+    size_t len = 0;
+    size_t n;
+    uint8_t *buf = malloc(capacity);
+    assert(buf);
+
+    while ((n = fread(buf + len, 1, capacity - len, fp)) > 0)
+    {
+        len += n;
+        if (len == capacity)
+        {
+            capacity *= 2;
+            buf = realloc(buf, capacity);
+            assert(buf);
+        }
+    }
+    *size = len;
+    return buf;
+}
+
+/**
+ * @fn image_reader_open(const char *fname)
+ * @brief Open a file holding one or more Netpbm images (P1..P7)
+ * @param fname path of image file, or "-" for standard input
+ * @return Handle of a new reader, NULL in case of failure.
+ */
+image_reader_t *image_reader_open(const char *fname)
+{
+    image_reader_t *self;
+    struct stat st;
+    int fd;
+
+    self = calloc(1, sizeof(image_reader_t));
+    assert(self);
+    self->fname = fname;
+
+    if (!strcmp(fname, "-"))
+    {
+        self->data = reader_read_all(stdin, &self->size);
+        return self;
+    }
+
+    fd = open(fname, O_RDONLY);
+    if (fd < 0)
+    {
+        fprintf(stderr, "Failed to open file `%s`\n", fname);
+        free(self);
+        return NULL;
+    }
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0)
+    {
+        self->data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (self->data != MAP_FAILED)
+        {
+            self->size = st.st_size;
+            self->mapped = 1;
+            (void)madvise(self->data, self->size, MADV_SEQUENTIAL);
+        }
+    }
+    if (!self->mapped)
+    {
+        /* pipes, devices... */
+        FILE *fp = fdopen(fd, "rb");
+        assert(fp);
+        self->data = reader_read_all(fp, &self->size);
+        fclose(fp);
+        return self;
+    }
+    close(fd);
+    return self;
+}
+
+/**
+ * @brief Image constructor; decodes the next image of a reader
+ * @param self a reader
+ * @return Handle of a new image object, NULL after the last image or in case of failure (then self->error is set).
+ */
+image_t *image_reader_next(image_reader_t *self)
+{
+    pnm_header_t hdr;
+    image_t *img;
+
+    /* whitespace may separate images */
+    while (self->pos < self->size && isspace(self->data[self->pos]))
+    {
+        self->pos++;
+    }
+    if (self->error || self->pos >= self->size)
+    {
+        return NULL;
+    }
+
+    const uint8_t *p = self->data + self->pos;
+    size_t len = self->size - self->pos;
+    if (pnm_parse_header(p, len, &hdr) != 0)
+    {
+        fprintf(stderr, "%s: image %d: not a Netpbm image\n", self->fname, self->index + 1);
+        self->error = 1;
+        return NULL;
+    }
+    size_t payload = pnm_payload_size(&hdr, p + hdr.offset, len - hdr.offset);
+    if (payload > len - hdr.offset)
+    {
+        fprintf(stderr, "%s: image %d: truncated pixel data\n", self->fname, self->index + 1);
+        self->error = 1;
+        return NULL;
+    }
+
+    img = pnm_decode(&hdr, p + hdr.offset, payload);
+    if (!img)
+    {
+        self->error = 1;
+        return NULL;
+    }
+    if (self->mapped)
+    {
+        /* pages already decoded will not be read again */
+        size_t done = (self->pos + hdr.offset + payload) & ~(size_t)(sysconf(_SC_PAGESIZE) - 1);
+        (void)madvise(self->data, done, MADV_DONTNEED);
+    }
+    self->pos += hdr.offset + payload;
+    self->index++;
+    return img;
+}
+
+/**
+ * @brief Close a reader
+ * @param self a reader
+ */
+void image_reader_close(image_reader_t *self)
+{
+    if (self->mapped)
+    {
+        munmap(self->data, self->size);
+    }
+    else
+    {
+        free(self->data);
+    }
+    free(self);
+}
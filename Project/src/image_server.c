@@ -0,0 +1,382 @@
+/**
+ * @file image_server.c
+ * @brief Image processing library: long-running connected components labeling service
+ * @author Saint-Cirgue Arnaud _ Correge Etienne
+ * @version 0.1
+ * @date november 2023
+ */
+
+/**
+ * The service answers one request per line, with one JSON line:
+ *
+ *     <path>                                               label an image file
+ *     shm <name> <width> <height> <pbm|pgm|pgm16|ppm> [stride]   label pixel rows in a POSIX shared memory object
+ *     quit                                                 stop the service
+ *
+ *     {"request":1,"width":640,"height":480,"num_cc":2,"time":0.000412,"components":[[x1,y1,x2,y2,pixels],...]}
+ *     {"request":2,"error":"cannot open image"}
+ *
+ * Shared memory rows are packed as in binary Netpbm files (bitmaps: 1 bit per pixel, 1 = black),
+ * with 16-bit samples in host byte order. Grayscale and color images are binarized first (see image_threshold.h).
+ *
+ * Between requests, the OpenMP thread team stays alive, and the tags buffer, equivalence table and
+ * components table are kept: a request only allocates when an image is larger than all previous ones.
+ */
+
+#include "image_server.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <omp.h>
+
+/**
+ * @fn image_server_t *image_server_new(int num_threads)
+ * @brief Create a labeling service
+ * @param num_threads number of OpenMP threads for labeling
+ * @return Handle of a new service
+ */
+image_server_t *image_server_new(int num_threads)
+{
+    image_server_t *self = calloc(1, sizeof(image_server_t));
+    assert(self);
+    self->num_threads = MAX(num_threads, 1);
+    self->equiv_table = mem_track_malloc(MAX_TAGS * sizeof(int));
+    assert(self->equiv_table);
+
+    /* start the thread team now, rather than on the first request */
+    omp_set_num_threads(self->num_threads);
+    #pragma omp parallel
+    {
+    }
+    return self;
+}
+
+/**
+ * @brief Delete a labeling service
+ * @param self a service
+ */
+void image_server_delete(image_server_t *self)
+{
+    if (self->tags_buf)
+    {
+        image_delete(self->tags_buf);
+    }
+    mem_track_free(self->con_cmp, self->con_cmp_size * sizeof(image_connected_component_t));
+    mem_track_free(self->equiv_table, MAX_TAGS * sizeof(int));
+    free(self);
+}
+
+/**
+ * @brief Write a JSON string (with quotes)
+ */
+static void server_write_string(FILE *out, const char *s)
+{
+    fputc('"', out);
+    for (; *s; ++s)
+    {
+        if (*s == '"' || *s == '\\')
+        {
+            fprintf(out, "\\%c", *s);
+        }
+        else if ((unsigned char)*s < 0x20)
+        {
+            fprintf(out, "\\u%04x", *s);
+        }
+        else
+        {
+            fputc(*s, out);
+        }
+    }
+    fputc('"', out);
+}
+
+/**
+ * @brief Write an error reply
+ */
+static void server_reply_error(image_server_t *self, FILE *out, const char *error)
+{
+    fprintf(out, "{\"request\":%ld,\"error\":", self->num_requests);
+    server_write_string(out, error);
+    fprintf(out, "}\n");
+}
+
+/**
+ * @brief Map an image from a POSIX shared memory object
+ * @param args request arguments: <name> <width> <height> <pbm|pgm|pgm16|ppm> [stride]
+ * @param error (output) error message, in case of failure
+ * @return Handle of a new image (mapped read-only), NULL in case of failure
+ */
+static image_t *server_open_shm(char *args, const char **error)
+{
+    char name[256], format[8];
+    int width, height;
+    long stride = 0;
+    image_type_t type;
+
+    if (sscanf(args, "%255s %d %d %7s %ld", name, &width, &height, format, &stride) < 4)
+    {
+        *error = "usage: shm <name> <width> <height> <pbm|pgm|pgm16|ppm> [stride]";
+        return NULL;
+    }
+    if (!strcmp(format, "pbm"))
+    {
+        type = IMAGE_BITMAP;
+    }
+    else if (!strcmp(format, "pgm"))
+    {
+        type = IMAGE_GRAYSCALE_8;
+    }
+    else if (!strcmp(format, "pgm16"))
+    {
+        type = IMAGE_GRAYSCALE_16;
+    }
+    else if (!strcmp(format, "ppm"))
+    {
+        type = IMAGE_RGB_888;
+    }
+    else
+    {
+        *error = "unknown pixel format";
+        return NULL;
+    }
+    if (width <= 0 || width >= 100000 || height <= 0 || height >= 100000)
+    {
+        *error = "unsupported image size";
+        return NULL;
+    }
+    if (stride == 0)
+    {
+        stride = image_row_bytes(width, type);
+    }
+    if ((size_t)stride < image_row_bytes(width, type))
+    {
+        *error = "stride shorter than a row";
+        return NULL;
+    }
+
+    int fd = shm_open(name, O_RDONLY, 0);
+    if (fd < 0)
+    {
+        *error = "cannot open shared memory object";
+        return NULL;
+    }
+    size_t size = (size_t)stride * (height - 1) + image_row_bytes(width, type);
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < size)
+    {
+        close(fd);
+        *error = "shared memory object is too small";
+        return NULL;
+    }
+    void *map = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+    {
+        *error = "cannot map shared memory object";
+        return NULL;
+    }
+
+    image_t *img = image_new_from_mem_stride(width, height, type, map, stride);
+    assert(img);
+    image_set_mem(img, IMAGE_MEM_MMAP, map, size);
+    return img;
+}
+
+/**
+ * @brief Label an image with the service's warm buffers, and write the reply (an error reply if labeling fails)
+ * @param self a service
+ * @param img input image (deleted by this function)
+ * @param out reply stream
+ */
+static void server_label(image_server_t *self, image_t *img, FILE *out)
+{
+    double t0 = omp_get_wtime();
+
+    if (img->type != IMAGE_BITMAP)
+    {
+        image_t *bitmap = image_new_threshold(img, NULL);
+        image_delete(img);
+        img = bitmap;
+        assert(img);
+    }
+
+    /* grow the tags buffer only when an image is larger than all previous ones */
+    if (!self->tags_buf || self->tags_buf->width < img->width || self->tags_buf->height < img->height)
+    {
+        int width = img->width, height = img->height;
+        if (self->tags_buf)
+        {
+            width = MAX(width, self->tags_buf->width);
+            height = MAX(height, self->tags_buf->height);
+            image_delete(self->tags_buf);
+        }
+        self->tags_buf = image_new(width, height, IMAGE_GRAYSCALE_16);
+        assert(self->tags_buf);
+    }
+    image_t *tags = image_new_view(self->tags_buf, 0, 0, img->width, img->height);
+    assert(tags);
+
+    int num_cc = ccl_label(img, tags, self->equiv_table);
+    if (num_cc < 0)
+    {
+        /* the service goes on with the next request */
+        server_reply_error(self, out, "too many connected components (temporary tags exceed MAX_TAGS)");
+        image_delete(tags);
+        image_delete(img);
+        return;
+    }
+    if (num_cc > self->con_cmp_size)
+    {
+        mem_track_free(self->con_cmp, self->con_cmp_size * sizeof(image_connected_component_t));
+        self->con_cmp_size = MAX(num_cc, 2 * self->con_cmp_size);
+        self->con_cmp = mem_track_malloc(self->con_cmp_size * sizeof(image_connected_component_t));
+        assert(self->con_cmp);
+    }
+    memset(self->con_cmp, 0, MAX(num_cc, 0) * sizeof(image_connected_component_t));
+    ccl_analyze(tags, self->con_cmp, num_cc);
+
+    double t1 = omp_get_wtime();
+
+    fprintf(out, "{\"request\":%ld,\"width\":%d,\"height\":%d,\"num_cc\":%d,\"time\":%.6f,\"components\":[",
+        self->num_requests, img->width, img->height, num_cc, t1 - t0);
+    for (int i = 0; i < num_cc; ++i)
+    {
+        const image_connected_component_t *cc = &self->con_cmp[i];
+        fprintf(out, "%s[%d,%d,%d,%d,%u]", i ? "," : "", cc->x1, cc->y1, cc->x2, cc->y2, cc->num_pixels);
+    }
+    fprintf(out, "]}\n");
+
+    image_delete(tags);
+    image_delete(img);
+}
+
+/**
+ * @brief Serve a single request
+ * @param self a service
+ * @param request request line (modified: trailing newline removed)
+ * @param out reply stream
+ * @return 1 if the request asks to stop the service, 0 otherwise
+ */
+int image_server_handle(image_server_t *self, char *request, FILE *out)
+{
+    const char *error = "cannot open image";
+    image_t *img;
+
+    request[strcspn(request, "\r\n")] = '\0';
+    if (request[0] == '\0')
+    {
+        return 0;
+    }
+    if (!strcmp(request, "quit"))
+    {
+        return 1;
+    }
+
+    self->num_requests++;
+    if (!strncmp(request, "shm ", 4))
+    {
+        img = server_open_shm(request + 4, &error);
+    }
+    else
+    {
+        img = image_new_open_mmap(request);
+    }
+
+    if (img)
+    {
+        server_label(self, img, out);
+    }
+    else
+    {
+        server_reply_error(self, out, error);
+    }
+    fflush(out);
+    return 0;
+}
+
+/**
+ * @brief Serve the requests of a stream, until its end or a "quit" request
+ * @param self a service
+ * @param in request stream
+ * @param out reply stream
+ * @return 1 if a request asked to stop the service, 0 at end of stream
+ */
+int image_server_serve(image_server_t *self, FILE *in, FILE *out)
+{
+    char *line = NULL;
+    size_t capacity = 0;
+    int quit = 0;
+
+    while (!quit && getline(&line, &capacity, in) != -1)
+    {
+        quit = image_server_handle(self, line, out);
+    }
+    free(line);
+    return quit;
+}
+
+/**
+ * @brief Serve the clients of a Unix domain socket, one connection at a time, until a "quit" request
+ * @param self a service
+ * @param socket_path path of the socket (replaced if it exists)
+ * @return 0 after a "quit" request, -1 if the socket cannot be created
+ */
+int image_server_listen(image_server_t *self, const char *socket_path)
+{
+    struct sockaddr_un addr = {.sun_family = AF_UNIX};
+    int quit = 0;
+
+    if (strlen(socket_path) >= sizeof(addr.sun_path))
+    {
+        fprintf(stderr, "%s: socket path too long\n", socket_path);
+        return -1;
+    }
+    strcpy(addr.sun_path, socket_path);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0)
+    {
+        perror("socket");
+        return -1;
+    }
+    unlink(socket_path);
+    if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 || listen(fd, 16) != 0)
+    {
+        perror(socket_path);
+        close(fd);
+        return -1;
+    }
+
+    /* a client leaving early must not kill the service */
+    signal(SIGPIPE, SIG_IGN);
+
+    while (!quit)
+    {
+        int client = accept(fd, NULL, NULL);
+        if (client < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            perror("accept");
+            break;
+        }
+        FILE *in = fdopen(client, "r");
+        FILE *out = fdopen(dup(client), "w");
+        assert(in && out);
+        quit = image_server_serve(self, in, out);
+        fclose(out);
+        fclose(in);
+    }
+
+    close(fd);
+    unlink(socket_path);
+    return quit ? 0 : -1;
+}
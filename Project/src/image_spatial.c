@@ -0,0 +1,352 @@
+/**
+ * @file image_spatial.c
+ * @brief Image processing library: spatial index of connected components (uniform grid of bounding boxes)
+ * @author Saint-Cirgue Arnaud _ Correge Etienne
+ * @version 0.1
+ * @date november 2023
+ */
+
+/**
+ * The grid is built in three parallel passes over the components table: count the components of each cell,
+ * prefix sum the counts into cell_start, then fill cell_items (each cell's list is finally sorted, so that
+ * the index and the query results do not depend on the number of threads).
+ *
+ * Cells are about the size of the average bounding box, and no smaller than needed for one component per cell
+ * on average: a component overlaps a few cells, and a cell holds a few components.
+ *
+ * Typical use, right after the analysis:
+ *
+ *     ccl_index_t *index = ccl_index_new(con_cmp, num_cc, img->width, img->height);
+ *     n = ccl_index_query_rect(index, x1, y1, x2, y2, found, max_found); ...
+ *     ccl_index_delete(index);
+ *
+ * Queries only read the index: they may run concurrently.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <math.h>
+
+#include "image_spatial.h"
+#include "image_memory.h"
+#include "utils.h"
+#include <omp.h>
+
+/**
+ * @brief Column of the cell holding a pixel, clamped to the grid
+ */
+static inline int index_col(const ccl_index_t *self, int x)
+{
+    return LIMIT(x / self->cell_width, 0, self->cols - 1);
+}
+
+/**
+ * @brief Row of the cell holding a pixel, clamped to the grid
+ */
+static inline int index_row(const ccl_index_t *self, int y)
+{
+    return LIMIT(y / self->cell_height, 0, self->rows - 1);
+}
+
+/**
+ * @brief Build the spatial index of a components table
+ * @param con_cmp components table (see ccl_analyze()); empty entries (no pixels) are not indexed
+ * @param num_cc number of components
+ * @param width image width
+ * @param height image height
+ * @return Handle of a new index, NULL if creation fails.
+ */
+ccl_index_t *ccl_index_new(const image_connected_component_t *con_cmp, int num_cc, int width, int height)
+{
+    assert(con_cmp || num_cc == 0);
+    ccl_index_t *self = calloc(1, sizeof(ccl_index_t));
+    if (!self)
+    {
+        return NULL;
+    }
+    self->con_cmp = con_cmp;
+    self->num_cc = num_cc;
+
+    /* cell dimensions: average bounding box, at least one component per cell on average */
+    long sum_width = 0, sum_height = 0;
+    int num_indexed = 0;
+    #pragma omp parallel for reduction(+:sum_width, sum_height, num_indexed)
+    for (int t = 0; t < num_cc; ++t)
+    {
+        if (con_cmp[t].num_pixels > 0)
+        {
+            sum_width += con_cmp[t].x2 - con_cmp[t].x1 + 1;
+            sum_height += con_cmp[t].y2 - con_cmp[t].y1 + 1;
+            num_indexed++;
+        }
+    }
+    int side = (int)ceil(sqrt((double)width * height / MAX(num_indexed, 1)));
+    self->cell_width = LIMIT(MAX(side, (int)(sum_width / MAX(num_indexed, 1))), 1, MAX(width, 1));
+    self->cell_height = LIMIT(MAX(side, (int)(sum_height / MAX(num_indexed, 1))), 1, MAX(height, 1));
+    self->cols = MAX((width + self->cell_width - 1) / self->cell_width, 1);
+    self->rows = MAX((height + self->cell_height - 1) / self->cell_height, 1);
+    int num_cells = self->cols * self->rows;
+
+    /* count the components of each cell (cell_start[c + 1]), then prefix sum */
+    self->cell_start = mem_track_calloc(num_cells + 1, sizeof(int));
+    assert(self->cell_start);
+    #pragma omp parallel for schedule(dynamic, 1024)
+    for (int t = 0; t < num_cc; ++t)
+    {
+        if (con_cmp[t].num_pixels == 0)
+        {
+            continue;
+        }
+        for (int j = index_row(self, con_cmp[t].y1); j <= index_row(self, con_cmp[t].y2); ++j)
+        {
+            for (int i = index_col(self, con_cmp[t].x1); i <= index_col(self, con_cmp[t].x2); ++i)
+            {
+                #pragma omp atomic
+                self->cell_start[j * self->cols + i + 1]++;
+            }
+        }
+    }
+    for (int c = 0; c < num_cells; ++c)
+    {
+        self->cell_start[c + 1] += self->cell_start[c];
+    }
+
+    /* fill: each component takes the next free position of its cells */
+    int num_items = self->cell_start[num_cells];
+    int *cursor = mem_track_malloc(num_cells * sizeof(int));
+    self->cell_items = mem_track_malloc(MAX(num_items, 1) * sizeof(int));
+    assert(cursor && self->cell_items);
+    memcpy(cursor, self->cell_start, num_cells * sizeof(int));
+
+    #pragma omp parallel for schedule(dynamic, 1024)
+    for (int t = 0; t < num_cc; ++t)
+    {
+        if (con_cmp[t].num_pixels == 0)
+        {
+            continue;
+        }
+        for (int j = index_row(self, con_cmp[t].y1); j <= index_row(self, con_cmp[t].y2); ++j)
+        {
+            for (int i = index_col(self, con_cmp[t].x1); i <= index_col(self, con_cmp[t].x2); ++i)
+            {
+                int pos;
+                #pragma omp atomic capture
+                pos = cursor[j * self->cols + i]++;
+                self->cell_items[pos] = t;
+            }
+        }
+    }
+    mem_track_free(cursor, num_cells * sizeof(int));
+
+    /* sort each cell's list (insertion sort: a cell holds a few components) */
+    #pragma omp parallel for schedule(dynamic, 256)
+    for (int c = 0; c < num_cells; ++c)
+    {
+        int *items = self->cell_items;
+        for (int a = self->cell_start[c] + 1; a < self->cell_start[c + 1]; ++a)
+        {
+            int item = items[a];
+            int b = a;
+            for (; b > self->cell_start[c] && items[b - 1] > item; --b)
+            {
+                items[b] = items[b - 1];
+            }
+            items[b] = item;
+        }
+    }
+
+    DEBUG_PRINT("Spatial index: %d components, %dx%d cells of %dx%d pixels, %d entries", num_indexed,
+        self->cols, self->rows, self->cell_width, self->cell_height, num_items);
+    return self;
+}
+
+/**
+ * @brief Release a spatial index (not the components table)
+ * @param self an index
+ */
+void ccl_index_delete(ccl_index_t *self)
+{
+    mem_track_free(self->cell_items, MAX(self->cell_start[self->cols * self->rows], 1) * sizeof(int));
+    mem_track_free(self->cell_start, (self->cols * self->rows + 1) * sizeof(int));
+    free(self);
+}
+
+/**
+ * @brief Find the components whose bounding box intersects a rectangle
+ * @param self an index
+ * @param x1 left column of the rectangle
+ * @param y1 top row of the rectangle
+ * @param x2 right column of the rectangle (included)
+ * @param y2 bottom row of the rectangle (included)
+ * @param out (output) indices of the components in the components table, in no particular order
+ * @param max_out number of entries of out
+ * @return the number of components found (only the first max_out ones are written)
+ *
+ * A component overlapping several cells of the rectangle is reported once: by the cell holding the upper-left
+ * pixel of its intersection with the rectangle.
+ */
+int ccl_index_query_rect(const ccl_index_t *self, int x1, int y1, int x2, int y2, int *out, int max_out)
+{
+    int num_found = 0;
+    if (x1 > x2 || y1 > y2)
+    {
+        return 0;
+    }
+
+    for (int j = index_row(self, y1); j <= index_row(self, y2); ++j)
+    {
+        for (int i = index_col(self, x1); i <= index_col(self, x2); ++i)
+        {
+            int c = j * self->cols + i;
+            for (int p = self->cell_start[c]; p < self->cell_start[c + 1]; ++p)
+            {
+                int t = self->cell_items[p];
+                const image_connected_component_t *cc = &self->con_cmp[t];
+                if (cc->x1 > x2 || cc->x2 < x1 || cc->y1 > y2 || cc->y2 < y1)
+                {
+                    continue;
+                }
+                if (index_col(self, MAX(cc->x1, x1)) != i || index_row(self, MAX(cc->y1, y1)) != j)
+                {
+                    /* reported by another cell */
+                    continue;
+                }
+                if (num_found < max_out)
+                {
+                    out[num_found] = t;
+                }
+                num_found++;
+            }
+        }
+    }
+    return num_found;
+}
+
+/**
+ * @brief Find the components whose bounding box contains a pixel
+ * @param self an index
+ * @param x pixel column
+ * @param y pixel row
+ * @param out (output) indices of the components in the components table, in increasing order
+ * @param max_out number of entries of out
+ * @return the number of components found (only the first max_out ones are written)
+ */
+int ccl_index_query_point(const ccl_index_t *self, int x, int y, int *out, int max_out)
+{
+    int num_found = 0;
+    if (x < 0 || y < 0 || x >= self->cols * self->cell_width || y >= self->rows * self->cell_height)
+    {
+        return 0;
+    }
+
+    int c = index_row(self, y) * self->cols + index_col(self, x);
+    for (int p = self->cell_start[c]; p < self->cell_start[c + 1]; ++p)
+    {
+        int t = self->cell_items[p];
+        const image_connected_component_t *cc = &self->con_cmp[t];
+        if (cc->x1 <= x && x <= cc->x2 && cc->y1 <= y && y <= cc->y2)
+        {
+            if (num_found < max_out)
+            {
+                out[num_found] = t;
+            }
+            num_found++;
+        }
+    }
+    return num_found;
+}
+
+/**
+ * @brief Squared distance from a pixel to the bounding box of a component (0 inside)
+ */
+static inline long index_distance2(const image_connected_component_t *cc, int x, int y)
+{
+    long dx = (x < cc->x1) ? cc->x1 - x : ((x > cc->x2) ? x - cc->x2 : 0);
+    long dy = (y < cc->y1) ? cc->y1 - y : ((y > cc->y2) ? y - cc->y2 : 0);
+    return dx * dx + dy * dy;
+}
+
+/**
+ * @brief Find the k components nearest to a pixel (distance to the bounding box)
+ * @param self an index
+ * @param x pixel column (may be outside the image)
+ * @param y pixel row (may be outside the image)
+ * @param k number of components wanted
+ * @param out (output) k entries: indices of the components in the components table, nearest first
+ *  (ties: lowest index first)
+ * @return the number of components found: k, or less if the table holds less components
+ *
+ * Cells are visited in rings around the cell of the pixel. Cells of ring r are at least (r - 1) cells away
+ * from the pixel: the search stops at the first ring which cannot hold a component nearer than the k-th one.
+ */
+int ccl_index_nearest(const ccl_index_t *self, int x, int y, int k, int *out)
+{
+    if (k <= 0)
+    {
+        return 0;
+    }
+    long *out_d2 = malloc(k * sizeof(long));
+    assert(out_d2);
+    int num_found = 0;
+    int ci = index_col(self, x);
+    int cj = index_row(self, y);
+    int cell_min = MIN(self->cell_width, self->cell_height);
+
+    for (int r = 0; r <= MAX(self->cols, self->rows); ++r)
+    {
+        long bound = (long)MAX(r - 1, 0) * cell_min;
+        if (num_found == k && bound * bound > out_d2[k - 1])
+        {
+            break;
+        }
+
+        for (int j = MAX(cj - r, 0); j <= MIN(cj + r, self->rows - 1); ++j)
+        {
+            /* ring r: whole first and last rows, only both ends of the other rows */
+            int step = (j == cj - r || j == cj + r) ? 1 : 2 * r;
+            for (int i = ci - r; i <= ci + r; i += MAX(step, 1))
+            {
+                if (i < 0 || i >= self->cols)
+                {
+                    continue;
+                }
+                int c = j * self->cols + i;
+                for (int p = self->cell_start[c]; p < self->cell_start[c + 1]; ++p)
+                {
+                    int t = self->cell_items[p];
+                    long d2 = index_distance2(&self->con_cmp[t], x, y);
+                    if (num_found == k && (d2 > out_d2[k - 1] || (d2 == out_d2[k - 1] && t >= out[k - 1])))
+                    {
+                        continue;
+                    }
+
+                    /* a component overlapping several cells is met several times */
+                    bool known = false;
+                    for (int n = 0; n < num_found && !known; ++n)
+                    {
+                        known = (out[n] == t);
+                    }
+                    if (known)
+                    {
+                        continue;
+                    }
+
+                    /* insert, sorted by distance then index */
+                    int n = (num_found < k) ? num_found++ : k - 1;
+                    for (; n > 0 && (out_d2[n - 1] > d2 || (out_d2[n - 1] == d2 && out[n - 1] > t)); --n)
+                    {
+                        out[n] = out[n - 1];
+                        out_d2[n] = out_d2[n - 1];
+                    }
+                    out[n] = t;
+                    out_d2[n] = d2;
+                }
+            }
+        }
+    }
+
+    free(out_d2);
+    return num_found;
+}
@@ -0,0 +1,399 @@
+/**
+ * @file image_stream.c
+ * @brief Basic image processing library: read/write NetBPM files by blocks of rows
+ * @author Saint-Cirgue Arnaud _ Correge Etienne
+ * @version 0.1
+ * @date november 2023
+ */
+
+/**
+ * A stream reads (or writes) an image as a sequence of bands, i.e. images of a few rows
+ * with the full image width. Band-based algorithms can thus process images larger than memory,
+ * and start computing before the whole file is read. Typical use:
+ *
+ *     image_stream_t *in = image_stream_open("big.pgm");
+ *     image_t *band = image_stream_new_band(in, 64);
+ *     while ((rows = image_stream_read(in, band)) > 0) { ... process rows 0..rows-1 of band ... }
+ *     image_delete(band);
+ *     image_stream_close(in);
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <stdint.h>
+#include <ctype.h>
+
+#include "image_stream.h"
+#include "image_bitmap.h"
+#include "image_file_io.h"
+#include "image_pnm.h"
+#include "utils.h"
+#include <omp.h>
+
+/**
+ * @brief Peek at the next byte of ASCII pixel data, refilling the input buffer if needed
+ * @param self a stream opened for reading
+ * @return next byte, or EOF
+ */
+static inline int stream_peek(image_stream_t *self)
+{
+    if (self->buf_pos == self->buf_len)
+    {
+        self->buf_len = fread(self->buf, 1, IMAGE_STREAM_BUFFER, self->fp);
+        self->buf_pos = 0;
+        if (self->buf_len == 0)
+        {
+            return EOF;
+        }
+    }
+    return self->buf[self->buf_pos];
+}
+
+/**
+ * @brief Read the next value of ASCII pixel data, skipping whitespace and comments
+ * @param self a stream opened for reading
+ * @param v (output) value
+ * @return 0 if success, -1 at end of file
+ */
+static int stream_next_value(image_stream_t *self, uint32_t *v)
+{
+    int c;
+
+    /* skip whitespace and comments */
+    while ((c = stream_peek(self)) != EOF && (unsigned)(c - '0') >= 10)
+    {
+        self->buf_pos++;
+        if (c == '#')
+        {
+            while ((c = stream_peek(self)) != EOF && c != '\n')
+                self->buf_pos++;
+        }
+    }
+    if (c == EOF)
+    {
+        return -1;
+    }
+
+    /* P1 bitmaps: each digit is a value */
+    if (self->type == IMAGE_BITMAP)
+    {
+        self->buf_pos++;
+        *v = c - '0';
+        return 0;
+    }
+
+    *v = 0;
+    while ((c = stream_peek(self)) != EOF && (unsigned)(c - '0') < 10)
+    {
+        self->buf_pos++;
+        *v = MIN(10 * *v + (c - '0'), 0x10000);
+    }
+    return 0;
+}
+
+/**
+ * @brief Read one row of ASCII pixel data
+ * @param self a stream opened for reading
+ * @param row destination pixel row
+ * @return 0 if success, -1 if pixel data is incomplete
+ */
+static int stream_read_ascii_row(image_stream_t *self, uint8_t *row)
+{
+    uint32_t v;
+    int channels = (self->type == IMAGE_RGB_888) ? 3 : 1;
+
+    for (int i = 0; i < self->width * channels; ++i)
+    {
+        if (stream_next_value(self, &v) != 0)
+        {
+            return -1;
+        }
+        switch(self->type)
+        {
+        case IMAGE_BITMAP:
+            image_bmp_row_set(row, i, v);
+            break;
+        case IMAGE_GRAYSCALE_8:
+        case IMAGE_RGB_888:
+            row[i] = LIMIT(v, 0, 255);
+            break;
+        case IMAGE_GRAYSCALE_16:
+            ((gs16_t *)row)[i] = LIMIT(v, 0, 65535);
+            break;
+        default:
+            DIE("Not supported");
+        }
+    }
+    return 0;
+}
+
+/**
+ * @fn image_stream_open(const char *fname)
+ * @brief Open a PBM/PGM/PPM file for reading by bands of rows; only the header is read.
+ * @param fname path of image file
+ * @return Handle of a new stream, NULL in case of failure.
+ */
+image_stream_t *image_stream_open(const char *fname)
+{
+    image_stream_t *self;
+    image_info_t info;
+    FILE *fp;
+
+    if (image_probe(fname, &info) != 0 || (info.format == 7 && info.type == IMAGE_BITMAP))
+    {
+        fprintf(stderr, "%s: not a supported Netpbm file\n", fname);
+        return NULL;
+    }
+    fp = fopen(fname, "rb");
+    if (!fp)
+    {
+        fprintf(stderr, "Failed to open file `%s`\n", fname);
+        return NULL;
+    }
+    fseek(fp, info.offset, SEEK_SET);
+
+    self = calloc(1, sizeof(image_stream_t));
+    assert(self);
+    self->fp = fp;
+    self->width = info.width;
+    self->height = info.height;
+    self->type = info.type;
+    self->depth = info.depth;
+    self->ascii = !info.binary;
+    if (self->ascii)
+    {
+        self->buf = malloc(IMAGE_STREAM_BUFFER);
+        assert(self->buf);
+    }
+    return self;
+}
+
+/**
+ * @brief Allocate a band image suitable for a stream: same width and type, given number of rows
+ * @param self a stream
+ * @param num_rows band height
+ * @return Handle of a new image object, NULL if creation fails.
+ */
+image_t *image_stream_new_band(const image_stream_t *self, int num_rows)
+{
+    return image_new(self->width, MIN(num_rows, self->height), self->type);
+}
+
+/**
+ * @brief Read the next rows of the image into a band
+ * @param self a stream opened for reading
+ * @param band destination image, with the stream's width and type; up to band->height rows are read
+ * @return number of rows read (0 once all rows were read), -1 if the file is truncated
+ */
+int image_stream_read(image_stream_t *self, image_t *band)
+{
+    assert(self && !self->writing);
+    assert(band && band->width == self->width && band->type == self->type);
+
+    int num_rows = MIN(band->height, self->height - self->next_row);
+    size_t row_bytes = image_row_bytes(self->width, self->type);
+
+    for (int y = 0; y < num_rows; ++y)
+    {
+        uint8_t *row = image_row(band, y);
+        if (self->ascii)
+        {
+            memset(row, 0, row_bytes);
+            if (stream_read_ascii_row(self, row) != 0)
+            {
+                return -1;
+            }
+        }
+        else
+        {
+            if (fread(row, row_bytes, 1, self->fp) != 1)
+            {
+                return -1;
+            }
+            if (self->type == IMAGE_BITMAP)
+            {
+                bmp_row_clear_padding(row, self->width);
+            }
+        }
+    }
+    if (!self->ascii && self->type == IMAGE_GRAYSCALE_16)
+    {
+        /* samples are big-endian in the file */
+        #pragma omp parallel for schedule(static)
+        for (int y = 0; y < num_rows; ++y)
+        {
+            pnm_swap16(image_row(band, y), image_row(band, y), self->width);
+        }
+    }
+    self->next_row += num_rows;
+    return num_rows;
+}
+
+/**
+ * @fn image_stream_create(const char *fname, int width, int height, image_type_t type, int binary_encoding)
+ * @brief Create a PBM/PGM/PPM file, to be written by bands of rows; the header is written immediately.
+ * @param fname path to file
+ * @param width image width
+ * @param height image height
+ * @param type image type (pixel format)
+ * @param binary_encoding set to 1 to use binary encoding, 0 for ASCII encoding
+ * @return Handle of a new stream, NULL in case of failure.
+ */
+image_stream_t *image_stream_create(const char *fname, int width, int height, image_type_t type, int binary_encoding)
+{
+    image_stream_t *self;
+    int format;
+    int depth;
+    FILE *fp;
+
+    switch(type)
+    {
+    case IMAGE_BITMAP:
+        format = 1;
+        depth = 1;
+        break;
+    case IMAGE_GRAYSCALE_8:
+        format = 2;
+        depth = 255;
+        break;
+    case IMAGE_GRAYSCALE_16:
+        format = 2;
+        depth = 65535;
+        break;
+    case IMAGE_GRAYSCALE_FL:
+        if (binary_encoding)
+        {
+            DIE("Unsupported");
+        }
+        format = 2;
+        depth = 255;
+        break;
+    case IMAGE_RGB_888:
+        format = 3;
+        depth = 255;
+        break;
+    default:
+        DIE("Unsupported");
+    }
+    if (binary_encoding)
+    {
+        format += 3;
+    }
+
+    fp = fopen(fname, "wb");
+    if (!fp)
+    {
+        fprintf(stderr, "Could not open file %s\n", fname);
+        return NULL;
+    }
+    /* note: bitmaps (P1/P4) have no maximum value field */
+    fprintf(fp, "P%d\n%d %d\n", format, width, height);
+    if (type != IMAGE_BITMAP)
+    {
+        fprintf(fp, "%d\n", depth);
+    }
+
+    self = calloc(1, sizeof(image_stream_t));
+    assert(self);
+    self->fp = fp;
+    self->writing = 1;
+    self->width = width;
+    self->height = height;
+    self->type = type;
+    self->depth = depth;
+    self->ascii = !binary_encoding;
+    return self;
+}
+
+/**
+ * @brief Append rows to the image
+ * @param self a stream opened for writing
+ * @param band source image, with the stream's width and type
+ * @param num_rows number of rows of band to write (rows 0..num_rows-1)
+ * @return 0 if success, -1 if failure
+ *
+ * ASCII rows are formatted in parallel, then written in order.
+ */
+int image_stream_write(image_stream_t *self, const image_t *band, int num_rows)
+{
+    assert(self && self->writing);
+    assert(band && band->width == self->width && band->type == self->type);
+    assert(0 <= num_rows && num_rows <= band->height && self->next_row + num_rows <= self->height);
+
+    if (self->ascii)
+    {
+        /* worst case: 5 digits + tab per value, 3 values per RGB pixel */
+        size_t row_max = (size_t)self->width * ((self->type == IMAGE_RGB_888) ? 3 * 6 : 6) + 1;
+        char *buf = malloc(row_max * MAX(num_rows, 1));
+        size_t *len = malloc(sizeof(size_t) * MAX(num_rows, 1));
+        int y;
+        assert(buf && len);
+
+        #pragma omp parallel for schedule(static)
+        for (y = 0; y < num_rows; ++y)
+        {
+            char *row = buf + y * row_max;
+            len[y] = pnm_format_row(band, y, self->depth, row) - row;
+        }
+        for (y = 0; y < num_rows; ++y)
+        {
+            fwrite(buf + y * row_max, 1, len[y], self->fp);
+        }
+        free(len);
+        free(buf);
+    }
+    else if (self->type == IMAGE_GRAYSCALE_16)
+    {
+        /* samples are big-endian in the file: convert the band in parallel, then write it at once */
+        size_t row_bytes = image_row_bytes(self->width, self->type);
+        uint8_t *buf = malloc(row_bytes * MAX(num_rows, 1));
+        int y;
+        assert(buf);
+
+        #pragma omp parallel for schedule(static)
+        for (y = 0; y < num_rows; ++y)
+        {
+            pnm_swap16(buf + y * row_bytes, image_row(band, y), self->width);
+        }
+        size_t written = fwrite(buf, row_bytes, num_rows, self->fp);
+        free(buf);
+        if (written != (size_t)num_rows)
+        {
+            return -1;
+        }
+    }
+    else
+    {
+        size_t row_bytes = image_row_bytes(self->width, self->type);
+        for (int y = 0; y < num_rows; ++y)
+        {
+            if (fwrite(image_row(band, y), row_bytes, 1, self->fp) != 1)
+            {
+                return -1;
+            }
+        }
+    }
+    self->next_row += num_rows;
+    return ferror(self->fp) ? -1 : 0;
+}
+
+/**
+ * @brief Close a stream
+ * @param self a stream
+ * @return 0 if success, -1 if a stream opened for writing did not receive all rows
+ */
+int image_stream_close(image_stream_t *self)
+{
+    int res = 0;
+    if (self->writing && self->next_row < self->height)
+    {
+        DEBUG_PRINT("Stream closed after %d rows out of %d", self->next_row, self->height);
+        res = -1;
+    }
+    fclose(self->fp);
+    free(self->buf);
+    free(self);
+    return res;
+}
@@ -0,0 +1,366 @@
+/**
+ * @file image_threshold.c
+ * @brief Basic image processing library: binarization of grayscale and color images into bitmaps
+ * @author Saint-Cirgue Arnaud _ Correge Etienne
+ * @version 0.1
+ * @date november 2023
+ */
+
+/**
+ * Pixels are converted to gray levels row by row (color: luma, see gs8_from_rgb_n()),
+ * then compared to a threshold: dark pixels become black (1) bits of a packed bitmap,
+ * as with Netpbm PBM files. Rows are processed in parallel; each thread owns whole bitmap rows.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include "image_threshold.h"
+#include "image_memory.h"
+#include "utils.h"
+#include <omp.h>
+
+/**
+ * @brief settings used by image_connected_components() and the batch driver for non-bitmap images
+ */
+static image_threshold_options_t threshold_default = {
+    .method = IMAGE_THRESHOLD_OTSU,
+    .level = 127,
+    .window = 64,
+    .percent = 15};
+
+/**
+ * @brief Default binarization settings (Otsu's method, unless changed by image_threshold_set_default_options())
+ * @return settings
+ */
+image_threshold_options_t image_threshold_default_options(void)
+{
+    return threshold_default;
+}
+
+/**
+ * @brief Change the default binarization settings
+ * @param options new default settings
+ */
+void image_threshold_set_default_options(const image_threshold_options_t *options)
+{
+    threshold_default = *options;
+}
+
+/**
+ * @brief Number of gray levels of an image type
+ */
+static int threshold_num_levels(image_type_t type)
+{
+    return (type == IMAGE_GRAYSCALE_16) ? 65536 : 256;
+}
+
+/**
+ * @brief Gray levels of a pixel row
+ * @param self a grayscale or color image
+ * @param y ordinate of the row
+ * @param levels (output) width gray levels
+ * @param tmp scratch row of width bytes (color images only)
+ */
+static void threshold_row_levels(const image_t *self, int y, uint16_t *levels, gs8_t *tmp)
+{
+    switch(self->type)
+    {
+    case IMAGE_GRAYSCALE_8:
+    {
+        const gs8_t *row = image_gs8_row(self, y);
+        #pragma omp simd
+        for (int x = 0; x < self->width; ++x)
+        {
+            levels[x] = row[x];
+        }
+        break;
+    }
+    case IMAGE_GRAYSCALE_16:
+        memcpy(levels, image_row(self, y), self->width * sizeof(gs16_t));
+        break;
+    case IMAGE_RGB_888:
+        gs8_from_rgb_n(tmp, image_rgb_row(self, y), self->width);
+        #pragma omp simd
+        for (int x = 0; x < self->width; ++x)
+        {
+            levels[x] = tmp[x];
+        }
+        break;
+    default:
+        DIE("Unsupported");
+    }
+}
+
+/**
+ * @brief Pack a row of black/white decisions into a bitmap row
+ * @param row bitmap row
+ * @param black width decisions (1 for black)
+ * @param width number of pixels
+ */
+static void threshold_pack_row(uint8_t *row, const uint8_t *black, int width)
+{
+    int x;
+    for (x = 0; x + 8 <= width; x += 8)
+    {
+        row[x >> 3] = (black[x] << 7) | (black[x + 1] << 6) | (black[x + 2] << 5) | (black[x + 3] << 4) |
+            (black[x + 4] << 3) | (black[x + 5] << 2) | (black[x + 6] << 1) | black[x + 7];
+    }
+    if (x < width)
+    {
+        uint8_t byte = 0;
+        for (int i = 0; x + i < width; ++i)
+        {
+            byte |= black[x + i] << (7 - i);
+        }
+        row[x >> 3] = byte;
+    }
+}
+
+/**
+ * @brief Compute a global threshold with Otsu's method
+ * @param self a grayscale or color image
+ * @return gray level; pixels up to this level are considered black
+ *
+ * Per-thread histograms are built in parallel, then merged; the level maximizing
+ * the between-class variance is then searched in a single pass over the histogram.
+ */
+int image_threshold_otsu(const image_t *self)
+{
+    int num_levels = threshold_num_levels(self->type);
+    uint64_t *hist = mem_track_calloc(num_levels, sizeof(uint64_t));
+    assert(hist);
+
+    #pragma omp parallel
+    {
+        /* 16-bit images: 512 kB per thread */
+        uint64_t *local = mem_track_calloc(num_levels, sizeof(uint64_t));
+        uint16_t *levels = malloc(self->width * sizeof(uint16_t));
+        gs8_t *tmp = malloc(self->width);
+        assert(local && levels && tmp);
+
+        #pragma omp for schedule(static)
+        for (int y = 0; y < self->height; ++y)
+        {
+            threshold_row_levels(self, y, levels, tmp);
+            for (int x = 0; x < self->width; ++x)
+            {
+                local[levels[x]]++;
+            }
+        }
+
+        #pragma omp critical
+        for (int l = 0; l < num_levels; ++l)
+        {
+            hist[l] += local[l];
+        }
+        free(tmp);
+        free(levels);
+        mem_track_free(local, num_levels * sizeof(uint64_t));
+    }
+
+    double total = (double)self->width * self->height;
+    double sum = 0.0;
+    for (int l = 0; l < num_levels; ++l)
+    {
+        sum += (double)l * hist[l];
+    }
+
+    double sum_black = 0.0, num_black = 0.0;
+    double best = -1.0;
+    int level = 0;
+    for (int l = 0; l < num_levels; ++l)
+    {
+        num_black += hist[l];
+        if (num_black == 0.0)
+        {
+            continue;
+        }
+        double num_white = total - num_black;
+        if (num_white == 0.0)
+        {
+            break;
+        }
+        sum_black += (double)l * hist[l];
+        double mean_black = sum_black / num_black;
+        double mean_white = (sum - sum_black) / num_white;
+        double between = num_black * num_white * (mean_black - mean_white) * (mean_black - mean_white);
+        if (between > best)
+        {
+            best = between;
+            level = l;
+        }
+    }
+    mem_track_free(hist, num_levels * sizeof(uint64_t));
+    return level;
+}
+
+/**
+ * @brief Binarize with a single threshold
+ * @param self a grayscale or color image
+ * @param bitmap (output) bitmap image
+ * @param level pixels up to this level are black
+ */
+static void threshold_global(const image_t *self, image_t *bitmap, int level)
+{
+    #pragma omp parallel
+    {
+        uint16_t *levels = malloc(self->width * sizeof(uint16_t));
+        uint8_t *black = malloc(self->width);
+        gs8_t *tmp = malloc(self->width);
+        assert(levels && black && tmp);
+
+        #pragma omp for schedule(static)
+        for (int y = 0; y < self->height; ++y)
+        {
+            threshold_row_levels(self, y, levels, tmp);
+            #pragma omp simd
+            for (int x = 0; x < self->width; ++x)
+            {
+                black[x] = (levels[x] <= level);
+            }
+            threshold_pack_row(image_row(bitmap, y), black, self->width);
+        }
+        free(tmp);
+        free(black);
+        free(levels);
+    }
+}
+
+/**
+ * @brief Binarize with a threshold depending on the mean level of a window around each pixel (Bradley's method)
+ * @param self a grayscale or color image
+ * @param bitmap (output) bitmap image
+ * @param window window size (in pixels)
+ * @param percent pixels darker than the window mean by this percentage are black
+ *
+ * Window sums are obtained as in an integral image, without storing one: each thread processes a strip of rows,
+ * and keeps the column sums of the window rows, updated by one row entering and one row leaving the window;
+ * a prefix sum of the column sums then gives the sum of any horizontal span of the window.
+ */
+static void threshold_adaptive(const image_t *self, image_t *bitmap, int window, int percent)
+{
+    int r = MAX(1, window / 2);
+    int width = self->width, height = self->height;
+
+    #pragma omp parallel
+    {
+        uint64_t *col_sum = calloc(width, sizeof(uint64_t));
+        uint64_t *prefix = malloc((width + 1) * sizeof(uint64_t));
+        uint16_t *levels = malloc(width * sizeof(uint16_t));
+        uint8_t *black = malloc(width);
+        gs8_t *tmp = malloc(width);
+        int next_y = -1;
+        assert(col_sum && prefix && levels && black && tmp);
+
+        #pragma omp for schedule(static)
+        for (int y = 0; y < height; ++y)
+        {
+            int y_top = MAX(0, y - r), y_bottom = MIN(height - 1, y + r);
+
+            if (y != next_y)
+            {
+                /* first row of this thread's strip: sum the whole window */
+                memset(col_sum, 0, width * sizeof(uint64_t));
+                for (int yy = y_top; yy <= y_bottom; ++yy)
+                {
+                    threshold_row_levels(self, yy, levels, tmp);
+                    for (int x = 0; x < width; ++x)
+                    {
+                        col_sum[x] += levels[x];
+                    }
+                }
+            }
+            else
+            {
+                /* slide the window down by one row */
+                if (y + r < height)
+                {
+                    threshold_row_levels(self, y + r, levels, tmp);
+                    for (int x = 0; x < width; ++x)
+                    {
+                        col_sum[x] += levels[x];
+                    }
+                }
+                if (y - r - 1 >= 0)
+                {
+                    threshold_row_levels(self, y - r - 1, levels, tmp);
+                    for (int x = 0; x < width; ++x)
+                    {
+                        col_sum[x] -= levels[x];
+                    }
+                }
+            }
+            next_y = y + 1;
+
+            prefix[0] = 0;
+            for (int x = 0; x < width; ++x)
+            {
+                prefix[x + 1] = prefix[x] + col_sum[x];
+            }
+
+            threshold_row_levels(self, y, levels, tmp);
+            uint64_t num_rows = y_bottom - y_top + 1;
+            for (int x = 0; x < width; ++x)
+            {
+                int x_left = MAX(0, x - r), x_right = MIN(width - 1, x + r);
+                uint64_t count = num_rows * (x_right - x_left + 1);
+                uint64_t sum = prefix[x_right + 1] - prefix[x_left];
+                /* level < mean * (100 - percent) / 100, without divisions */
+                black[x] = ((uint64_t)levels[x] * count * 100 <= sum * (100 - percent));
+            }
+            threshold_pack_row(image_row(bitmap, y), black, width);
+        }
+        free(tmp);
+        free(black);
+        free(levels);
+        free(prefix);
+        free(col_sum);
+    }
+}
+
+/**
+ * @fn image_t *image_new_threshold(const image_t *self, const image_threshold_options_t *options)
+ * @brief Image constructor; creates a bitmap from a grayscale or color image
+ * @param self a IMAGE_GRAYSCALE_8, IMAGE_GRAYSCALE_16 or IMAGE_RGB_888 image
+ * @param options binarization settings, or NULL for the default settings
+ * @return Handle of a new bitmap image, NULL if creation fails.
+ */
+image_t *image_new_threshold(const image_t *self, const image_threshold_options_t *options)
+{
+    image_t *bitmap;
+    int level;
+
+    assert(self && self->data);
+    assert(self->type == IMAGE_GRAYSCALE_8 || self->type == IMAGE_GRAYSCALE_16 || self->type == IMAGE_RGB_888);
+    if (!options)
+    {
+        options = &threshold_default;
+    }
+
+    bitmap = image_new(self->width, self->height, IMAGE_BITMAP);
+    if (!bitmap)
+    {
+        return NULL;
+    }
+
+    switch(options->method)
+    {
+    case IMAGE_THRESHOLD_GLOBAL:
+        threshold_global(self, bitmap, options->level);
+        break;
+    case IMAGE_THRESHOLD_OTSU:
+        level = image_threshold_otsu(self);
+        DEBUG_PRINT("Otsu threshold: %d", level);
+        threshold_global(self, bitmap, level);
+        break;
+    case IMAGE_THRESHOLD_ADAPTIVE:
+        threshold_adaptive(self, bitmap, options->window, LIMIT(options->percent, 0, 100));
+        break;
+    default:
+        DIE("Unsupported");
+    }
+    return bitmap;
+}
@@ -0,0 +1,548 @@
+/**
+ * @file image_tiled.c
+ * @brief Basic image processing library: tiled, indexed image container files, with random access to regions
+ * @author Saint-Cirgue Arnaud _ Correge Etienne
+ * @version 0.1
+ * @date november 2023
+ */
+
+/**
+ * File layout (all integers little-endian):
+ *
+ * Offset  Size          Field
+ * ---------------------------------------------------------------
+ * 0       4             magic "CCLT"
+ * 4       4 x 8         version, type, width, height, tile width, tile height, tile columns, tile rows
+ * 36      16 x tiles    index, tile rows first: { u64 offset, u32 size, u32 encoding } for each tile
+ * ...                   tile data
+ *
+ * A tile holds the tightly packed rows of a tile_width x tile_height rectangle of the image
+ * (smaller on the right and bottom edges), either raw or run-length encoded.
+ * Tiles are encoded and decoded independently, in parallel; loading a region only reads
+ * the header, the index and the tiles overlapping that region.
+ *
+ * Run-length encoding works on pixels of the image type (1 byte for bitmaps, i.e. 8 pixels):
+ * a control byte c < 128 is followed by c+1 literal pixels; a control byte c >= 128 is followed
+ * by one pixel, repeated c-126 times. A tile is stored raw if encoding does not make it smaller.
+ * Pixel values are stored in host byte order.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "image_tiled.h"
+#include "utils.h"
+#include <omp.h>
+
+#define TILED_HEADER_SIZE 36
+#define TILED_ENTRY_SIZE 16
+
+/**
+ * @brief Store a 32-bit little-endian integer
+ */
+static void tiled_put_u32(uint8_t *p, uint32_t v)
+{
+    for (int i = 0; i < 4; ++i)
+    {
+        p[i] = v >> (8 * i);
+    }
+}
+
+/**
+ * @brief Load a 32-bit little-endian integer
+ */
+static uint32_t tiled_get_u32(const uint8_t *p)
+{
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+/**
+ * @brief Store a 64-bit little-endian integer
+ */
+static void tiled_put_u64(uint8_t *p, uint64_t v)
+{
+    tiled_put_u32(p, v);
+    tiled_put_u32(p + 4, v >> 32);
+}
+
+/**
+ * @brief Load a 64-bit little-endian integer
+ */
+static uint64_t tiled_get_u64(const uint8_t *p)
+{
+    return tiled_get_u32(p) | ((uint64_t)tiled_get_u32(p + 4) << 32);
+}
+
+/**
+ * @brief Size of the run-length encoding unit for an image type
+ * @param type image type
+ * @return element size (in bytes)
+ */
+static int tiled_element_size(image_type_t type)
+{
+    return (type == IMAGE_BITMAP) ? 1 : (int)image_row_bytes(1, type);
+}
+
+/**
+ * @brief Run-length encode an array of elements
+ * @param src elements
+ * @param n number of elements
+ * @param esz element size (in bytes)
+ * @param dst output buffer
+ * @param capacity size of dst (in bytes)
+ * @return encoded size (in bytes), 0 if the encoded data does not fit in dst
+ */
+static size_t tiled_rle_encode(const uint8_t *src, size_t n, int esz, uint8_t *dst, size_t capacity)
+{
+    size_t i = 0, out = 0;
+
+    while (i < n)
+    {
+        /* length of the run of identical elements starting at i */
+        size_t run = 1;
+        while (i + run < n && run < 129 && !memcmp(src + (i + run) * esz, src + i * esz, esz))
+        {
+            run++;
+        }
+
+        if (run >= 2)
+        {
+            if (out + 1 + esz > capacity)
+            {
+                return 0;
+            }
+            dst[out++] = 128 + (run - 2);
+            memcpy(dst + out, src + i * esz, esz);
+            out += esz;
+            i += run;
+        }
+        else
+        {
+            /* literal elements, until the next run of identical elements */
+            size_t start = i, len = 0;
+            while (i < n && len < 128 &&
+                !(i + 1 < n && !memcmp(src + (i + 1) * esz, src + i * esz, esz)))
+            {
+                i++;
+                len++;
+            }
+            if (out + 1 + len * esz > capacity)
+            {
+                return 0;
+            }
+            dst[out++] = len - 1;
+            memcpy(dst + out, src + start * esz, len * esz);
+            out += len * esz;
+        }
+    }
+    return out;
+}
+
+/**
+ * @brief Decode run-length encoded elements
+ * @param src encoded data
+ * @param size encoded size (in bytes)
+ * @param esz element size (in bytes)
+ * @param dst output buffer
+ * @param n expected number of elements
+ * @return 0 if success, -1 if data is corrupted
+ */
+static int tiled_rle_decode(const uint8_t *src, size_t size, int esz, uint8_t *dst, size_t n)
+{
+    size_t in = 0, i = 0;
+
+    while (in < size && i < n)
+    {
+        uint8_t c = src[in++];
+        if (c < 128)
+        {
+            size_t len = c + 1;
+            if (i + len > n || in + len * esz > size)
+            {
+                return -1;
+            }
+            memcpy(dst + i * esz, src + in, len * esz);
+            in += len * esz;
+            i += len;
+        }
+        else
+        {
+            size_t run = c - 126;
+            if (i + run > n || in + esz > size)
+            {
+                return -1;
+            }
+            for (size_t k = 0; k < run; ++k)
+            {
+                memcpy(dst + (i + k) * esz, src + in, esz);
+            }
+            in += esz;
+            i += run;
+        }
+    }
+    return (i == n) ? 0 : -1;
+}
+
+/**
+ * @brief Geometry of a tile
+ * @param info container header
+ * @param t tile index
+ * @param x0 (output) abscissa of the tile's upper-left pixel
+ * @param y0 (output) ordinate of the tile's upper-left pixel
+ * @param w (output) tile width
+ * @param h (output) tile height
+ */
+static void tiled_tile_rect(const image_tiled_info_t *info, int t, int *x0, int *y0, int *w, int *h)
+{
+    *x0 = (t % info->tiles_x) * info->tile_width;
+    *y0 = (t / info->tiles_x) * info->tile_height;
+    *w = MIN(info->tile_width, info->width - *x0);
+    *h = MIN(info->tile_height, info->height - *y0);
+}
+
+/**
+ * @fn int image_tiled_save(const image_t *self, const char *fname, int tile_width, int tile_height, int compress)
+ * @brief saves image data to a tiled container file
+ * @param self image object
+ * @param fname path to file
+ * @param tile_width tile width (in pixels); must be a multiple of 8
+ * @param tile_height tile height (in pixels)
+ * @param compress set to 1 to run-length encode tiles, 0 to store them raw
+ * @return 0 if success, -1 if failure
+ *
+ * Tiles are extracted (through image views) and encoded in parallel, then written sequentially.
+ */
+int image_tiled_save(const image_t *self, const char *fname, int tile_width, int tile_height, int compress)
+{
+    image_tiled_info_t info;
+    uint8_t **tile_data;
+    size_t *tile_size;
+    int *tile_encoding;
+    int num_tiles;
+    int t;
+    int res = 0;
+
+    assert(self && self->data);
+    assert(tile_width > 0 && tile_width % 8 == 0 && tile_height > 0);
+
+    info = (image_tiled_info_t){
+        .type = self->type,
+        .width = self->width,
+        .height = self->height,
+        .tile_width = tile_width,
+        .tile_height = tile_height,
+        .tiles_x = (self->width + tile_width - 1) / tile_width,
+        .tiles_y = (self->height + tile_height - 1) / tile_height};
+    num_tiles = info.tiles_x * info.tiles_y;
+    int esz = tiled_element_size(self->type);
+
+    tile_data = calloc(num_tiles, sizeof(uint8_t *));
+    tile_size = calloc(num_tiles, sizeof(size_t));
+    tile_encoding = calloc(num_tiles, sizeof(int));
+    assert(tile_data && tile_size && tile_encoding);
+
+    /* encode tiles in parallel */
+    #pragma omp parallel for schedule(dynamic)
+    for (t = 0; t < num_tiles; ++t)
+    {
+        int x0, y0, w, h;
+        tiled_tile_rect(&info, t, &x0, &y0, &w, &h);
+
+        image_t *tile = image_new_view(self, x0, y0, w, h);
+        assert(tile);
+        size_t row_bytes = image_row_bytes(w, self->type);
+        size_t raw_size = row_bytes * h;
+        uint8_t *raw = malloc(raw_size);
+        assert(raw);
+        for (int y = 0; y < h; ++y)
+        {
+            memcpy(raw + y * row_bytes, image_row(tile, y), row_bytes);
+        }
+        image_delete(tile);
+
+        tile_data[t] = raw;
+        tile_size[t] = raw_size;
+        tile_encoding[t] = IMAGE_TILE_RAW;
+
+        if (compress)
+        {
+            uint8_t *rle = malloc(raw_size);
+            assert(rle);
+            size_t rle_size = tiled_rle_encode(raw, raw_size / esz, esz, rle, raw_size - 1);
+            if (rle_size > 0)
+            {
+                free(raw);
+                tile_data[t] = rle;
+                tile_size[t] = rle_size;
+                tile_encoding[t] = IMAGE_TILE_RLE;
+            }
+            else
+            {
+                free(rle);
+            }
+        }
+    }
+
+    /* header and index */
+    size_t index_size = TILED_HEADER_SIZE + (size_t)num_tiles * TILED_ENTRY_SIZE;
+    uint8_t *index = calloc(1, index_size);
+    assert(index);
+    memcpy(index, IMAGE_TILED_MAGIC, 4);
+    tiled_put_u32(index + 4, IMAGE_TILED_VERSION);
+    tiled_put_u32(index + 8, info.type);
+    tiled_put_u32(index + 12, info.width);
+    tiled_put_u32(index + 16, info.height);
+    tiled_put_u32(index + 20, info.tile_width);
+    tiled_put_u32(index + 24, info.tile_height);
+    tiled_put_u32(index + 28, info.tiles_x);
+    tiled_put_u32(index + 32, info.tiles_y);
+
+    uint64_t offset = index_size;
+    for (t = 0; t < num_tiles; ++t)
+    {
+        uint8_t *entry = index + TILED_HEADER_SIZE + t * TILED_ENTRY_SIZE;
+        tiled_put_u64(entry, offset);
+        tiled_put_u32(entry + 8, tile_size[t]);
+        tiled_put_u32(entry + 12, tile_encoding[t]);
+        offset += tile_size[t];
+    }
+
+    FILE *fp = fopen(fname, "wb");
+    if (!fp)
+    {
+        fprintf(stderr, "Could not open file %s\n", fname);
+        res = -1;
+    }
+    else
+    {
+        fwrite(index, 1, index_size, fp);
+        for (t = 0; t < num_tiles; ++t)
+        {
+            fwrite(tile_data[t], 1, tile_size[t], fp);
+        }
+        res = ferror(fp) ? -1 : 0;
+        fclose(fp);
+    }
+
+    for (t = 0; t < num_tiles; ++t)
+    {
+        free(tile_data[t]);
+    }
+    free(index);
+    free(tile_data);
+    free(tile_size);
+    free(tile_encoding);
+    return res;
+}
+
+/**
+ * @brief Read the header of a tiled container from an open file
+ * @param fd file descriptor
+ * @param info (output) container header
+ * @return 0 if success, -1 if not a valid container
+ */
+static int tiled_read_info(int fd, image_tiled_info_t *info)
+{
+    uint8_t hdr[TILED_HEADER_SIZE];
+
+    if (pread(fd, hdr, sizeof(hdr), 0) != sizeof(hdr) ||
+        memcmp(hdr, IMAGE_TILED_MAGIC, 4) ||
+        tiled_get_u32(hdr + 4) != IMAGE_TILED_VERSION)
+    {
+        return -1;
+    }
+    info->type = tiled_get_u32(hdr + 8);
+    info->width = tiled_get_u32(hdr + 12);
+    info->height = tiled_get_u32(hdr + 16);
+    info->tile_width = tiled_get_u32(hdr + 20);
+    info->tile_height = tiled_get_u32(hdr + 24);
+    info->tiles_x = tiled_get_u32(hdr + 28);
+    info->tiles_y = tiled_get_u32(hdr + 32);
+
+    if (info->type > IMAGE_RGB_888 || info->width <= 0 || info->height <= 0 ||
+        info->tile_width <= 0 || info->tile_width % 8 || info->tile_height <= 0 ||
+        info->tiles_x != (info->width + info->tile_width - 1) / info->tile_width ||
+        info->tiles_y != (info->height + info->tile_height - 1) / info->tile_height)
+    {
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Read the header of a tiled container file
+ * @param fname path to file
+ * @param info (output) container header
+ * @return 0 if success, -1 if failure
+ */
+int image_tiled_info(const char *fname, image_tiled_info_t *info)
+{
+    int fd = open(fname, O_RDONLY);
+    if (fd < 0)
+    {
+        return -1;
+    }
+    int res = tiled_read_info(fd, info);
+    close(fd);
+    return res;
+}
+
+/**
+ * @fn image_t *image_tiled_load_region(const char *fname, int x, int y, int width, int height)
+ * @brief Image constructor; creates an image object from a rectangle of a tiled container file.
+ * @param fname path to file
+ * @param x abscissa of the upper-left pixel of the region
+ * @param y ordinate of the upper-left pixel of the region
+ * @param width region width
+ * @param height region height
+ * @return Handle of a new image object, NULL in case of failure.
+ *
+ * Only the tiles overlapping the region are read; they are read and decoded in parallel.
+ */
+image_t *image_tiled_load_region(const char *fname, int x, int y, int width, int height)
+{
+    image_tiled_info_t info;
+    image_t *self;
+    uint8_t *index;
+    int fd;
+    int k;
+    int failed = 0;
+
+    fd = open(fname, O_RDONLY);
+    if (fd < 0)
+    {
+        fprintf(stderr, "Failed to open file `%s`\n", fname);
+        return NULL;
+    }
+    if (tiled_read_info(fd, &info) != 0)
+    {
+        fprintf(stderr, "%s: not a tiled image container\n", fname);
+        close(fd);
+        return NULL;
+    }
+    assert(0 <= x && 0 < width && x + width <= info.width);
+    assert(0 <= y && 0 < height && y + height <= info.height);
+
+    size_t index_size = (size_t)info.tiles_x * info.tiles_y * TILED_ENTRY_SIZE;
+    index = malloc(index_size);
+    assert(index);
+    if (pread(fd, index, index_size, TILED_HEADER_SIZE) != (ssize_t)index_size)
+    {
+        free(index);
+        close(fd);
+        return NULL;
+    }
+
+    self = image_new(width, height, info.type);
+    assert(self);
+
+    /* range of tiles overlapping the region */
+    int tx0 = x / info.tile_width, tx1 = (x + width - 1) / info.tile_width;
+    int ty0 = y / info.tile_height, ty1 = (y + height - 1) / info.tile_height;
+    int num_cols = tx1 - tx0 + 1;
+    int num_overlap = num_cols * (ty1 - ty0 + 1);
+    int esz = tiled_element_size(info.type);
+
+    #pragma omp parallel for schedule(dynamic) reduction(|:failed)
+    for (k = 0; k < num_overlap; ++k)
+    {
+        int t = (ty0 + k / num_cols) * info.tiles_x + tx0 + k % num_cols;
+        const uint8_t *entry = index + t * TILED_ENTRY_SIZE;
+        uint64_t offset = tiled_get_u64(entry);
+        size_t size = tiled_get_u32(entry + 8);
+        int encoding = tiled_get_u32(entry + 12);
+
+        int x0, y0, w, h;
+        tiled_tile_rect(&info, t, &x0, &y0, &w, &h);
+        size_t row_bytes = image_row_bytes(w, info.type);
+        size_t raw_size = row_bytes * h;
+
+        uint8_t *buf = malloc(size);
+        uint8_t *raw = (encoding == IMAGE_TILE_RAW) ? buf : malloc(raw_size);
+        assert(buf && raw);
+        if (pread(fd, buf, size, offset) != (ssize_t)size ||
+            (encoding == IMAGE_TILE_RAW && size != raw_size) ||
+            (encoding == IMAGE_TILE_RLE && tiled_rle_decode(buf, size, esz, raw, raw_size / esz) != 0))
+        {
+            failed = 1;
+        }
+        else
+        {
+            /* copy the intersection of the tile and the region */
+            int ix0 = MAX(x, x0), ix1 = MIN(x + width, x0 + w);
+            int iy0 = MAX(y, y0), iy1 = MIN(y + height, y0 + h);
+            for (int yy = iy0; yy < iy1; ++yy)
+            {
+                const uint8_t *src = raw + (yy - y0) * row_bytes;
+                uint8_t *dst = image_row(self, yy - y);
+                if (info.type != IMAGE_BITMAP)
+                {
+                    memcpy(dst + esz * (ix0 - x), src + esz * (ix0 - x0), esz * (ix1 - ix0));
+                }
+                else if (x % 8 == 0)
+                {
+                    /* tile and region are byte-aligned: copy whole bytes */
+                    memcpy(dst + (ix0 - x) / 8, src + (ix0 - x0) / 8, (ix1 - ix0 + 7) / 8);
+                }
+                else
+                {
+                    for (int xx = ix0; xx < ix1; ++xx)
+                    {
+                        if (image_bmp_row_get(src, xx - x0))
+                        {
+                            /* neighbor tiles may share this byte */
+                            #pragma omp atomic update
+                            dst[(xx - x) >> 3] |= 0x80 >> ((xx - x) & 7);
+                        }
+                    }
+                }
+            }
+        }
+        if (raw != buf)
+        {
+            free(raw);
+        }
+        free(buf);
+    }
+
+    free(index);
+    close(fd);
+
+    if (failed)
+    {
+        fprintf(stderr, "%s: corrupted tile data\n", fname);
+        image_delete(self);
+        return NULL;
+    }
+    if (info.type == IMAGE_BITMAP)
+    {
+        /* the last byte copied may hold pixels beyond the region */
+        FOR_Y(self, yy)
+        {
+            image_row(self, yy)[(width - 1) / 8] &= (width % 8) ? (uint8_t)(0xFF << (8 - width % 8)) : 0xFF;
+        }
+    }
+    return self;
+}
+
+/**
+ * @fn image_t *image_tiled_load(const char *fname)
+ * @brief Image constructor; creates an image object from a whole tiled container file.
+ * @param fname path to file
+ * @return Handle of a new image object, NULL in case of failure.
+ */
+image_t *image_tiled_load(const char *fname)
+{
+    image_tiled_info_t info;
+    if (image_tiled_info(fname, &info) != 0)
+    {
+        fprintf(stderr, "%s: not a tiled image container\n", fname);
+        return NULL;
+    }
+    return image_tiled_load_region(fname, 0, 0, info.width, info.height);
+}
@@ -0,0 +1,746 @@
+/**
+ * @file image_tracking.c
+ * @brief Image processing library: tracking of connected components along a sequence of frames
+ * @author Saint-Cirgue Arnaud _ Correge Etienne
+ * @version 0.1
+ * @date november 2023
+ */
+
+/**
+ * Each frame is compared with the previous one row by row (bmp_row_equal(): whole words at once).
+ * Only regions (rectangles) around the changed pixels are labeled again. Components of the previous frame
+ * with pixels next to a change are "absorbed": regions grow to their bounding boxes, and they are labeled again.
+ * The other components are unchanged, and not even adjacent to a change: they keep their labels, table slots
+ * and identifiers, and are masked out (as background) of the copy of the region which is labeled.
+ *
+ * Components of the regions are matched with the components of the previous frame by overlap: region rows of both
+ * label maps are run-length encoded, and runs are intersected row by row. Pairs are then matched greedily,
+ * largest overlap first: an identifier passes to at most one component of the new frame (split: the largest
+ * part keeps it; merge: the identifier of the largest overlap is kept, the other ones are lost).
+ *
+ * Typical use:
+ *
+ *     ccl_sequence_t *seq = ccl_sequence_new(width, height);
+ *     for each frame: ccl_sequence_push(seq, frame); ... seq->tracks[0 .. seq->num_tracks-1] ...
+ *     ccl_sequence_delete(seq);
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include "image_tracking.h"
+#include "image_bitmap.h"
+#include "image_memory.h"
+#include "utils.h"
+#include <omp.h>
+
+/**
+ * @brief a run of pixels with the same tag in a label map row
+ */
+typedef struct
+{
+    int x1, x2;     /*!< pixels x1 .. x2-1 */
+    int tag;        /*!< tag of the run (not 0) */
+} seq_run_t;
+
+/**
+ * @brief overlap between a component of the new frame and a component of the previous frame
+ */
+typedef struct
+{
+    int cur;        /*!< component of the new frame (index + 1 in the regions' table) */
+    int prev;       /*!< component of the previous frame (index + 1 in the previous table) */
+    long overlap;   /*!< number of common pixels */
+} seq_pair_t;
+
+/**
+ * @brief a rectangle of pixels
+ */
+typedef struct
+{
+    int x1, y1;     /*!< upper-left pixel */
+    int x2, y2;     /*!< lower-right pixel (included) */
+} seq_rect_t;
+
+/**
+ * @brief Create the labeling state of a sequence of frames
+ * @param width frame width
+ * @param height frame height
+ * @return Handle of a new sequence, NULL if creation fails.
+ */
+ccl_sequence_t *ccl_sequence_new(int width, int height)
+{
+    ccl_sequence_t *self = calloc(1, sizeof(ccl_sequence_t));
+    if (!self)
+    {
+        return NULL;
+    }
+    self->width = width;
+    self->height = height;
+    self->bitmap = image_new(width, height, IMAGE_BITMAP);
+    self->tags = image_new(width, height, IMAGE_GRAYSCALE_16);
+    self->equiv_table = mem_track_malloc(MAX_TAGS * sizeof(int));
+    assert(self->bitmap && self->tags && self->equiv_table);
+    return self;
+}
+
+/**
+ * @brief Release a sequence, and its components table
+ * @param self a sequence
+ */
+void ccl_sequence_delete(ccl_sequence_t *self)
+{
+    image_delete(self->bitmap);
+    image_delete(self->tags);
+    mem_track_free(self->equiv_table, MAX_TAGS * sizeof(int));
+    mem_track_free(self->tracks, MAX(self->num_tracks, 1) * sizeof(ccl_track_t));
+    free(self);
+}
+
+/**
+ * @brief Run-length encode the rows of a label map
+ * @param tags label map (or a view of it)
+ * @param tag_offset added to the tags of the runs
+ * @param first_run (output) runs of row y are runs[first_run[y] .. first_run[y+1]-1]; height + 1 entries
+ * @return runs table (release with mem_track_free(), MAX(first_run[height], 1) entries)
+ *
+ * Runs are counted row by row in parallel, then a prefix sum gives the position of each row's runs.
+ */
+static seq_run_t *seq_encode(const image_t *tags, int tag_offset, int *first_run)
+{
+    first_run[0] = 0;
+
+    #pragma omp parallel for schedule(static)
+    for (int y = 0; y < tags->height; ++y)
+    {
+        const gs16_t *tag_row = image_gs16_row(tags, y);
+        int n = 0;
+        for (int x = 0; x < tags->width; ++x)
+        {
+            n += (tag_row[x] != 0) && (x == 0 || tag_row[x - 1] != tag_row[x]);
+        }
+        first_run[y + 1] = n;
+    }
+    for (int y = 0; y < tags->height; ++y)
+    {
+        first_run[y + 1] += first_run[y];
+    }
+
+    seq_run_t *runs = mem_track_malloc(MAX(first_run[tags->height], 1) * sizeof(seq_run_t));
+    assert(runs);
+
+    #pragma omp parallel for schedule(static)
+    for (int y = 0; y < tags->height; ++y)
+    {
+        const gs16_t *tag_row = image_gs16_row(tags, y);
+        seq_run_t *run = &runs[first_run[y]];
+        int x = 0;
+        while (x < tags->width)
+        {
+            int tag = tag_row[x];
+            int x1 = x;
+            while (x < tags->width && tag_row[x] == tag)
+            {
+                ++x;
+            }
+            if (tag != 0)
+            {
+                *run++ = (seq_run_t){.x1 = x1, .x2 = x, .tag = tag + tag_offset};
+            }
+        }
+    }
+    return runs;
+}
+
+/**
+ * @brief Intersect the runs of two label maps of the same rows, and append overlapping pairs
+ * @param height number of rows
+ * @param prev_first, prev_runs runs of the previous label map (see seq_encode())
+ * @param cur_first, cur_runs runs of the new label map
+ * @param pairs (input/output) table of pairs, reallocated as needed
+ * @param num_pairs (input/output) number of pairs
+ *
+ * Pairs may appear several times (once per row, at most); see seq_reduce_pairs().
+ */
+static void seq_overlap(
+    int height,
+    const int *prev_first, const seq_run_t *prev_runs,
+    const int *cur_first, const seq_run_t *cur_runs,
+    seq_pair_t **pairs, int *num_pairs)
+{
+    #pragma omp parallel
+    {
+        seq_pair_t *local = NULL;
+        int num_local = 0;
+        int capacity = 0;
+
+        #pragma omp for schedule(static)
+        for (int y = 0; y < height; ++y)
+        {
+            int i = prev_first[y];
+            int j = cur_first[y];
+            while (i < prev_first[y + 1] && j < cur_first[y + 1])
+            {
+                const seq_run_t *a = &prev_runs[i];
+                const seq_run_t *b = &cur_runs[j];
+                int len = MIN(a->x2, b->x2) - MAX(a->x1, b->x1);
+                if (len > 0)
+                {
+                    if (num_local > 0 && local[num_local - 1].cur == b->tag && local[num_local - 1].prev == a->tag)
+                    {
+                        local[num_local - 1].overlap += len;
+                    }
+                    else
+                    {
+                        if (num_local == capacity)
+                        {
+                            local = mem_track_realloc(local, capacity * sizeof(seq_pair_t), (2 * capacity + 64) * sizeof(seq_pair_t));
+                            assert(local);
+                            capacity = 2 * capacity + 64;
+                        }
+                        local[num_local++] = (seq_pair_t){.cur = b->tag, .prev = a->tag, .overlap = len};
+                    }
+                }
+                /* move past the run that ends first */
+                if (a->x2 < b->x2)
+                {
+                    ++i;
+                }
+                else
+                {
+                    ++j;
+                }
+            }
+        }
+
+        if (num_local > 0)
+        {
+            #pragma omp critical
+            {
+                *pairs = mem_track_realloc(*pairs, *num_pairs * sizeof(seq_pair_t), (*num_pairs + num_local) * sizeof(seq_pair_t));
+                assert(*pairs);
+                memcpy(*pairs + *num_pairs, local, num_local * sizeof(seq_pair_t));
+                *num_pairs += num_local;
+            }
+        }
+        mem_track_free(local, capacity * sizeof(seq_pair_t));
+    }
+}
+
+/**
+ * @brief qsort() comparison of pairs, by components
+ */
+static int seq_compare_components(const void *a, const void *b)
+{
+    const seq_pair_t *p = a, *q = b;
+    if (p->cur != q->cur)
+    {
+        return (p->cur < q->cur) ? -1 : 1;
+    }
+    return (p->prev > q->prev) - (p->prev < q->prev);
+}
+
+/**
+ * @brief qsort() comparison of pairs, by decreasing overlap (then by components, for reproducible results)
+ */
+static int seq_compare_overlaps(const void *a, const void *b)
+{
+    const seq_pair_t *p = a, *q = b;
+    if (p->overlap != q->overlap)
+    {
+        return (p->overlap > q->overlap) ? -1 : 1;
+    }
+    return seq_compare_components(a, b);
+}
+
+/**
+ * @brief Sum the overlaps of identical pairs, then sort pairs by decreasing overlap
+ * @param pairs table of pairs
+ * @param num_pairs number of pairs
+ * @return number of distinct pairs
+ */
+static int seq_reduce_pairs(seq_pair_t *pairs, int num_pairs)
+{
+    int n = 0;
+
+    qsort(pairs, num_pairs, sizeof(seq_pair_t), seq_compare_components);
+    for (int i = 0; i < num_pairs; ++i)
+    {
+        if (n > 0 && pairs[n - 1].cur == pairs[i].cur && pairs[n - 1].prev == pairs[i].prev)
+        {
+            pairs[n - 1].overlap += pairs[i].overlap;
+        }
+        else
+        {
+            pairs[n++] = pairs[i];
+        }
+    }
+    qsort(pairs, n, sizeof(seq_pair_t), seq_compare_overlaps);
+    return n;
+}
+
+/**
+ * @brief Whether two rectangles overlap or are side by side (a component may then cross from one to the other)
+ */
+static bool seq_rects_touch(const seq_rect_t *a, const seq_rect_t *b)
+{
+    return a->x1 <= b->x2 + 1 && b->x1 <= a->x2 + 1 && a->y1 <= b->y2 + 1 && b->y1 <= a->y2 + 1;
+}
+
+/**
+ * @brief Grow a rectangle to include another one
+ */
+static void seq_rect_union(seq_rect_t *self, const seq_rect_t *other)
+{
+    self->x1 = MIN(self->x1, other->x1);
+    self->y1 = MIN(self->y1, other->y1);
+    self->x2 = MAX(self->x2, other->x2);
+    self->y2 = MAX(self->y2, other->y2);
+}
+
+/**
+ * @brief Find the regions to label again: changed pixels and their neighbours, and whole absorbed components
+ * @param self a sequence, with the previous frame
+ * @param frame the new frame (binary)
+ * @param rects (output) regions, at most self->height
+ * @param absorbed (output) 1 for each component of the previous frame to label again
+ * @return number of regions
+ *
+ * Changed columns of a row are found from the first and last differing bytes. Regions are then grown to
+ * the bounding boxes of absorbed components, aligned on bytes (bitmap rows are copied bytewise),
+ * and merged when they touch (a component may cross from one to the other).
+ */
+static int seq_find_regions(const ccl_sequence_t *self, const image_t *frame, seq_rect_t *rects, uint8_t *absorbed)
+{
+    int width = self->width;
+    int height = self->height;
+    int n = 0;
+
+    if (self->num_frames == 0 ||
+        image_bmp_row_get(image_row(frame, 0), 0) != image_bmp_row_get(image_row(self->bitmap, 0), 0))
+    {
+        /* first frame, or the background color changed: label everything */
+        rects[0] = (seq_rect_t){.x1 = 0, .y1 = 0, .x2 = width - 1, .y2 = height - 1};
+        memset(absorbed, 1, self->num_tracks);
+        return 1;
+    }
+    memset(absorbed, 0, self->num_tracks);
+
+    /* changed columns of each row; empty (x1 > x2) if the row did not change */
+    seq_rect_t *changes = mem_track_malloc(height * sizeof(seq_rect_t));
+    assert(changes);
+    int num_bytes = image_row_bytes(width, IMAGE_BITMAP);
+
+    #pragma omp parallel for schedule(static)
+    for (int y = 0; y < height; ++y)
+    {
+        const uint8_t *a = image_row(frame, y);
+        const uint8_t *b = image_row(self->bitmap, y);
+        changes[y] = (seq_rect_t){.x1 = 1, .y1 = y, .x2 = 0, .y2 = y};
+        if (!bmp_row_equal(a, b, width))
+        {
+            int i = 0, j = num_bytes - 1;
+            while (a[i] == b[i])
+            {
+                ++i;
+            }
+            while (a[j] == b[j])
+            {
+                --j;
+            }
+            changes[y].x1 = 8 * i;
+            changes[y].x2 = MIN(8 * j + 7, width - 1);
+        }
+    }
+
+    /* changed pixels and their neighbours (4-connectivity); rows of one moving shape make one region */
+    for (int y = 0; y < height; ++y)
+    {
+        if (changes[y].x1 <= changes[y].x2)
+        {
+            seq_rect_t r = {
+                .x1 = MAX(changes[y].x1 - 1, 0), .y1 = MAX(y - 1, 0),
+                .x2 = MIN(changes[y].x2 + 1, width - 1), .y2 = MIN(y + 1, height - 1)};
+            if (n > 0 && seq_rects_touch(&rects[n - 1], &r))
+            {
+                seq_rect_union(&rects[n - 1], &r);
+            }
+            else
+            {
+                rects[n++] = r;
+            }
+        }
+    }
+    mem_track_free(changes, height * sizeof(seq_rect_t));
+
+    /* components with pixels next to a change */
+    for (int r = 0; r < n; ++r)
+    {
+        seq_rect_t box = rects[r];
+        for (int y = box.y1; y <= box.y2; ++y)
+        {
+            const gs16_t *tag_row = image_gs16_row(self->tags, y);
+            for (int x = box.x1; x <= box.x2; ++x)
+            {
+                int i = tag_row[x] - 1;
+                if (i >= 0 && !absorbed[i])
+                {
+                    const image_connected_component_t *cc = &self->tracks[i].cc;
+                    seq_rect_union(&rects[r], &(seq_rect_t){.x1 = cc->x1, .y1 = cc->y1, .x2 = cc->x2, .y2 = cc->y2});
+                    absorbed[i] = 1;
+                }
+            }
+        }
+        rects[r].x1 &= ~7;
+        rects[r].x2 = MIN(rects[r].x2 | 7, width - 1);
+    }
+
+    /* a grown region may touch regions already examined: repeat until no merge */
+    bool merged = true;
+    while (merged)
+    {
+        merged = false;
+        for (int a = 0; a < n; ++a)
+        {
+            for (int b = a + 1; b < n; ++b)
+            {
+                if (seq_rects_touch(&rects[a], &rects[b]))
+                {
+                    seq_rect_union(&rects[a], &rects[b]);
+                    rects[b] = rects[--n];
+                    b = a;
+                    merged = true;
+                }
+            }
+        }
+    }
+    return n;
+}
+
+/**
+ * @brief Copy a region of the frame to label: components kept from the previous frame become background
+ * @param self a sequence, with the previous labels
+ * @param frame the new frame (binary)
+ * @param rect region (columns aligned on bytes)
+ * @param absorbed 1 for each component of the previous frame to label again
+ * @return bitmap of the region, below a row of background (labeling takes the top-left pixel as background)
+ */
+static image_t *seq_region_bitmap(const ccl_sequence_t *self, const image_t *frame, const seq_rect_t *rect, const uint8_t *absorbed)
+{
+    int width = rect->x2 - rect->x1 + 1;
+    int num_rows = rect->y2 - rect->y1 + 1;
+    int byte1 = rect->x1 / 8;
+    int num_bytes = image_row_bytes(width, IMAGE_BITMAP);
+    bool bg_color = image_bmp_row_get(image_row(frame, 0), 0);
+    image_t *pixels = image_new(width, num_rows + 1, IMAGE_BITMAP);
+    assert(pixels);
+
+    memset(image_row(pixels, 0), bg_color ? 0xff : 0, num_bytes);
+    bmp_row_clear_padding(image_row(pixels, 0), width);
+
+    #pragma omp parallel for schedule(static)
+    for (int y = 0; y < num_rows; ++y)
+    {
+        uint8_t *row = image_row(pixels, y + 1);
+        const gs16_t *tag_row = image_gs16_row(self->tags, rect->y1 + y) + rect->x1;
+        memcpy(row, image_row(frame, rect->y1 + y) + byte1, num_bytes);
+        bmp_row_clear_padding(row, width);
+        for (int x = 0; x < width; ++x)
+        {
+            if (tag_row[x] > 0 && !absorbed[tag_row[x] - 1])
+            {
+                image_bmp_row_set(row, x, bg_color);
+            }
+        }
+    }
+    return pixels;
+}
+
+/**
+ * @brief Replace one tag by another one
+ * @param tags label map (or a view of it)
+ * @param tag tag to replace
+ * @param new_tag replacement
+ */
+static void seq_replace_tag(image_t *tags, int tag, int new_tag)
+{
+    #pragma omp parallel for schedule(static)
+    for (int y = 0; y < tags->height; ++y)
+    {
+        gs16_t *tag_row = image_gs16_row(tags, y);
+        for (int x = 0; x < tags->width; ++x)
+        {
+            tag_row[x] = (tag_row[x] == tag) ? new_tag : tag_row[x];
+        }
+    }
+}
+
+/**
+ * @brief Label a new frame, and match its components with the previous frame's ones
+ * @param self a sequence
+ * @param frame the new frame: a bitmap, or a grayscale or color image (binarized with the default settings,
+ *  see image_threshold_default_options()), with the dimensions of the sequence
+ * @return the number of connected components (self->num_tracks), -1 if the frame dimensions differ or if
+ *  the components need more than MAX_TAGS - 1 labels (the sequence is then left as it was)
+ *
+ * After the call, self->tracks holds the components of the frame with their identifiers,
+ * and self->tags the label map (index in self->tracks + 1). Unchanged components keep their index.
+ */
+int ccl_sequence_push(ccl_sequence_t *self, const image_t *frame)
+{
+    image_t *bitmap = NULL;
+    int height = self->height;
+
+    assert(self && frame);
+    if (frame->width != self->width || frame->height != self->height)
+    {
+        DEBUG_PRINT("Frame of %dx%d pixels, sequence of %dx%d pixels", frame->width, frame->height, self->width, self->height);
+        return -1;
+    }
+    if (frame->type != IMAGE_BITMAP)
+    {
+        bitmap = image_new_threshold(frame, NULL);
+        assert(bitmap);
+        frame = bitmap;
+    }
+
+    ccl_track_t *prev = self->tracks;
+    int num_prev = self->num_tracks;
+    seq_rect_t *rects = mem_track_malloc(height * sizeof(seq_rect_t));
+    uint8_t *absorbed = mem_track_malloc(MAX(num_prev, 1));
+    assert(rects && absorbed);
+
+    /* ~~~~~~~~~~ Frame differencing: regions to label again ~~~~~~~~~~ */
+    int num_regions = seq_find_regions(self, frame, rects, absorbed);
+    image_t **region_tags = mem_track_calloc(MAX(num_regions, 1), sizeof(image_t *));
+    int *region_num_cc = mem_track_malloc(MAX(num_regions, 1) * sizeof(int));
+    assert(region_tags && region_num_cc);
+
+    /* ~~~~~~~~~~ Label each region, and intersect it with the previous labels ~~~~~~~~~~ */
+    image_connected_component_t *region_cc = NULL;
+    int num_region_cc = 0;
+    int cc_capacity = 0;
+    seq_pair_t *pairs = NULL;
+    int num_pairs = 0;
+    bool overflow = false;
+    self->relabeled_pixels = 0;
+
+    for (int r = 0; r < num_regions; ++r)
+    {
+        int x1 = rects[r].x1, y1 = rects[r].y1;
+        int width = rects[r].x2 - x1 + 1;
+        int num_rows = rects[r].y2 - y1 + 1;
+        image_t *pixels = seq_region_bitmap(self, frame, &rects[r], absorbed);
+        region_tags[r] = image_new(width, num_rows + 1, IMAGE_GRAYSCALE_16);
+        assert(region_tags[r]);
+
+        int num_cc = ccl_label(pixels, region_tags[r], self->equiv_table);
+        image_delete(pixels);
+        if (num_cc < 0)
+        {
+            overflow = true;
+            break;
+        }
+
+        /* region rows, without the background row */
+        image_t *tags = image_new_view(region_tags[r], 0, 1, width, num_rows);
+        assert(tags);
+        region_cc = mem_track_realloc(region_cc, cc_capacity * sizeof(image_connected_component_t),
+            MAX(num_region_cc + num_cc, 1) * sizeof(image_connected_component_t));
+        assert(region_cc);
+        cc_capacity = MAX(num_region_cc + num_cc, 1);
+        memset(region_cc + num_region_cc, 0, num_cc * sizeof(image_connected_component_t));
+        ccl_analyze(tags, region_cc + num_region_cc, num_cc);
+        for (int t = num_region_cc; t < num_region_cc + num_cc; ++t)
+        {
+            region_cc[t].x1 += x1;
+            region_cc[t].x2 += x1;
+            region_cc[t].y1 += y1;
+            region_cc[t].y2 += y1;
+        }
+
+        if (self->num_frames > 0)
+        {
+            image_t *prev_tags = image_new_view(self->tags, x1, y1, width, num_rows);
+            int *prev_first = mem_track_malloc((num_rows + 1) * sizeof(int));
+            int *cur_first = mem_track_malloc((num_rows + 1) * sizeof(int));
+            assert(prev_tags && prev_first && cur_first);
+            seq_run_t *prev_runs = seq_encode(prev_tags, 0, prev_first);
+            seq_run_t *cur_runs = seq_encode(tags, num_region_cc, cur_first);
+            seq_overlap(num_rows, prev_first, prev_runs, cur_first, cur_runs, &pairs, &num_pairs);
+            mem_track_free(cur_runs, MAX(cur_first[num_rows], 1) * sizeof(seq_run_t));
+            mem_track_free(prev_runs, MAX(prev_first[num_rows], 1) * sizeof(seq_run_t));
+            mem_track_free(cur_first, (num_rows + 1) * sizeof(int));
+            mem_track_free(prev_first, (num_rows + 1) * sizeof(int));
+            image_delete(prev_tags);
+        }
+        image_delete(tags);
+
+        /* region tags: 1..num_cc, renumbered below */
+        region_num_cc[r] = num_cc;
+        num_region_cc += num_cc;
+        self->relabeled_pixels += (long)width * num_rows;
+    }
+    self->num_regions = num_regions;
+
+    int num_kept = 0;
+    for (int i = 0; i < num_prev; ++i)
+    {
+        num_kept += !absorbed[i];
+    }
+    if (overflow || num_kept + num_region_cc >= MAX_TAGS)
+    {
+        /* labels do not fit in 16 bits: the sequence is left as it was before this frame */
+        DEBUG_PRINT("Too many connected components: more than %d", MAX_TAGS - 1);
+        for (int r = 0; r < num_regions; ++r)
+        {
+            if (region_tags[r])
+            {
+                image_delete(region_tags[r]);
+            }
+        }
+        mem_track_free(pairs, num_pairs * sizeof(seq_pair_t));
+        mem_track_free(region_cc, cc_capacity * sizeof(image_connected_component_t));
+        mem_track_free(region_num_cc, MAX(num_regions, 1) * sizeof(int));
+        mem_track_free(region_tags, MAX(num_regions, 1) * sizeof(image_t *));
+        mem_track_free(absorbed, MAX(num_prev, 1));
+        mem_track_free(rects, height * sizeof(seq_rect_t));
+        if (bitmap)
+        {
+            image_delete(bitmap);
+        }
+        return -1;
+    }
+
+    /* ~~~~~~~~~~ Match region components with the previous ones, largest overlaps first ~~~~~~~~~~ */
+    int pairs_capacity = num_pairs;
+    num_pairs = seq_reduce_pairs(pairs, num_pairs);
+    int *match = mem_track_calloc(num_region_cc + 1, sizeof(int));
+    uint8_t *matched = mem_track_calloc(num_prev + 1, sizeof(uint8_t));
+    assert(match && matched);
+    for (int i = 0; i < num_pairs; ++i)
+    {
+        /* masked components have no pixels in the new labels, hence no pairs */
+        if (!match[pairs[i].cur] && !matched[pairs[i].prev])
+        {
+            match[pairs[i].cur] = pairs[i].prev;
+            matched[pairs[i].prev] = 1;
+        }
+    }
+
+    /* ~~~~~~~~~~ New components table ~~~~~~~~~~ */
+    /* kept components keep their slot; region components take the freed slots, then are appended;
+       if fewer, the last kept components move down to fill the remaining free slots */
+    int num_tracks = num_kept + num_region_cc;
+    ccl_track_t *tracks = mem_track_malloc(MAX(num_tracks, 1) * sizeof(ccl_track_t));
+    int *renum = mem_track_calloc(num_region_cc + 1, sizeof(int));
+    assert(tracks && renum);
+
+    for (int i = 0; i < MIN(num_prev, num_tracks); ++i)
+    {
+        if (!absorbed[i])
+        {
+            tracks[i] = (ccl_track_t){.id = prev[i].id, .age = prev[i].age + 1, .prev = i, .cc = prev[i].cc};
+        }
+    }
+    int free_slot = 0;
+    self->num_new = 0;
+    for (int t = 1; t <= num_region_cc; ++t)
+    {
+        while (free_slot < num_prev && !absorbed[free_slot])
+        {
+            ++free_slot;
+        }
+        int slot = (free_slot < num_prev) ? free_slot++ : num_kept + t - 1;
+        int p = match[t];
+        if (p > 0)
+        {
+            tracks[slot] = (ccl_track_t){.id = prev[p - 1].id, .age = prev[p - 1].age + 1, .prev = p - 1, .cc = region_cc[t - 1]};
+        }
+        else
+        {
+            tracks[slot] = (ccl_track_t){.id = self->next_id++, .age = 1, .prev = -1, .cc = region_cc[t - 1]};
+            self->num_new++;
+        }
+        renum[t] = slot + 1;
+    }
+    self->num_lost = 0;
+    for (int i = 0; i < num_prev; ++i)
+    {
+        self->num_lost += absorbed[i] && !matched[i + 1];
+    }
+
+    /* ~~~~~~~~~~ Label map of the regions, and previous frame for the next differencing ~~~~~~~~~~ */
+    int first_tag = 0;
+    for (int r = 0; r < num_regions; ++r)
+    {
+        const seq_rect_t *rect = &rects[r];
+        const int *region_renum = renum + first_tag;
+
+        #pragma omp parallel for schedule(static)
+        for (int y = rect->y1; y <= rect->y2; ++y)
+        {
+            gs16_t *tag_row = image_gs16_row(self->tags, y);
+            const gs16_t *new_row = image_gs16_row(region_tags[r], y - rect->y1 + 1);
+            for (int x = rect->x1; x <= rect->x2; ++x)
+            {
+                int t = tag_row[x];
+                /* kept components were masked out */
+                if (t == 0 || absorbed[t - 1])
+                {
+                    int new_tag = new_row[x - rect->x1];
+                    tag_row[x] = (new_tag > 0) ? region_renum[new_tag] : 0;
+                }
+            }
+            memcpy(image_row(self->bitmap, y) + rect->x1 / 8, image_row(frame, y) + rect->x1 / 8,
+                image_row_bytes(rect->x2 - rect->x1 + 1, IMAGE_BITMAP));
+        }
+        first_tag += region_num_cc[r];
+        image_delete(region_tags[r]);
+    }
+
+    int last = num_prev - 1;
+    for (int hole = free_slot; hole < MIN(num_prev, num_tracks); ++hole)
+    {
+        if (!absorbed[hole])
+        {
+            continue;
+        }
+        while (absorbed[last])
+        {
+            --last;
+        }
+        assert(last >= num_tracks);
+        tracks[hole] = (ccl_track_t){.id = prev[last].id, .age = prev[last].age + 1, .prev = last, .cc = prev[last].cc};
+
+        /* the component's pixels are within its bounding box; other labels there are final (at most num_tracks) */
+        const image_connected_component_t *cc = &prev[last].cc;
+        image_t *tags = image_new_view(self->tags, cc->x1, cc->y1, cc->x2 - cc->x1 + 1, cc->y2 - cc->y1 + 1);
+        assert(tags);
+        seq_replace_tag(tags, last + 1, hole + 1);
+        image_delete(tags);
+        --last;
+    }
+
+    mem_track_free(renum, (num_region_cc + 1) * sizeof(int));
+    mem_track_free(matched, (num_prev + 1) * sizeof(uint8_t));
+    mem_track_free(match, (num_region_cc + 1) * sizeof(int));
+    mem_track_free(pairs, pairs_capacity * sizeof(seq_pair_t));
+    mem_track_free(region_cc, cc_capacity * sizeof(image_connected_component_t));
+    mem_track_free(region_num_cc, MAX(num_regions, 1) * sizeof(int));
+    mem_track_free(region_tags, MAX(num_regions, 1) * sizeof(image_t *));
+    mem_track_free(absorbed, MAX(num_prev, 1));
+    mem_track_free(rects, height * sizeof(seq_rect_t));
+    mem_track_free(prev, MAX(num_prev, 1) * sizeof(ccl_track_t));
+    if (bitmap)
+    {
+        image_delete(bitmap);
+    }
+
+    self->tracks = tracks;
+    self->num_tracks = num_tracks;
+    self->num_frames++;
+    return num_tracks;
+}
@@ -0,0 +1,299 @@
+/**
+ * @file image_tuning.c
+ * @brief Image processing library: auto-tuning of connected components labeling parameters
+ * @author Saint-Cirgue Arnaud _ Correge Etienne
+ * @version 0.1
+ * @date november 2023
+ */
+
+/**
+ * Calibration labels synthetic images of a few sizes and foreground densities with each
+ * configuration (thread count, first pass variant, strips and analysis sections per thread),
+ * and keeps the fastest one per image class in a profile. A profile is a small text file:
+ *
+ *     # num_pixels density threads variant strips_per_thread sections_per_thread time
+ *     1048576 0.20 4 strips 2 1 0.001234
+ *
+ * Once loaded, the profile is consulted by ccl_label() and image_connected_components():
+ * the entry with the nearest size (in log scale), then the nearest density, gives the parameters.
+ */
+
+#include <math.h>
+#include <omp.h>
+
+#include "image_tuning.h"
+#include "image_bitmap.h"
+
+/**
+ * @brief loaded profile
+ */
+static ccl_profile_entry_t profile[CCL_PROFILE_MAX_ENTRIES];
+static int profile_size = 0;
+
+/**
+ * @brief Estimate the fraction of foreground pixels of a bitmap, from a sample of rows
+ * @param self a bitmap image
+ * @return fraction of pixels differing from the top-left (background) pixel
+ */
+float ccl_sample_density(const image_t *self)
+{
+    assert(self && self->type == IMAGE_BITMAP);
+    int num_rows = MIN(self->height, 64);
+    int nbytes = (self->width + 7) / 8;
+    long ones = 0;
+
+    for (int i = 0; i < num_rows; ++i)
+    {
+        const uint8_t *row = image_row(self, (long)self->height * i / num_rows);
+        for (int b = 0; b < nbytes; ++b)
+        {
+            /* padding bits are clear */
+            ones += __builtin_popcount(row[b]);
+        }
+    }
+    float density = (float)ones / ((float)num_rows * self->width);
+    return image_bmp_row_get(image_row(self, 0), 0) ? 1.0f - density : density;
+}
+
+/**
+ * @brief Name of a first pass variant, in profiles
+ */
+static const char *tuning_variant_name(ccl_variant_t variant)
+{
+    return (variant == CCL_TEMP_TAG_ROWS) ? "rows" : "strips";
+}
+
+/**
+ * @brief Load a profile; it replaces the current one
+ * @param fname path of the profile
+ * @return number of entries, -1 if the file cannot be read
+ */
+int ccl_profile_load(const char *fname)
+{
+    FILE *fp = fopen(fname, "r");
+    char line[256], variant[16];
+
+    if (!fp)
+    {
+        return -1;
+    }
+    profile_size = 0;
+    while (profile_size < CCL_PROFILE_MAX_ENTRIES && fgets(line, sizeof(line), fp))
+    {
+        ccl_profile_entry_t e;
+        if (line[0] == '#' ||
+            sscanf(line, "%ld %f %d %15s %d %d %lf", &e.num_pixels, &e.density, &e.params.num_threads,
+                variant, &e.params.strips_per_thread, &e.params.sections_per_thread, &e.time) != 7)
+        {
+            continue;
+        }
+        e.params.variant = strcmp(variant, "rows") ? CCL_TEMP_TAG_STRIPS : CCL_TEMP_TAG_ROWS;
+        profile[profile_size++] = e;
+    }
+    fclose(fp);
+    DEBUG_PRINT("Loaded %d profile entries from `%s`", profile_size, fname);
+    return profile_size;
+}
+
+/**
+ * @brief Save the current profile
+ * @param fname path of the profile
+ * @return 0 if success, -1 if failure
+ */
+int ccl_profile_save(const char *fname)
+{
+    FILE *fp = fopen(fname, "w");
+    if (!fp)
+    {
+        return -1;
+    }
+    fprintf(fp, "# num_pixels density threads variant strips_per_thread sections_per_thread time\n");
+    for (int i = 0; i < profile_size; ++i)
+    {
+        const ccl_profile_entry_t *e = &profile[i];
+        fprintf(fp, "%ld %.3f %d %s %d %d %.6f\n", e->num_pixels, e->density, e->params.num_threads,
+            tuning_variant_name(e->params.variant), e->params.strips_per_thread, e->params.sections_per_thread, e->time);
+    }
+    return fclose(fp) ? -1 : 0;
+}
+
+/**
+ * @brief Labeling parameters for an image: those of the nearest profile entry, or the defaults
+ * @param self a bitmap image
+ * @return parameters
+ */
+ccl_params_t ccl_profile_lookup(const image_t *self)
+{
+    if (profile_size == 0)
+    {
+        return ccl_default_params();
+    }
+
+    double log_pixels = log((double)self->width * self->height);
+    float density = ccl_sample_density(self);
+    int best = 0;
+    double best_distance = INFINITY;
+    for (int i = 0; i < profile_size; ++i)
+    {
+        /* size first: densities only separate entries of the same size */
+        double distance = 100.0 * fabs(log((double)profile[i].num_pixels) - log_pixels) + fabs(profile[i].density - density);
+        if (distance < best_distance)
+        {
+            best_distance = distance;
+            best = i;
+        }
+    }
+    return profile[best].params;
+}
+
+/**
+ * @brief Draw a synthetic bitmap: random discs, up to given foreground density
+ * @param width image width
+ * @param height image height
+ * @param density target fraction of foreground (black) pixels
+ * @return Handle of a new bitmap image
+ */
+static image_t *tuning_new_image(int width, int height, float density)
+{
+    image_t *self = image_new(width, height, IMAGE_BITMAP);
+    assert(self);
+    for (int y = 0; y < height; ++y)
+    {
+        memset(image_row(self, y), 0, image_row_bytes(width, IMAGE_BITMAP));
+    }
+
+    /* a few thousand discs, so that tags fit in 16 bits */
+    double area = (double)width * height * density;
+    int radius = MAX(2, (int)sqrt(area / (M_PI * 2000)));
+    int num_discs = area / (M_PI * radius * radius);
+    unsigned int seed = 12345;
+
+    for (int d = 0; d < num_discs; ++d)
+    {
+        int cx = rand_r(&seed) % width, cy = rand_r(&seed) % height;
+        for (int y = MAX(cy - radius, 1); y <= MIN(cy + radius, height - 1); ++y)
+        {
+            uint8_t *row = image_row(self, y);
+            int dx = (int)sqrt((double)radius * radius - (double)(y - cy) * (y - cy));
+            for (int x = MAX(cx - dx, 1); x <= MIN(cx + dx, width - 1); ++x)
+            {
+                image_bmp_row_set(row, x, 1);
+            }
+        }
+    }
+    return self;
+}
+
+/**
+ * @brief Measure labeling and analysis with given parameters (best of 3 runs)
+ * @param img input image
+ * @param tags tags image
+ * @param equiv_table equivalence table
+ * @param params parameters
+ * @param num_cc (output) number of connected components, -1 if the image needs too many tags
+ * @return time (in seconds), INFINITY if labeling fails
+ */
+static double tuning_measure(const image_t *img, image_t *tags, int *equiv_table, const ccl_params_t *params, int *num_cc)
+{
+    double best = INFINITY;
+    omp_set_num_threads(params->num_threads);
+    for (int run = 0; run < 3; ++run)
+    {
+        double t0 = omp_get_wtime();
+        *num_cc = ccl_label_params(img, tags, equiv_table, params);
+        if (*num_cc < 0)
+        {
+            return INFINITY;
+        }
+        image_connected_component_t *con_cmp = calloc(MAX(*num_cc, 1), sizeof(image_connected_component_t));
+        assert(con_cmp);
+        ccl_analyze_sections(tags, con_cmp, *num_cc, params->num_threads * params->sections_per_thread);
+        best = MIN(best, omp_get_wtime() - t0);
+        free(con_cmp);
+    }
+    return best;
+}
+
+/**
+ * @brief Benchmark labeling configurations on synthetic images, and save the best ones as a profile
+ * @param max_threads largest number of threads to try
+ * @param fname path of the profile to write
+ * @return number of profile entries, -1 if the profile cannot be written
+ *
+ * Thread counts are powers of 2 up to max_threads (and max_threads itself). The rows variant is only
+ * tried with one thread, where it is exact. A configuration finding a different number of connected
+ * components than the single-threaded reference is discarded.
+ */
+int ccl_calibrate(int max_threads, const char *fname)
+{
+    static const int sizes[] = {256, 512, 1024, 2048};
+    static const float densities[] = {0.05f, 0.2f, 0.5f};
+    static const int strips_per_thread[] = {1, 2, 4, 8};
+    static const int sections_per_thread[] = {1, 2, 4};
+    int saved_threads = omp_get_max_threads();
+    int *equiv_table = malloc(MAX_TAGS * sizeof(int));
+    assert(equiv_table);
+
+    max_threads = LIMIT(max_threads, 1, CCL_MAX_THREADS);
+    profile_size = 0;
+
+    for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); ++i)
+    {
+        for (size_t j = 0; j < sizeof(densities) / sizeof(densities[0]); ++j)
+        {
+            image_t *img = tuning_new_image(sizes[i], sizes[i], densities[j]);
+            image_t *tags = image_new(img->width, img->height, IMAGE_GRAYSCALE_16);
+            assert(tags);
+
+            /* reference: sequential rows variant */
+            ccl_profile_entry_t best = {
+                .num_pixels = (long)img->width * img->height,
+                .density = ccl_sample_density(img),
+                .params = {.num_threads = 1, .variant = CCL_TEMP_TAG_ROWS, .strips_per_thread = 1, .sections_per_thread = 1}};
+            int ref_cc, num_cc;
+            best.time = tuning_measure(img, tags, equiv_table, &best.params, &ref_cc);
+
+            for (int threads = 1; ; threads = MIN(2 * threads, max_threads))
+            {
+                for (size_t k = 0; k < sizeof(strips_per_thread) / sizeof(strips_per_thread[0]); ++k)
+                {
+                    for (size_t l = 0; l < sizeof(sections_per_thread) / sizeof(sections_per_thread[0]); ++l)
+                    {
+                        ccl_params_t params = {
+                            .num_threads = threads,
+                            .variant = CCL_TEMP_TAG_STRIPS,
+                            .strips_per_thread = strips_per_thread[k],
+                            .sections_per_thread = sections_per_thread[l]};
+                        double time = tuning_measure(img, tags, equiv_table, &params, &num_cc);
+                        if (num_cc != ref_cc)
+                        {
+                            fprintf(stderr, "calibration: %d components instead of %d with %d threads, discarded\n", num_cc, ref_cc, threads);
+                            continue;
+                        }
+                        if (time < best.time)
+                        {
+                            best.params = params;
+                            best.time = time;
+                        }
+                    }
+                }
+                if (threads == max_threads)
+                {
+                    break;
+                }
+            }
+
+            printf("%dx%d, density %.2f: %d threads, %s, %d strips/thread, %d sections/thread: %.6fs\n",
+                img->width, img->height, best.density, best.params.num_threads, tuning_variant_name(best.params.variant),
+                best.params.strips_per_thread, best.params.sections_per_thread, best.time);
+            profile[profile_size++] = best;
+
+            image_delete(tags);
+            image_delete(img);
+        }
+    }
+
+    free(equiv_table);
+    omp_set_num_threads(saved_threads);
+    return (ccl_profile_save(fname) == 0) ? profile_size : -1;
+}
@@ -0,0 +1,520 @@
+/**
+ * @file image_volume.c
+ * @brief Image processing library: volumes (stacks of slices) and 3D connected components labeling
+ * @author Saint-Cirgue Arnaud _ Correge Etienne
+ * @version 0.1
+ * @date november 2023
+ */
+
+/**
+ * 3D labeling follows the strips variant of the 2D first pass (see ccl_temp_tag_strips()), with slabs of
+ * consecutive slices instead of strips of rows. Slabs are tagged independently, each with its own equivalence
+ * table; local tags are then shifted by the number of tags of the previous slabs, so that tags follow the
+ * raster order (slice by slice), and the boundary between two slabs is joined. Equivalences are reduced and
+ * voxels renumbered as in 2D (ccl_reduce_equivalences()), then components are analyzed slab by slab.
+ *
+ * Labels are 32-bit: a volume easily holds more than MAX_TAGS temporary tags.
+ * Voxel (x, y, z) has label labels[((size_t)z * height + y) * width + x].
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include "image_volume.h"
+#include "image_bitmap.h"
+#include "image_memory.h"
+#include "utils.h"
+#include <omp.h>
+
+/**
+ * @brief Create a volume from slices
+ * @param slices depth images of identical dimensions: bitmaps, or grayscale or color images (binarized with
+ *  the default settings, see image_threshold_default_options())
+ * @param depth number of slices
+ * @return Handle of a new volume, which owns the slices; NULL if the dimensions differ (slices are left to the caller)
+ */
+image_volume_t *image_volume_new_from_slices(image_t **slices, int depth)
+{
+    assert(slices && depth > 0);
+    for (int z = 1; z < depth; ++z)
+    {
+        if (slices[z]->width != slices[0]->width || slices[z]->height != slices[0]->height)
+        {
+            DEBUG_PRINT("Slice %d of %dx%d pixels, slice 0 of %dx%d pixels", z,
+                slices[z]->width, slices[z]->height, slices[0]->width, slices[0]->height);
+            return NULL;
+        }
+    }
+
+    image_volume_t *self = calloc(1, sizeof(image_volume_t));
+    if (!self)
+    {
+        return NULL;
+    }
+    self->width = slices[0]->width;
+    self->height = slices[0]->height;
+    self->depth = depth;
+    self->slices = malloc(depth * sizeof(image_t *));
+    assert(self->slices);
+
+    for (int z = 0; z < depth; ++z)
+    {
+        self->slices[z] = slices[z];
+        if (slices[z]->type != IMAGE_BITMAP)
+        {
+            self->slices[z] = image_new_threshold(slices[z], NULL);
+            assert(self->slices[z]);
+            image_delete(slices[z]);
+        }
+    }
+    return self;
+}
+
+/**
+ * @brief Open a volume, from a stack of slice files
+ * @param path directory of slice files (in name order: slice 0 first), or text file listing slice paths
+ * @return Handle of a new volume, NULL if a slice cannot be read or the dimensions differ.
+ */
+image_volume_t *image_volume_open(const char *path)
+{
+    char **files;
+    int num_files = image_batch_list(path, &files);
+    if (num_files <= 0)
+    {
+        return NULL;
+    }
+
+    image_t **slices = calloc(num_files, sizeof(image_t *));
+    assert(slices);
+    image_volume_t *self = NULL;
+    int z;
+    for (z = 0; z < num_files; ++z)
+    {
+        slices[z] = image_new_open_mmap(files[z]);
+        if (!slices[z])
+        {
+            DEBUG_PRINT("Cannot read slice `%s`", files[z]);
+            break;
+        }
+    }
+    if (z == num_files)
+    {
+        self = image_volume_new_from_slices(slices, num_files);
+    }
+    if (!self)
+    {
+        for (z = 0; z < num_files && slices[z]; ++z)
+        {
+            image_delete(slices[z]);
+        }
+    }
+
+    free(slices);
+    image_batch_list_delete(files, num_files);
+    return self;
+}
+
+/**
+ * @brief Release a volume, and its slices
+ * @param self a volume
+ */
+void image_volume_delete(image_volume_t *self)
+{
+    for (int z = 0; z < self->depth; ++z)
+    {
+        image_delete(self->slices[z]);
+    }
+    free(self->slices);
+    free(self);
+}
+
+/**
+ * @brief Number of voxels of a volume: number of entries of a labels table
+ * @param self a volume
+ * @return width * height * depth
+ */
+size_t image_volume_num_voxels(const image_volume_t *self)
+{
+    return (size_t)self->width * self->height * self->depth;
+}
+
+/**
+ * @brief Take a neighbor's tag into account
+ * @param equiv equivalence table
+ * @param tag tag of the current voxel so far (0: none yet)
+ * @param tag_nb tag of a neighbor (0: background)
+ * @return the new tag of the current voxel; both classes are joined if they differ
+ */
+static inline int vol_neighbor(int *equiv, int tag, int tag_nb)
+{
+    if (tag_nb == 0 || tag_nb == tag)
+    {
+        return tag;
+    }
+    if (tag == 0)
+    {
+        return tag_nb;
+    }
+    return join(equiv, tag, tag_nb);
+}
+
+/**
+ * @brief Assign temporary tags to the voxels of a slab of slices, ignoring voxels outside the slab
+ * @param self the input volume
+ * @param labels the (output) labels table (local to the slab: 1..n)
+ * @param connectivity voxel neighborhood
+ * @param z_begin first slice of the slab
+ * @param z_end slice after the last slice of the slab
+ * @param bg_color background color
+ * @param equiv (input/output) equivalence table of the slab, grown as needed
+ * @param capacity (input/output) number of entries of *equiv
+ * @return the number of temporary tags of the slab
+ *
+ * Neighbors already tagged in raster order: West and North (6-connectivity), or West, North-West, North and
+ * North-East (26-connectivity) in the current slice; the same pixel (6) or its 3x3 neighborhood (26)
+ * in the previous slice.
+ */
+static int vol_tag_slab(
+      const image_volume_t *self,
+      int *labels,
+      ccl_connectivity_t connectivity,
+      int z_begin,
+      int z_end,
+      bool bg_color,
+      int **equiv,
+      int *capacity)
+{
+    int width = self->width;
+    int height = self->height;
+    size_t plane = (size_t)width * height;
+    int num_tags = 0;
+
+    for (int z = z_begin; z < z_end; ++z)
+    {
+        const image_t *slice = self->slices[z];
+        for (int y = 0; y < height; ++y)
+        {
+            const uint8_t *pxl_row = image_row(slice, y);
+            int *lab = labels + z * plane + (size_t)y * width;
+            const int *lab_n = (y > 0) ? lab - width : NULL;
+            /* rows y-1, y and y+1 of the previous slice: NULL outside the slab or the slice */
+            const int *lab_p[3] = {NULL, NULL, NULL};
+            if (z > z_begin)
+            {
+                for (int dy = -1; dy <= 1; ++dy)
+                {
+                    if (y + dy >= 0 && y + dy < height)
+                    {
+                        lab_p[dy + 1] = lab - plane + dy * width;
+                    }
+                }
+            }
+
+            int x = 0;
+            while (x < width)
+            {
+                /* skip the background run, 64 pixels at a time: its labels are zero */
+                int x_fg = bmp_row_find_next(pxl_row, width, x, !bg_color);
+                memset(&lab[x], 0, (x_fg - x) * sizeof(int));
+
+                /* then tag the foreground run */
+                int x_bg = bmp_row_find_next(pxl_row, width, x_fg, bg_color);
+                for (x = x_fg; x < x_bg; ++x)
+                {
+                    int tag = (x > x_fg) ? lab[x - 1] : 0;
+                    if (connectivity == CCL_CONNECT_6)
+                    {
+                        tag = lab_n ? vol_neighbor(*equiv, tag, lab_n[x]) : tag;
+                        tag = lab_p[1] ? vol_neighbor(*equiv, tag, lab_p[1][x]) : tag;
+                    }
+                    else
+                    {
+                        for (int xn = MAX(x - 1, 0); xn <= MIN(x + 1, width - 1); ++xn)
+                        {
+                            tag = lab_n ? vol_neighbor(*equiv, tag, lab_n[xn]) : tag;
+                            for (int k = 0; k < 3; ++k)
+                            {
+                                tag = lab_p[k] ? vol_neighbor(*equiv, tag, lab_p[k][xn]) : tag;
+                            }
+                        }
+                    }
+
+                    if (tag == 0)
+                    {
+                        if (++num_tags >= *capacity)
+                        {
+                            int old_capacity = *capacity;
+                            *capacity = 2 * *capacity + 256;
+                            *equiv = mem_track_realloc(*equiv, old_capacity * sizeof(int), *capacity * sizeof(int));
+                            assert(*equiv);
+                        }
+                        tag = num_tags;
+                        (*equiv)[tag] = tag;
+                    }
+                    lab[x] = tag;
+                }
+            }
+        }
+    }
+    return num_tags;
+}
+
+/**
+ * @brief Join the first slice of a slab with the last slice of the previous one
+ * @param self the input volume
+ * @param labels labels table (global temporary tags)
+ * @param connectivity voxel neighborhood
+ * @param z first slice of the slab (> 0)
+ * @param equiv equivalence table
+ */
+static void vol_join_boundary(const image_volume_t *self, const int *labels, ccl_connectivity_t connectivity, int z, int *equiv)
+{
+    int width = self->width;
+    int height = self->height;
+    size_t plane = (size_t)width * height;
+
+    for (int y = 0; y < height; ++y)
+    {
+        const int *lab = labels + z * plane + (size_t)y * width;
+        for (int x = 0; x < width; ++x)
+        {
+            if (lab[x] == 0)
+            {
+                continue;
+            }
+            if (connectivity == CCL_CONNECT_6)
+            {
+                const int *lab_p = lab - plane;
+                if (lab_p[x] > 0)
+                {
+                    join(equiv, lab_p[x], lab[x]);
+                }
+                continue;
+            }
+            for (int yn = MAX(y - 1, 0); yn <= MIN(y + 1, height - 1); ++yn)
+            {
+                const int *lab_p = labels + (z - 1) * plane + (size_t)yn * width;
+                for (int xn = MAX(x - 1, 0); xn <= MIN(x + 1, width - 1); ++xn)
+                {
+                    if (lab_p[xn] > 0)
+                    {
+                        join(equiv, lab_p[xn], lab[x]);
+                    }
+                }
+            }
+        }
+    }
+}
+
+/**
+ * @brief Analyze 3D connected components, slab by slab (each one has its own partial table, merged at the end)
+ * @param self the input volume
+ * @param labels labels table (renumbered: 1..num_classes)
+ * @param con_cmp table of connected components (zeroed)
+ * @param num_classes number of connected components
+ * @param num_slabs number of slabs
+ */
+static void vol_analyze(const image_volume_t *self, const int *labels, image_volume_component_t *con_cmp, int num_classes, int num_slabs)
+{
+    int width = self->width;
+    int height = self->height;
+    size_t plane = (size_t)width * height;
+    image_volume_component_t *temp_con_cmp = mem_track_calloc((size_t)num_slabs * num_classes, sizeof(image_volume_component_t));
+    assert(temp_con_cmp);
+
+    #pragma omp parallel for schedule(dynamic)
+    for (int s = 0; s < num_slabs; ++s)
+    {
+        image_volume_component_t *cmp = temp_con_cmp + (size_t)s * num_classes;
+        int z_begin = (long)self->depth * s / num_slabs;
+        int z_end = (long)self->depth * (s + 1) / num_slabs;
+        for (int z = z_begin; z < z_end; ++z)
+        {
+            for (int y = 0; y < height; ++y)
+            {
+                const int *lab = labels + z * plane + (size_t)y * width;
+                for (int x = 0; x < width; ++x)
+                {
+                    if (lab[x] == 0)
+                    {
+                        continue;
+                    }
+                    image_volume_component_t *c = &cmp[lab[x] - 1];
+                    if (c->num_voxels == 0)
+                    {
+                        *c = (image_volume_component_t){.x1 = x, .x2 = x, .y1 = y, .y2 = y, .z1 = z, .z2 = z, .num_voxels = 1};
+                    }
+                    else
+                    {
+                        c->num_voxels++;
+                        c->x1 = MIN(c->x1, x);
+                        c->y1 = MIN(c->y1, y);
+                        c->x2 = MAX(c->x2, x);
+                        c->y2 = MAX(c->y2, y);
+                        c->z2 = z;
+                    }
+                }
+            }
+        }
+    }
+
+    /* merge the partial tables: each thread owns a range of components */
+    #pragma omp parallel for schedule(static)
+    for (int t = 0; t < num_classes; ++t)
+    {
+        for (int s = 0; s < num_slabs; ++s)
+        {
+            const image_volume_component_t *c = &temp_con_cmp[(size_t)s * num_classes + t];
+            if (c->num_voxels == 0)
+            {
+                continue;
+            }
+            if (con_cmp[t].num_voxels == 0)
+            {
+                con_cmp[t] = *c;
+            }
+            else
+            {
+                con_cmp[t].num_voxels += c->num_voxels;
+                con_cmp[t].x1 = MIN(con_cmp[t].x1, c->x1);
+                con_cmp[t].y1 = MIN(con_cmp[t].y1, c->y1);
+                con_cmp[t].x2 = MAX(con_cmp[t].x2, c->x2);
+                con_cmp[t].y2 = MAX(con_cmp[t].y2, c->y2);
+                con_cmp[t].z2 = c->z2;
+            }
+        }
+    }
+
+    mem_track_free(temp_con_cmp, (size_t)num_slabs * num_classes * sizeof(image_volume_component_t));
+}
+
+/**
+ * @brief Label the 3D connected components of a volume
+ * @param self the input volume
+ * @param labels the (output) labels table, image_volume_num_voxels() entries: connected component numbers
+ *  (1..num_cc, 0 for background)
+ * @param connectivity voxel neighborhood
+ * @param stats (output) components table, timings; may be NULL
+ * @return the number of connected components
+ *
+ * By convention, background is the color of the first voxel (top-left pixel of slice 0).
+ * Slabs are tagged in parallel, one slab per OpenMP thread (at most one slab per slice).
+ */
+int image_volume_connected_components(const image_volume_t *self, int *labels, ccl_connectivity_t connectivity, ccl_volume_stats_t *stats)
+{
+    double time[5];
+    assert(self && labels);
+    assert(connectivity == CCL_CONNECT_6 || connectivity == CCL_CONNECT_26);
+
+    int width = self->width;
+    int height = self->height;
+    size_t plane = (size_t)width * height;
+    int num_slabs = LIMIT(omp_get_max_threads(), 1, self->depth);
+    bool bg_color = image_bmp_row_get(image_row(self->slices[0], 0), 0);
+
+    time[0] = omp_get_wtime();
+
+    /* ~~~~~~~~~~ First pass: temporary tags, slab by slab ~~~~~~~~~~ */
+    int *first_tag = mem_track_calloc(num_slabs + 1, sizeof(int));
+    int **slab_equiv = mem_track_calloc(num_slabs, sizeof(int *));
+    int *capacity = mem_track_calloc(num_slabs, sizeof(int));
+    assert(first_tag && slab_equiv && capacity);
+
+    #pragma omp parallel for schedule(dynamic)
+    for (int s = 0; s < num_slabs; ++s)
+    {
+        int z_begin = (long)self->depth * s / num_slabs;
+        int z_end = (long)self->depth * (s + 1) / num_slabs;
+        first_tag[s + 1] = vol_tag_slab(self, labels, connectivity, z_begin, z_end, bg_color, &slab_equiv[s], &capacity[s]);
+    }
+
+    /* tags of slab s are first_tag[s]+1 .. first_tag[s+1] */
+    for (int s = 0; s < num_slabs; ++s)
+    {
+        first_tag[s + 1] += first_tag[s];
+    }
+    int num_tags = first_tag[num_slabs];
+    int *equiv_table = mem_track_malloc((num_tags + 1) * sizeof(int));
+    assert(equiv_table);
+
+    #pragma omp parallel for schedule(dynamic)
+    for (int s = 0; s < num_slabs; ++s)
+    {
+        int offset = first_tag[s];
+        int num_local = first_tag[s + 1] - offset;
+        for (int t = 1; t <= num_local; ++t)
+        {
+            equiv_table[offset + t] = offset + slab_equiv[s][t];
+        }
+        mem_track_free(slab_equiv[s], capacity[s] * sizeof(int));
+
+        if (offset > 0)
+        {
+            int z_begin = (long)self->depth * s / num_slabs;
+            int z_end = (long)self->depth * (s + 1) / num_slabs;
+            int *lab = labels + z_begin * plane;
+            for (size_t i = 0; i < (z_end - z_begin) * plane; ++i)
+            {
+                lab[i] += (lab[i] != 0) ? offset : 0;
+            }
+        }
+    }
+    time[1] = omp_get_wtime();
+
+    /* ~~~~~~~~~~ Slab boundaries, equivalences ~~~~~~~~~~ */
+    for (int s = 1; s < num_slabs; ++s)
+    {
+        vol_join_boundary(self, labels, connectivity, (long)self->depth * s / num_slabs, equiv_table);
+    }
+
+    int *class_num = mem_track_calloc(num_tags + 1, sizeof(int));
+    assert(class_num);
+    int num_cc = ccl_reduce_equivalences(equiv_table, num_tags, class_num);
+    mem_track_free(equiv_table, (num_tags + 1) * sizeof(int));
+    time[2] = omp_get_wtime();
+
+    /* ~~~~~~~~~~ Retag ~~~~~~~~~~ */
+    #pragma omp parallel for schedule(static)
+    for (long r = 0; r < (long)self->depth * height; ++r)
+    {
+        int *lab = labels + r * width;
+        for (int x = 0; x < width; ++x)
+        {
+            lab[x] = class_num[lab[x]];
+        }
+    }
+    mem_track_free(class_num, (num_tags + 1) * sizeof(int));
+    time[3] = omp_get_wtime();
+
+    /* ~~~~~~~~~~ Analysis ~~~~~~~~~~ */
+    if (stats)
+    {
+        image_volume_component_t *con_cmp = calloc(MAX(num_cc, 1), sizeof(image_volume_component_t));
+        assert(con_cmp);
+        vol_analyze(self, labels, con_cmp, num_cc, num_slabs);
+
+        stats->largest_cc = 0;
+        for (int t = 1; t < num_cc; ++t)
+        {
+            if (con_cmp[t].num_voxels > con_cmp[stats->largest_cc].num_voxels)
+            {
+                stats->largest_cc = t;
+            }
+        }
+        stats->con_cmp = con_cmp;
+        stats->num_threads = omp_get_max_threads();
+        stats->num_slabs = num_slabs;
+    }
+    time[4] = omp_get_wtime();
+
+    if (stats)
+    {
+        memcpy(stats->time, time, sizeof(time));
+    }
+    mem_track_free(capacity, num_slabs * sizeof(int));
+    mem_track_free(slab_equiv, num_slabs * sizeof(int *));
+    mem_track_free(first_tag, (num_slabs + 1) * sizeof(int));
+    return num_cc;
+}
@@ -9,36 +9,444 @@
 #include <stdlib.h>
 #include <omp.h>
 #include "image_lib.h"
+#include "image_server.h"
+#include "image_tuning.h"
+#include "image_cache.h"
+#include "image_tracking.h"
+#include "image_volume.h"
+#include "image_spatial.h"
 
 
+/**
+ * @brief Append the timings of a run to main.csv
+ * @param num_threads number of OpenMP threads of the run
+ * @param time step timestamps (see ccl_stats_t)
+ * @param mem memory footprint of each step (see ccl_stats_t)
+ */
+static void write_time_csv(int num_threads, const double *time, const mem_track_t *mem)
+{
+  size_t peak = 0;
+  for (int t = 1; t < 7; ++t)
+  {
+    peak = MAX(peak, mem[t].peak);
+  }
+
+  FILE *csvFile = fopen("main.csv", "a");  // Ouvre le fichier en mode écriture
+
+  if (csvFile == NULL) {
+    perror("Erreur lors de l'ouverture du fichier");
+    return;
+  }
+
+  fprintf(csvFile, "%d,%.6f,%.6f,%.6f,%.6f,%zu\n",
+    num_threads,
+    time[5] - time[0],
+    time[1] - time[0],  
+    time[4] - time[3],
+    time[5] - time[4],
+    peak);
+
+  fclose(csvFile);  // Ferme le fichier
+}
+
 void test_image_connected_components(const char *fname)
 {
-  /* Allocate image structure for input image (expect a bitmap, i.e; black/white image) */
-  image_t *img = image_new_open(fname);
+  /* Allocate image structure for input image (a bitmap, i.e. black/white image, or a grayscale/color image to binarize) */
+  image_t *img = image_new_open_mmap(fname);
   assert(img);
-  assert(img->type == IMAGE_BITMAP);
 
   /* Allocate a 2D table (image) structure for holding tags; as a 16bit grayscale so that it can hold up to 65536 temp tags */
   image_t *img_tag = image_new(img->width, img->height, IMAGE_GRAYSCALE_16);
   assert(img_tag);
 
-  /* Allocate image structure for output color image, for visualization */
-  image_t *img_colors = image_new(img->width, img->height, IMAGE_RGB_888);
+  /* Allocate image structure for output color image, for visualization (only drawn in debug builds) */
+  image_t *img_colors = NULL;
+#ifdef DEBUG
+  img_colors = image_new(img->width, img->height, IMAGE_RGB_888);
   assert(img_colors);
+#endif
 
   /* Actually call the connected components labelling procedure */
-  (void)image_connected_components(img, img_tag, img_colors);
+  ccl_stats_t stats;
+  int num_cc = image_connected_components(img, img_tag, img_colors, &stats);
+  if (num_cc < 0)
+  {
+    DIE("Cannot label `%s`: more than %d temporary tags\n", fname, MAX_TAGS - 1);
+  }
+  double *time = stats.time;
+
+  double t_save = omp_get_wtime();
+  if (stats.cached == 1)
+  {
+    printf("Components found in the cache, without label map: classes.pgm not written.\n");
+  }
+  else
+  {
+#ifdef DEBUG
+    image_save_ascii(img_tag, "classes.pgm");
+    /* use BIN format for large images: optimize for speed */
+    image_save_binary(img_colors, "color.ppm");
+#else
+    image_save_binary(img_tag, "classes.pgm");
+#endif
+  }
+  t_save = omp_get_wtime() - t_save;
+
+  printf("Found %d connected components.\n", num_cc);
+  if (num_cc > 0)
+  {
+    printf("Largest connected component is class #%06d, has %9d pixels.\n", stats.largest_cc, stats.con_cmp[stats.largest_cc].num_pixels);
+  }
+
+  printf("Total time: %.6fs; temp tag: %.6f, save tags %.6f, reduce_equiv %.6f, retag %.6f, analyze %.6f, color %.6f, save classes %.6f\n", 
+    time[5] - time[0],
+    time[1] - time[0], 
+    time[2] - time[1], 
+    time[3] - time[2], 
+    time[4] - time[3],
+    time[5] - time[4],
+    time[6] - time[5],
+    t_save);
+
+  /* memory held by the library: images, labeling tables */
+  const mem_track_t *mem = stats.mem;
+  printf("Memory (MiB, end/peak): start %.2f; temp tag %.2f/%.2f, save tags %.2f/%.2f, reduce_equiv %.2f/%.2f, retag %.2f/%.2f, analyze %.2f/%.2f, color %.2f/%.2f\n",
+    mem[0].current / 1048576.0,
+    mem[1].current / 1048576.0, mem[1].peak / 1048576.0,
+    mem[2].current / 1048576.0, mem[2].peak / 1048576.0,
+    mem[3].current / 1048576.0, mem[3].peak / 1048576.0,
+    mem[4].current / 1048576.0, mem[4].peak / 1048576.0,
+    mem[5].current / 1048576.0, mem[5].peak / 1048576.0,
+    mem[6].current / 1048576.0, mem[6].peak / 1048576.0);
+
+  write_time_csv(stats.num_threads, time, mem);
+  free(stats.con_cmp);
 
   image_delete(img_tag);
-  image_delete(img_colors);
+  if (img_colors)
+  {
+    image_delete(img_colors);
+  }
   image_delete(img);
   return;
 }
 
+/**
+ * @brief Label all images of a batch, with the pipelined batch driver
+ * @param path directory of .pbm files, or text file listing image paths
+ * @param n_threads number of cores for labeling, shared by all images in progress
+ * @param out_dir output directory, or NULL
+ */
+void test_image_batch(const char *path, int n_threads, const char *out_dir)
+{
+  char **files;
+  int num_files = image_batch_list(path, &files);
+  if (num_files < 0)
+  {
+    DIE("Cannot read batch `%s`\n", path);
+  }
+
+  /* two-level parallelism: up to n_threads images at once, big images get several of the n_threads cores */
+  image_batch_options_t options = image_batch_default_options();
+  options.num_cores = n_threads;
+  options.max_pool_threads = 2 * n_threads;
+  options.num_labelers = n_threads;
+  options.num_threads = MIN(n_threads, CCL_MAX_THREADS);
+  options.out_dir = out_dir;
+
+  image_batch_result_t *results = calloc(MAX(num_files, 1), sizeof(image_batch_result_t));
+  assert(results);
+
+  double t0 = omp_get_wtime();
+  int processed = image_batch_run(files, num_files, &options, results);
+  double t1 = omp_get_wtime();
+
+  for (int i = 0; i < num_files; ++i)
+  {
+    if (results[i].num_cc < 0)
+    {
+      printf("%s: not processed\n", results[i].fname);
+      continue;
+    }
+    printf("%s: %dx%d, %d connected components, largest has %u pixels\n",
+      results[i].fname, results[i].width, results[i].height, results[i].num_cc, results[i].largest_cc);
+  }
+  printf("Processed %d/%d images in %.6fs\n", processed, num_files, t1 - t0);
+
+  free(results);
+  image_batch_list_delete(files, num_files);
+}
+
+/**
+ * @brief Track connected components along a sequence of frames, with persistent identifiers
+ * @param path directory of .pbm frames (in name order), or text file listing frame paths
+ * @param n_threads number of OpenMP threads
+ */
+void test_image_sequence(const char *path, int n_threads)
+{
+  char **files;
+  int num_files = image_batch_list(path, &files);
+  if (num_files < 0)
+  {
+    DIE("Cannot read sequence `%s`\n", path);
+  }
+  omp_set_num_threads(n_threads);
+
+  ccl_sequence_t *seq = NULL;
+  for (int i = 0; i < num_files; ++i)
+  {
+    image_t *img = image_new_open_mmap(files[i]);
+    if (!img)
+    {
+      continue;
+    }
+    if (!seq)
+    {
+      seq = ccl_sequence_new(img->width, img->height);
+      assert(seq);
+    }
+
+    double t0 = omp_get_wtime();
+    int num_cc = ccl_sequence_push(seq, img);
+    double t1 = omp_get_wtime();
+    if (num_cc < 0)
+    {
+      printf("%s: %dx%d, not the size of the sequence or too many components, skipped\n", files[i], img->width, img->height);
+    }
+    else
+    {
+      printf("%s: %d connected components (%d new, %d lost), %.1f%% of pixels labeled in %d regions, %.6fs\n",
+        files[i], num_cc, seq->num_new, seq->num_lost,
+        100.0 * seq->relabeled_pixels / ((double)seq->width * seq->height), seq->num_regions, t1 - t0);
+#ifdef DEBUG
+      for (int t = 0; t < seq->num_tracks; ++t)
+      {
+        const ccl_track_t *track = &seq->tracks[t];
+        DEBUG_PRINT("id %d (age %d): (%d,%d)-(%d,%d), %u pixels", track->id, track->age,
+          track->cc.x1, track->cc.y1, track->cc.x2, track->cc.y2, track->cc.num_pixels);
+      }
+#endif
+    }
+    image_delete(img);
+  }
+
+  if (seq)
+  {
+    printf("%d frames, %d identifiers\n", seq->num_frames, seq->next_id);
+    ccl_sequence_delete(seq);
+  }
+  image_batch_list_delete(files, num_files);
+}
+
+/**
+ * @brief Label the 3D connected components of a stack of slices
+ * @param path directory of .pbm slices (in name order), or text file listing slice paths
+ * @param n_threads number of OpenMP threads
+ * @param connectivity 6 or 26
+ */
+void test_image_volume(const char *path, int n_threads, int connectivity)
+{
+  image_volume_t *vol = image_volume_open(path);
+  if (!vol)
+  {
+    DIE("Cannot read volume `%s`\n", path);
+  }
+  omp_set_num_threads(n_threads);
+
+  int *labels = malloc(image_volume_num_voxels(vol) * sizeof(int));
+  assert(labels);
+
+  ccl_volume_stats_t stats;
+  int num_cc = image_volume_connected_components(vol, labels, (connectivity == 26) ? CCL_CONNECT_26 : CCL_CONNECT_6, &stats);
+  double *time = stats.time;
+
+  printf("Volume %dx%dx%d, %d-connectivity: found %d connected components.\n",
+    vol->width, vol->height, vol->depth, (connectivity == 26) ? 26 : 6, num_cc);
+  if (num_cc > 0)
+  {
+    const image_volume_component_t *cc = &stats.con_cmp[stats.largest_cc];
+    printf("Largest connected component is class #%06d, has %9lu voxels, (%d,%d,%d)-(%d,%d,%d).\n", stats.largest_cc + 1,
+      cc->num_voxels, cc->x1, cc->y1, cc->z1, cc->x2, cc->y2, cc->z2);
+  }
+  printf("Total time: %.6fs (%d slabs); temp tag: %.6f, merge & reduce_equiv %.6f, retag %.6f, analyze %.6f\n",
+    time[4] - time[0], stats.num_slabs,
+    time[1] - time[0],
+    time[2] - time[1],
+    time[3] - time[2],
+    time[4] - time[3]);
+
+  free(stats.con_cmp);
+  free(labels);
+  image_volume_delete(vol);
+}
+
+/**
+ * @brief Label an image, then query the spatial index of its components around a pixel
+ * @param fname image file
+ * @param x pixel column
+ * @param y pixel row
+ * @param k number of nearest components to list
+ */
+void test_image_query(const char *fname, int x, int y, int k)
+{
+  image_t *img = image_new_open_mmap(fname);
+  if (!img)
+  {
+    DIE("Cannot read `%s`\n", fname);
+  }
+  image_t *img_tag = image_new(img->width, img->height, IMAGE_GRAYSCALE_16);
+  assert(img_tag);
+
+  ccl_stats_t stats;
+  int num_cc = image_connected_components(img, img_tag, NULL, &stats);
+  if (num_cc < 0)
+  {
+    DIE("Cannot label `%s`: more than %d temporary tags\n", fname, MAX_TAGS - 1);
+  }
+
+  double t0 = omp_get_wtime();
+  ccl_index_t *index = ccl_index_new(stats.con_cmp, num_cc, img->width, img->height);
+  double t1 = omp_get_wtime();
+  printf("Found %d connected components; spatial index: %dx%d cells of %dx%d pixels, built in %.6fs\n",
+    num_cc, index->cols, index->rows, index->cell_width, index->cell_height, t1 - t0);
+
+  k = MAX(k, 1);
+  int *found = malloc(MAX(num_cc, k) * sizeof(int));
+  assert(found);
+
+  t0 = omp_get_wtime();
+  int num_found = ccl_index_query_point(index, x, y, found, num_cc);
+  t1 = omp_get_wtime();
+  printf("%d components have (%d,%d) in their bounding box (%.6fs):", num_found, x, y, t1 - t0);
+  for (int i = 0; i < num_found; ++i)
+  {
+    printf(" #%06d", found[i]);
+  }
+  printf("\n");
+
+  t0 = omp_get_wtime();
+  num_found = ccl_index_nearest(index, x, y, k, found);
+  t1 = omp_get_wtime();
+  printf("%d nearest components (%.6fs):\n", num_found, t1 - t0);
+  for (int i = 0; i < num_found; ++i)
+  {
+    const image_connected_component_t *cc = &stats.con_cmp[found[i]];
+    printf("  #%06d: (%d,%d)-(%d,%d), %u pixels\n", found[i], cc->x1, cc->y1, cc->x2, cc->y2, cc->num_pixels);
+  }
+
+  free(found);
+  ccl_index_delete(index);
+  free(stats.con_cmp);
+  image_delete(img_tag);
+  image_delete(img);
+}
+
 int main(int argc, char **argv)
 {
+  /* NUMA placement of image buffers, for all modes: IMAGE_ALLOC=first_touch|interleave */
+  char *alloc_policy = getenv("IMAGE_ALLOC");
+  if (alloc_policy && !strcmp(alloc_policy, "first_touch"))
+  {
+    image_set_alloc_policy(IMAGE_ALLOC_FIRST_TOUCH);
+  }
+  else if (alloc_policy && !strcmp(alloc_policy, "interleave"))
+  {
+    image_set_alloc_policy(IMAGE_ALLOC_INTERLEAVE);
+  }
+  /* back large image buffers with huge pages: IMAGE_HUGEPAGES=1 */
+  char *hugepages = getenv("IMAGE_HUGEPAGES");
+  image_set_alloc_hugepages(hugepages && atoi(hugepages));
+
+  /* binarization of grayscale/color inputs: IMAGE_THRESHOLD=otsu|adaptive|<gray level> */
+  char *threshold = getenv("IMAGE_THRESHOLD");
+  if (threshold)
+  {
+    image_threshold_options_t options = image_threshold_default_options();
+    if (!strcmp(threshold, "adaptive"))
+    {
+      options.method = IMAGE_THRESHOLD_ADAPTIVE;
+    }
+    else if (strcmp(threshold, "otsu"))
+    {
+      options.method = IMAGE_THRESHOLD_GLOBAL;
+      options.level = atoi(threshold);
+    }
+    image_threshold_set_default_options(&options);
+  }
+
+  /* labeling parameters tuned by a calibration run: CCL_PROFILE=<profile path> */
+  char *profile = getenv("CCL_PROFILE");
+  if (profile && ccl_profile_load(profile) < 0)
+  {
+    fprintf(stderr, "Cannot read profile `%s`\n", profile);
+  }
+
+  /* cache of labeling results: CCL_CACHE=<directory>, CCL_CACHE_LABELS=1 to also store label maps */
+  char *cache = getenv("CCL_CACHE");
+  if (cache)
+  {
+    char *cache_labels = getenv("CCL_CACHE_LABELS");
+    ccl_cache_set_dir(cache, cache_labels && atoi(cache_labels));
+  }
+
+  /* calibration mode: main -t <profile path> [max_threads] */
+  if (argc > 2 && !strcmp(argv[1], "-t"))
+  {
+    return (ccl_calibrate((argc > 3) ? atoi(argv[3]) : omp_get_num_procs(), argv[2]) < 0) ? 1 : 0;
+  }
+
+  /* daemon mode: main -d <socket path|-> [n_threads]; "-" serves requests from stdin, replies on stdout */
+  if (argc > 2 && !strcmp(argv[1], "-d"))
+  {
+    image_server_t *server = image_server_new((argc > 3) ? atoi(argv[3]) : 1);
+    int res = 0;
+    if (!strcmp(argv[2], "-"))
+    {
+      image_server_serve(server, stdin, stdout);
+    }
+    else
+    {
+      res = image_server_listen(server, argv[2]);
+    }
+    image_server_delete(server);
+    return res ? 1 : 0;
+  }
+
   printf("Started.\n");
 
+  /* batch mode: main -b <directory|list file> [n_threads] [output directory] */
+  if (argc > 2 && !strcmp(argv[1], "-b"))
+  {
+    int n_threads = (argc > 3) ? atoi(argv[3]) : 1;
+    test_image_batch(argv[2], n_threads, (argc > 4) ? argv[4] : NULL);
+    printf("Finished.\n");
+    return 0;
+  }
+
+  /* sequence mode: main -s <directory|list file> [n_threads]; components tracked from frame to frame */
+  if (argc > 2 && !strcmp(argv[1], "-s"))
+  {
+    test_image_sequence(argv[2], (argc > 3) ? atoi(argv[3]) : 1);
+    printf("Finished.\n");
+    return 0;
+  }
+
+  /* volume mode: main -v <directory|list file> [n_threads] [6|26]; slices stacked in name order */
+  if (argc > 2 && !strcmp(argv[1], "-v"))
+  {
+    test_image_volume(argv[2], (argc > 3) ? atoi(argv[3]) : 1, (argc > 4) ? atoi(argv[4]) : 6);
+    printf("Finished.\n");
+    return 0;
+  }
+
+  /* query mode: main -q <file> <x> <y> [k]; components around a pixel, from the spatial index */
+  if (argc > 4 && !strcmp(argv[1], "-q"))
+  {
+    test_image_query(argv[2], atoi(argv[3]), atoi(argv[4]), (argc > 5) ? atoi(argv[5]) : 1);
+    printf("Finished.\n");
+    return 0;
+  }
+
   char *filename = "img/test1.pbm";
   if (argc > 1)
   {
@@ -37,6 +37,19 @@ rgb_t rgb_from_3f(float r, float g, float b)
         255.0 * LIMIT(b, 0.0, 1.0));
 }
 
+/**
+ * @brief Convert floating-point levels of red, green, blue into a 8-bit gray level (ITU-R BT.601 luma)
+ * @param r level of red (internally constrained 0.0 to 1.0)
+ * @param g level of green (internally constrained 0.0 to 1.0)
+ * @param b level of blue (internally constrained 0.0 to 1.0)
+ * @return gray level
+ */
+gs8_t gs8_from_3f(float r, float g, float b)
+{
+    float y = 0.299f * r + 0.587f * g + 0.114f * b;
+    return 255.0f * LIMIT(y, 0.0f, 1.0f);
+}
+
 /* Convert color to RGB from other color spaces */
 
 /**
@@ -56,7 +69,8 @@ rgb_t rgb_from_hsv(hsv_t hsv)
 
     if (s <= 0.0)
     {
-        return rgb_from_3f(0.0, 0.0, 0.0);
+        /* no saturation: a gray level */
+        return rgb_from_3f(v, v, v);
     }
 
     while (h >= 360.) {h -= 360.;}
@@ -138,4 +152,170 @@ hsv_t hsv_from_rgb(rgb_t rgb)
     }
     v = cmax;
     return (hsv_t){.h = h, .s = s, .v = v};
-}
\ No newline at end of file
+}
+/*
+ * Batched conversions: arrays of n pixels (typically a pixel row).
+ *
+ * Loops have no data-dependent branches (conditions compile to selects, min/max),
+ * so that the compiler vectorizes them; conversions follow the single-pixel functions above.
+ * Float selects are only vectorized with -fno-trapping-math (see Makefile).
+ * On x86-64, kernels are compiled for AVX2, SSSE3 (needed to de-interleave RGB bytes) and the baseline,
+ * and the best version is selected at load time.
+ */
+#if defined(__GNUC__) && defined(__x86_64__)
+#define PIXEL_SIMD_CLONES __attribute__((target_clones("avx2", "ssse3", "default")))
+#else
+#define PIXEL_SIMD_CLONES
+#endif
+
+/**
+ * @brief Constrain a level to 0.0..1.0 (a function rather than LIMIT(): nested macros defeat the vectorizer)
+ */
+static inline float pixel_clamp(float x)
+{
+    x = MAX(x, 0.0f);
+    return MIN(x, 1.0f);
+}
+
+/**
+ * @brief Convert RGB colors into 8-bit gray levels (ITU-R BT.601 luma, 8-bit fixed point)
+ * @param dst (output) gray levels
+ * @param src RGB colors
+ * @param n number of pixels
+ */
+PIXEL_SIMD_CLONES
+void gs8_from_rgb_n(gs8_t *restrict dst, const rgb_t *restrict src, int n)
+{
+    #pragma omp simd
+    for (int i = 0; i < n; ++i)
+    {
+        /* 0.299, 0.587, 0.114 scaled by 256 */
+        dst[i] = (77 * src[i].r + 150 * src[i].g + 29 * src[i].b + 128) >> 8;
+    }
+}
+
+/**
+ * @brief Convert floating-point gray levels (0.0 to 1.0) into 8-bit gray levels
+ * @param dst (output) 8-bit gray levels
+ * @param src floating-point gray levels (internally constrained 0.0 to 1.0)
+ * @param n number of pixels
+ */
+PIXEL_SIMD_CLONES
+void gs8_from_fl_n(gs8_t *restrict dst, const float *restrict src, int n)
+{
+    #pragma omp simd
+    for (int i = 0; i < n; ++i)
+    {
+        dst[i] = (int)(255.0f * pixel_clamp(src[i]));
+    }
+}
+
+/**
+ * @brief Convert 8-bit gray levels into floating-point gray levels (0.0 to 1.0)
+ * @param dst (output) floating-point gray levels
+ * @param src 8-bit gray levels
+ * @param n number of pixels
+ */
+PIXEL_SIMD_CLONES
+void fl_from_gs8_n(float *restrict dst, const gs8_t *restrict src, int n)
+{
+    #pragma omp simd
+    for (int i = 0; i < n; ++i)
+    {
+        dst[i] = src[i] * (1.0f / 255.0f);
+    }
+}
+
+/**
+ * @brief Convert hue-saturation-value colors into RGB colors
+ * @param dst (output) RGB colors
+ * @param src hue-saturation-value colors (any hue; saturation and value 0.0 to 1.0)
+ * @param n number of pixels
+ *
+ * Each channel is v - v.s.clamp(min(k, 4 - k), 0, 1), with k = (c + h / 60) mod 6 and c = 5, 3, 1 for red, green, blue:
+ * the same result as the 6-sector switch of rgb_from_hsv(), without branches.
+ */
+PIXEL_SIMD_CLONES
+void rgb_from_hsv_n(rgb_t *restrict dst, const hsv_t *restrict src, int n)
+{
+    /* blocks of pixels: de-interleave, convert with vector code, then interleave */
+    float h[64], s[64], v[64];
+    uint8_t r8[64], g8[64], b8[64];
+
+    for (int i0 = 0; i0 < n; i0 += 64)
+    {
+        int m = MIN(64, n - i0);
+        for (int i = 0; i < m; ++i)
+        {
+            h[i] = src[i0 + i].h;
+            s[i] = src[i0 + i].s;
+            v[i] = src[i0 + i].v;
+        }
+
+        #pragma omp simd
+        for (int i = 0; i < m; ++i)
+        {
+            float hue = h[i] * (1.0f / 60.0f);
+            float vs = v[i] * MAX(s[i], 0.0f);
+
+            /* hue wrapping, without loops: hue - 6 * floor(hue / 6) */
+            float turns = (int)(hue * (1.0f / 6.0f));
+            turns -= (turns > hue * (1.0f / 6.0f)) ? 1.0f : 0.0f;
+            hue -= 6.0f * turns;
+
+            float kr = 5.0f + hue, kg = 3.0f + hue, kb = 1.0f + hue;
+            kr -= (kr >= 6.0f) ? 6.0f : 0.0f;
+            kg -= (kg >= 6.0f) ? 6.0f : 0.0f;
+            kb -= (kb >= 6.0f) ? 6.0f : 0.0f;
+
+            float r = v[i] - vs * pixel_clamp(MIN(kr, 4.0f - kr));
+            float g = v[i] - vs * pixel_clamp(MIN(kg, 4.0f - kg));
+            float b = v[i] - vs * pixel_clamp(MIN(kb, 4.0f - kb));
+
+            r8[i] = (int)(255.0f * pixel_clamp(r));
+            g8[i] = (int)(255.0f * pixel_clamp(g));
+            b8[i] = (int)(255.0f * pixel_clamp(b));
+        }
+
+        for (int i = 0; i < m; ++i)
+        {
+            dst[i0 + i] = (rgb_t){r8[i], g8[i], b8[i]};
+        }
+    }
+}
+
+/**
+ * @brief Convert RGB colors into hue-saturation-value colors
+ * @param dst (output) hue-saturation-value colors
+ * @param src RGB colors
+ * @param n number of pixels
+ */
+PIXEL_SIMD_CLONES
+void hsv_from_rgb_n(hsv_t *restrict dst, const rgb_t *restrict src, int n)
+{
+    #pragma omp simd
+    for (int i = 0; i < n; ++i)
+    {
+        float r = src[i].r * (1.0f / 255.0f);
+        float g = src[i].g * (1.0f / 255.0f);
+        float b = src[i].b * (1.0f / 255.0f);
+
+        float cmax = MAX(MAX(r, g), b);
+        float cmin = MIN(MIN(r, g), b);
+        float diff = cmax - cmin;
+        /* avoid divisions by 0; results are then discarded */
+        float inv_diff = 1.0f / ((diff > 0.0f) ? diff : 1.0f);
+        float inv_max = 1.0f / ((cmax > 0.0f) ? cmax : 1.0f);
+
+        /* hue sector, in units of 60 degrees: -1..1 (red), 1..3 (green), 3..5 (blue) */
+        float h = (cmax == r) ? (g - b) * inv_diff :
+                  (cmax == g) ? 2.0f + (b - r) * inv_diff :
+                                4.0f + (r - g) * inv_diff;
+        h = 60.0f * h;
+        h += (h < 0.0f) ? 360.0f : 0.0f;
+
+        dst[i].h = (diff > 0.0f) ? h : 0.0f;
+        dst[i].s = diff * inv_max;
+        dst[i].v = cmax;
+    }
+}
@@ -0,0 +1,113 @@
+/**
+ * @file queue.c
+ * @brief Bounded, blocking FIFO queue of pointers, for connecting pipeline stages
+ * @author Saint-Cirgue Arnaud _ Correge Etienne
+ * @version 0.1
+ * @date november 2023
+ */
+#include "queue.h"
+
+/**
+ * @brief Constructor
+ * @param size the capacity of the queue
+ * @return pointer to queue, or NULL
+ */
+queue_t *queue_new(int size)
+{
+    assert(size > 0);
+    queue_t *self = calloc(1, sizeof(queue_t));
+    if (!self)
+    {
+        return NULL;
+    }
+    self->buffer = calloc(size, sizeof(void *));
+    if (!self->buffer)
+    {
+        free(self);
+        return NULL;
+    }
+    self->size = size;
+    pthread_mutex_init(&self->mutex, NULL);
+    pthread_cond_init(&self->not_empty, NULL);
+    pthread_cond_init(&self->not_full, NULL);
+    return self;
+}
+
+/**
+ * @brief Destructor; remaining items are not freed
+ * @param self queue to deallocate
+ */
+void queue_delete(queue_t *self)
+{
+    pthread_cond_destroy(&self->not_full);
+    pthread_cond_destroy(&self->not_empty);
+    pthread_mutex_destroy(&self->mutex);
+    free(self->buffer);
+    free(self);
+}
+
+/**
+ * @brief Push an item; block while the queue is full
+ * @param self a queue
+ * @param item pointer to store on queue
+ * @return QUEUE_OK, or QUEUE_CLOSED if the queue was closed
+ */
+int queue_push(queue_t *self, void *item)
+{
+    assert(self);
+    pthread_mutex_lock(&self->mutex);
+    while (self->length == self->size && !self->closed)
+    {
+        pthread_cond_wait(&self->not_full, &self->mutex);
+    }
+    if (self->closed)
+    {
+        pthread_mutex_unlock(&self->mutex);
+        return QUEUE_CLOSED;
+    }
+    self->buffer[(self->read_idx + self->length) % self->size] = item;
+    self->length++;
+    pthread_cond_signal(&self->not_empty);
+    pthread_mutex_unlock(&self->mutex);
+    return QUEUE_OK;
+}
+
+/**
+ * @brief Pop an item; block while the queue is empty and not closed
+ * @param self a queue
+ * @param item pointer that will store the item popped
+ * @return QUEUE_OK, or QUEUE_CLOSED if the queue is closed and empty
+ */
+int queue_pop(queue_t *self, void **item)
+{
+    assert(self && item);
+    pthread_mutex_lock(&self->mutex);
+    while (self->length == 0 && !self->closed)
+    {
+        pthread_cond_wait(&self->not_empty, &self->mutex);
+    }
+    if (self->length == 0)
+    {
+        pthread_mutex_unlock(&self->mutex);
+        return QUEUE_CLOSED;
+    }
+    *item = self->buffer[self->read_idx];
+    self->read_idx = (self->read_idx + 1) % self->size;
+    self->length--;
+    pthread_cond_signal(&self->not_full);
+    pthread_mutex_unlock(&self->mutex);
+    return QUEUE_OK;
+}
+
+/**
+ * @brief Close the queue: no more items will be pushed; consumers drain the remaining items, then get QUEUE_CLOSED
+ * @param self a queue
+ */
+void queue_close(queue_t *self)
+{
+    pthread_mutex_lock(&self->mutex);
+    self->closed = 1;
+    pthread_cond_broadcast(&self->not_empty);
+    pthread_cond_broadcast(&self->not_full);
+    pthread_mutex_unlock(&self->mutex);
+}